@@ -0,0 +1,155 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <array>
+#include <random>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include "../include/CommonUtils.hpp"
+#include "../include/WordDistanceHandler.hpp"
+
+/**
+ * Compares the length-specialized unrestricted distance kernels against the generic one they replace, on the names of the
+ * binaries of the PATH. Only the BK-tree runs these kernels: the speedups apply to lookups with lookupEngine set to bkTree,
+ * not to the default linear scan, which scores with the bit-parallel optimal string alignment kernel.
+ *
+ * Usage: kernelBenchmark [directory...]   (defaults to the directories of $PATH)
+ *
+ * Queries are typos (one to three random edits) of names drawn from the directories, and every query is compared against
+ * every name, as when the BK-tree is walked. The pairs are grouped by the length class the dispatcher picks for them, and
+ * for each class the best of benchmarkRuns runs of both kernels is reported in nanoseconds per pair. The benchmark fails
+ * if the kernels disagree on any pair.
+ */
+
+static const int benchmarkRuns = 5;
+static const std::size_t benchmarkQueryCount = 200;
+static const unsigned benchmarkSeed = 42;
+
+struct LengthClass {
+    const char * name;
+    std::size_t maxLength;
+    std::vector<std::pair<std::string_view, std::string_view>> pairs;
+};
+
+static std::string generateTypo(std::string name, std::mt19937& generator) {
+    static const std::string alphabet = "abcdefghijklmnopqrstuvwxyz";
+    std::uniform_int_distribution<std::size_t> characterDistribution(0, alphabet.size() - 1);
+
+    const int edits = std::uniform_int_distribution<int>(1, 3)(generator);
+    for (int edit = 0; edit < edits && !name.empty(); ++edit) {
+        const std::size_t position = std::uniform_int_distribution<std::size_t>(0, name.size() - 1)(generator);
+        switch (std::uniform_int_distribution<int>(0, 3)(generator)) {
+            case 0:
+                name.insert(name.begin() + position, alphabet[characterDistribution(generator)]);
+                break;
+            case 1:
+                name.erase(position, 1);
+                break;
+            case 2:
+                name[position] = alphabet[characterDistribution(generator)];
+                break;
+            default:
+                if (position + 1 < name.size())
+                    std::swap(name[position], name[position + 1]);
+        }
+    }
+    return name;
+}
+
+template <typename Kernel>
+static double measureBestNanosecondsPerPair(const std::vector<std::pair<std::string_view, std::string_view>>& pairs, Kernel kernel, long& checksum) {
+    double best = 1e300;
+    for (int run = 0; run < benchmarkRuns; ++run) {
+        long sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& [query, name] : pairs)
+            sum += kernel(query, name);
+        auto end = std::chrono::steady_clock::now();
+        checksum = sum;
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(pairs.size()));
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> directories;
+    for (int i = 1; i < argc; ++i)
+        directories.push_back(argv[i]);
+
+    if (directories.empty()) {
+        std::stringstream ss(getenv("PATH") ? getenv("PATH") : "");
+        std::string directory;
+        while (getline(ss, directory, ':'))
+            if (std::filesystem::is_directory(directory))
+                directories.push_back(directory);
+    }
+
+    std::set<std::string> nameSet;
+    for (const std::vector<std::string>& files : CommonUtils::getListsOfFilesInPaths(directories, false, true))
+        nameSet.insert(files.begin(), files.end());
+    const std::vector<std::string> names(nameSet.begin(), nameSet.end());
+    if (names.empty()) {
+        std::cerr<<"error: no executables found\n";
+        return 1;
+    }
+
+    std::mt19937 generator(benchmarkSeed);
+    std::vector<std::string> queries;
+    for (std::size_t i = 0; i < benchmarkQueryCount; ++i)
+        queries.push_back(generateTypo(names[std::uniform_int_distribution<std::size_t>(0, names.size() - 1)(generator)], generator));
+
+    std::array<LengthClass, 5> lengthClasses = {{
+        {"<=8", 8, {}}, {"<=16", 16, {}}, {"<=32", 32, {}}, {"<=64", UNRESTRICTED_KERNEL_MAX_LENGTH, {}}, {">64", SIZE_MAX, {}}
+    }};
+    for (const std::string& query : queries) {
+        for (const std::string& name : names) {
+            const std::size_t longestLength = std::max(query.size(), name.size());
+            for (LengthClass& lengthClass : lengthClasses) {
+                if (longestLength <= lengthClass.maxLength) {
+                    lengthClass.pairs.emplace_back(query, name);
+                    break;
+                }
+            }
+        }
+    }
+
+    std::cout<<"executables: "<<names.size()<<", queries: "<<queries.size()<<"\n";
+    std::cout<<"unrestricted distance kernels of the BK-tree engine (lookupEngine=bkTree)\n";
+    std::cout<<"class   pairs        generic ns   specialized ns   speedup\n";
+
+    bool identical = true;
+    double genericTotal = 0;
+    double specializedTotal = 0;
+    for (const LengthClass& lengthClass : lengthClasses) {
+        if (lengthClass.pairs.empty())
+            continue;
+
+        long genericChecksum = 0;
+        long specializedChecksum = 0;
+        const double generic = measureBestNanosecondsPerPair(lengthClass.pairs, WordDistanceHandler::calculateGenericUnrestrictedWordDistance, genericChecksum);
+        const double specialized = measureBestNanosecondsPerPair(lengthClass.pairs, WordDistanceHandler::calculateUnrestrictedWordDistance, specializedChecksum);
+
+        for (const auto& [query, name] : lengthClass.pairs) {
+            if (WordDistanceHandler::calculateGenericUnrestrictedWordDistance(query, name) != WordDistanceHandler::calculateUnrestrictedWordDistance(query, name)) {
+                std::cerr<<"error: the kernels disagree on \""<<query<<"\" and \""<<name<<"\"\n";
+                identical = false;
+                break;
+            }
+        }
+        identical = identical && genericChecksum == specializedChecksum;
+
+        const double pairCount = static_cast<double>(lengthClass.pairs.size());
+        genericTotal += generic * pairCount;
+        specializedTotal += specialized * pairCount;
+        std::printf("%-7s %-12zu %-12.1f %-16.1f %.2fx\n", lengthClass.name, lengthClass.pairs.size(), generic, specialized, generic / specialized);
+    }
+    std::printf("all pairs: generic %.1f ms, specialized %.1f ms, %.2fx\n", genericTotal / 1e6, specializedTotal / 1e6, genericTotal / specializedTotal);
+
+    return identical ? 0 : 1;
+}
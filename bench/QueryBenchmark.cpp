@@ -0,0 +1,562 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+#include "../include/Settings.hpp"
+#include "../include/BinaryIndex.hpp"
+#include "../include/BKTree.hpp"
+#include "../include/CandidateStore.hpp"
+#include "../include/QGramIndex.hpp"
+#include "../include/CommandSuggester.hpp"
+#include "../include/QueryArena.hpp"
+#include "../include/SymSpellIndex.hpp"
+#include "../include/PrefixTrie.hpp"
+#include "../include/ThreadPool.hpp"
+#include "../include/Engine.hpp"
+
+/**
+ * End-to-end benchmark of the lookup over synthetic PATH trees.
+ *
+ * Usage: queryBenchmark [size...]   (defaults to 1000 10000 100000 1000000 executables)
+ *
+ * For each size, a PATH of benchmarkDirectoryCount directories is generated in a temporary directory, with names drawn
+ * from a length distribution close to the one of a desktop /usr/bin, together with a corpus of typos of those names at
+ * edit distance 1 to 3. Each stage of the lookup is timed separately, and the result is printed as one JSON object per
+ * size, with the p50 and p99 of every stage in microseconds:
+ *
+ *     settingsLoad      Settings construction, reading settings.json
+ *     directoryScan     full scan of the directories and index write, the index file being removed before each run
+ *     indexRefresh      refresh of an up-to-date index (mapping and mtime checks only)
+ *     structuresLoad    loading of the persisted BK-tree (and q-gram index when enabled)
+ *     heuristicFilter   length slice, letter and q-gram heuristics, per query
+ *     distanceScoring   scoring with the default engine, the linear scan, spread over the cores as in smile when enough
+ *                       binaries pass the heuristics, per query
+ *     ranking           ranking and bounding of the suggestions, per query
+ *     query             the three per-query stages together
+ *     bkTreeScoring     BK-tree search, per query
+ *     linearScoring     linear scan of the filtered binaries on one thread, per query
+ *     parallelScoring   the same scan spread over a thread pool, per query
+ *     symSpellScoring   lookup in the SymSpell index, per query, including the queries it cannot answer
+ *     prefixTrieScoring walk of the prefix trie, per query
+ *
+ * Every heap allocation of the process is counted by the replaced operator new below. The per-query stages run as in
+ * smile, over a QueryArena, and must not allocate, nor must the BK-tree search: the number of allocations they made is
+ * reported as queryAllocations. Over the same arena, the allocations of the parallel scan, workers included, of the
+ * SymSpell lookup and of the prefix trie walk are reported as parallelAllocations, symSpellAllocations and
+ * prefixTrieAllocations. The Engine with the default settings is then queried as smile does, query cache included, once
+ * its first queries opened the cache and sized its arena: its allocations are reported as engineQueryAllocations. The
+ * benchmark fails if any of these counts is not 0.
+ *
+ * The parallel scan uses SMILE_BENCH_SCORING_THREADS threads (defaults to the number of cores, at least 2), whatever the
+ * threshold of the settings. It must return the same binaries as the linear one, with and without a maximum number of
+ * suggestions and a margin: the queries for which they differ are reported as parallelMismatches, and the benchmark fails
+ * if there is any. The same goes for the SymSpell lookup (symSpellMismatches), on the queries it can answer, whose
+ * binaries and distances must be those of the linear scan; the others are counted as symSpellFallbacks. The BK-tree search and the prefix trie walk must return the binaries of the linear
+ * scan on every query, with and without the ties (bkTreeMismatches and prefixTrieMismatches). The share of the BK-tree
+ * nodes the search computed the distance of is reported as visitedNodeFraction.
+ *
+ * Before the corpora, a lookup limited to one suggestion must return, among binaries tied at the minimum distance, the
+ * one sharing the longest prefix with the command even when it comes later in the index.
+ */
+
+static const std::size_t benchmarkDirectoryCount = 16;
+static const std::size_t benchmarkQueryCount = 500;
+static const std::size_t benchmarkScanRuns = 5;
+static const std::size_t benchmarkLoadRuns = 20;
+static const unsigned benchmarkSeed = 42;
+// Maximum number of suggestions and margin of the second comparison of the linear and parallel scans, to exercise ties
+static const std::size_t benchmarkTieMaxResults = 3;
+static const int benchmarkTieMargin = 1;
+
+static std::atomic<std::size_t> allocationCount{0};
+
+void * operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void * pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void * operator new(std::size_t size, std::align_val_t alignment) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t alignmentSize = static_cast<std::size_t>(alignment);
+    if (void * pointer = std::aligned_alloc(alignmentSize, (std::max<std::size_t>(size, 1) + alignmentSize - 1) / alignmentSize * alignmentSize))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+// The replaced operator new allocates with malloc, which GCC cannot see once the operators are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void * pointer) noexcept { std::free(pointer); }
+void operator delete(void * pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void * pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void * pointer, std::size_t, std::align_val_t) noexcept { std::free(pointer); }
+#pragma GCC diagnostic pop
+
+struct Typo {
+    std::string query;
+    int distance;
+};
+
+static std::string generateName(std::mt19937& generator) {
+    // Lengths of the names in a desktop /usr/bin, from 2 to 24 characters
+    static const std::vector<double> lengthWeights = {0, 0, 3, 6, 8, 9, 9, 9, 8, 7, 6, 5, 4, 4, 3, 3, 2, 2, 2, 1, 1, 1, 1, 1, 1};
+    static const std::vector<std::string> prefixes = {"", "", "", "", "", "", "git-", "x86_64-linux-gnu-", "lib", "py", "gnome-", "kde", "xdg-", "perl", "llvm-"};
+    static const std::string alphabet = "abcdefghijklmnopqrstuvwxyzaeiouaeiourstlnrstln0123456789-_.";
+
+    std::discrete_distribution<std::size_t> lengthDistribution(lengthWeights.begin(), lengthWeights.end());
+    std::uniform_int_distribution<std::size_t> prefixDistribution(0, prefixes.size() - 1);
+    std::uniform_int_distribution<std::size_t> characterDistribution(0, alphabet.size() - 1);
+
+    const std::size_t length = lengthDistribution(generator);
+    std::string name = prefixes[prefixDistribution(generator)];
+    if (name.size() >= length)
+        name.clear();
+
+    // Names start with a letter
+    name += alphabet[characterDistribution(generator) % 26];
+    while (name.size() < length)
+        name += alphabet[characterDistribution(generator)];
+    return name;
+}
+
+/**
+ * Applies the given number of random edits (insertion, deletion, substitution or transposition) to a name.
+ */
+static std::string generateTypo(std::string name, int edits, std::mt19937& generator) {
+    static const std::string alphabet = "abcdefghijklmnopqrstuvwxyz";
+    std::uniform_int_distribution<std::size_t> characterDistribution(0, alphabet.size() - 1);
+
+    for (int edit = 0; edit < edits; ++edit) {
+        const std::size_t position = std::uniform_int_distribution<std::size_t>(0, name.size() - 1)(generator);
+        switch (std::uniform_int_distribution<int>(0, 3)(generator)) {
+            case 0:
+                name.insert(name.begin() + position, alphabet[characterDistribution(generator)]);
+                break;
+            case 1:
+                if (name.size() > 1) {
+                    name.erase(position, 1);
+                    break;
+                }
+                [[fallthrough]];
+            case 2:
+                name[position] = alphabet[characterDistribution(generator)];
+                break;
+            default:
+                if (position + 1 < name.size())
+                    std::swap(name[position], name[position + 1]);
+                else
+                    name[position] = alphabet[characterDistribution(generator)];
+        }
+    }
+    return name;
+}
+
+static std::vector<std::string> generateCorpus(const std::filesystem::path& root, std::size_t size, std::mt19937& generator, std::vector<std::string>& names) {
+    std::vector<std::string> directories;
+    for (std::size_t i = 0; i < benchmarkDirectoryCount; ++i) {
+        directories.push_back((root / ("bin" + std::to_string(i))).string());
+        std::filesystem::create_directories(directories.back());
+    }
+
+    names.clear();
+    names.reserve(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        names.push_back(generateName(generator));
+        const std::string path = directories[i % benchmarkDirectoryCount] + "/" + names.back();
+        int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0755);
+        if (fd >= 0)
+            close(fd);
+    }
+    return directories;
+}
+
+static void writeSettingsFile(const std::filesystem::path& home, const std::vector<std::string>& directories, double qGramJaccardThreshold) {
+    std::filesystem::create_directories(home / ("." PROJECT_NAME));
+
+    json settingsFile;
+    settingsFile["databaseHistoryStorageEnabled"] = false;
+    settingsFile["systemBinariesPath"] = directories;
+    settingsFile["ignoreMntFromSystemPathVariables"] = DEFAULT_IGNORE_MNT_FROM_SYSTEM_PATH_VARIABLES;
+    settingsFile["lengthConditionHeuristicEnabled"] = DEFAULT_LENGTH_CONDITION_ENABLED;
+    settingsFile["lengthConditionHeuristic"] = DEFAULT_LENGTH_CONDITION_HEURISTIC;
+    settingsFile["qGramJaccardThreshold"] = qGramJaccardThreshold;
+
+    std::ofstream file(home / ("." PROJECT_NAME) / SETTINGS_FILE_NAME);
+    file<<settingsFile;
+}
+
+template <typename Function>
+static double measureMicroseconds(Function function) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static json summarize(std::vector<double> samples) {
+    if (samples.empty())
+        return json::object();
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double fraction) {
+        return samples[std::min(samples.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(samples.size())))];
+    };
+    return json{{"p50", percentile(0.5)}, {"p99", percentile(0.99)}, {"samples", samples.size()}};
+}
+
+/**
+ * Looks up "abcd" among "bcd" and "abcdx", both at distance 1, with a single suggestion: "bcd" is first in the index,
+ * ordered by length, but "abcdx" shares the longest prefix with the command.
+ *
+ * @return true if "abcdx" is suggested.
+ */
+static bool checkTieRanking() {
+    const std::filesystem::path root = std::filesystem::temp_directory_path() / ("smile-bench-ties-" + std::to_string(getpid()));
+    std::filesystem::remove_all(root);
+    const std::filesystem::path directory = root / "bin";
+    std::filesystem::create_directories(directory);
+    for (const char * name : {"bcd", "abcdx"}) {
+        int fd = open((directory / name).c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0755);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    setenv("HOME", root.c_str(), 1);
+    writeSettingsFile(root, {directory.string()}, DEFAULT_Q_GRAM_JACCARD_THRESHOLD);
+
+    bool ranked;
+    {
+        Settings settings;
+        Engine engine(settings);
+        engine.refresh();
+        const std::pmr::vector<std::string_view> similarCommands = engine.query("abcd", 1);
+        ranked = similarCommands.size() == 1 && similarCommands.front() == "abcdx";
+    }
+    std::filesystem::remove_all(root);
+    return ranked;
+}
+
+static json benchmarkCorpus(std::size_t size, double qGramJaccardThreshold) {
+    std::mt19937 generator(benchmarkSeed);
+    const std::filesystem::path root = std::filesystem::temp_directory_path() / ("smile-bench-" + std::to_string(getpid()));
+    std::filesystem::remove_all(root);
+
+    std::vector<std::string> names;
+    std::vector<std::string> directories = generateCorpus(root, size, generator, names);
+
+    std::vector<Typo> typos;
+    for (std::size_t i = 0; i < benchmarkQueryCount; ++i) {
+        const int distance = static_cast<int>(i % 3) + 1;
+        typos.push_back({generateTypo(names[std::uniform_int_distribution<std::size_t>(0, names.size() - 1)(generator)], distance, generator), distance});
+    }
+
+    setenv("HOME", root.c_str(), 1);
+    writeSettingsFile(root, directories, qGramJaccardThreshold);
+
+    std::vector<double> settingsLoad, directoryScan, indexRefresh, structuresLoad, heuristicFilter, distanceScoring, ranking, query, bkTreeScoring, linearScoring, parallelScoring, symSpellScoring, prefixTrieScoring;
+
+    for (std::size_t run = 0; run < benchmarkLoadRuns; ++run)
+        settingsLoad.push_back(measureMicroseconds([]() { Settings settings; }));
+
+    Settings settings;
+    for (std::size_t run = 0; run < benchmarkScanRuns; ++run) {
+        std::filesystem::remove(settings.getBinaryIndexFilePath());
+        directoryScan.push_back(measureMicroseconds([&settings]() {
+            BinaryIndex binaryIndex(settings.getBinaryIndexFilePath());
+            binaryIndex.refresh(settings.getSystemPathVariablePaths());
+        }));
+    }
+
+    BinaryIndex binaryIndex(settings.getBinaryIndexFilePath());
+    for (std::size_t run = 0; run < benchmarkLoadRuns; ++run)
+        indexRefresh.push_back(measureMicroseconds([&binaryIndex, &settings]() { binaryIndex.refresh(settings.getSystemPathVariablePaths()); }));
+
+    const CandidateStore& candidates = binaryIndex.getCandidates();
+
+    // The first load builds and saves the structures, the following ones measure loading them
+    BKTree bkTree;
+    QGramIndex qGramIndex;
+    const double buildMicroseconds = measureMicroseconds([&]() {
+        bkTree.loadOrBuild(binaryIndex, settings.getBkTreeFilePath());
+        if (qGramJaccardThreshold > 0)
+            qGramIndex.loadOrBuild(candidates, binaryIndex.getFingerprint(), settings.getQGramIndexFilePath());
+    });
+    for (std::size_t run = 0; run < benchmarkLoadRuns; ++run) {
+        structuresLoad.push_back(measureMicroseconds([&]() {
+            bkTree.loadOrBuild(binaryIndex, settings.getBkTreeFilePath());
+            if (qGramJaccardThreshold > 0)
+                qGramIndex.loadOrBuild(candidates, binaryIndex.getFingerprint(), settings.getQGramIndexFilePath());
+        }));
+    }
+
+    SymSpellIndex symSpellIndex;
+    symSpellIndex.loadOrBuild(candidates, binaryIndex.getFingerprint(), settings.getSymSpellMaxDistance(), settings.getSymSpellIndexFilePath());
+    PrefixTrie prefixTrie;
+    prefixTrie.loadOrBuild(candidates, binaryIndex.getFingerprint(), settings.getPrefixTrieFilePath());
+
+    const char * threads = getenv("SMILE_BENCH_SCORING_THREADS");
+    const std::size_t scoringThreads = std::max<std::size_t>(threads != nullptr ? std::stoul(threads) : ThreadPool::getThreadCount(SIZE_MAX), 2);
+    ThreadPool threadPool(scoringThreads);
+
+    std::size_t suggestions = 0;
+    std::size_t visitedNodes = 0;
+    std::size_t recovered = 0;
+    std::size_t queryAllocations = 0;
+    std::size_t parallelAllocations = 0;
+    std::size_t symSpellAllocations = 0;
+    std::size_t prefixTrieAllocations = 0;
+    QueryArena arena(candidates.size());
+    // The pool the default engine spreads the scoring over, started before the queries as the engine keeps it between them
+    const std::size_t engineThreads = ThreadPool::getThreadCount(SIZE_MAX);
+    std::unique_ptr<ThreadPool> engineThreadPool = engineThreads > 1 ? std::make_unique<ThreadPool>(engineThreads) : nullptr;
+    // The task queue of the pool grows on its first use only
+    CommandSuggester::findClosestCommands(typos.front().query, candidates, CommandSuggester::filterCandidates(typos.front().query, candidates, settings, &qGramIndex),
+        settings, 0, 0, std::pmr::get_default_resource(), &threadPool);
+    for (const Typo& typo : typos) {
+        arena.release();
+        const std::size_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+
+        CommandSuggester::CandidateFilter candidateFilter{CandidateStore::Slice{}, std::pmr::vector<std::uint8_t>(arena.get())};
+        std::pmr::vector<CommandSuggester::Suggestion> matches(arena.get());
+        BKTree::SearchResult nearestBinaries{std::pmr::vector<BKTree::Match>(arena.get())};
+        std::pmr::vector<std::string_view> similarCommands(arena.get());
+
+        const double filterTime = measureMicroseconds([&]() {
+            candidateFilter = CommandSuggester::filterCandidates(typo.query, candidates, settings, &qGramIndex, arena.get());
+        });
+        const double scoringTime = measureMicroseconds([&]() {
+            ThreadPool * threadPool = CommandSuggester::shouldScoreInParallel(candidateFilter, settings) ? engineThreadPool.get() : nullptr;
+            matches = CommandSuggester::findClosestCommands(typo.query, candidates, candidateFilter, settings, 0, 0, arena.get(), threadPool);
+        });
+        const double rankingTime = measureMicroseconds([&]() {
+            similarCommands = CommandSuggester::rankSuggestions(typo.query, matches, nullptr, 0, static_cast<std::size_t>(settings.getMaxSuggestions()), arena.get());
+        });
+        const double bkTreeTime = measureMicroseconds([&]() {
+            nearestBinaries = bkTree.findBest(binaryIndex, typo.query, settings.getMaxEditDistance(), 0, 0,
+                [&candidateFilter](std::uint32_t nameId) { return candidateFilter.accepts(nameId); }, arena.get());
+        });
+
+        queryAllocations += allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+
+        // The other engines, over the same arena. The parallel scan is run whatever the number of binaries, and the
+        // allocations of its workers are counted as well
+        std::size_t engineAllocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        CommandSuggester::findClosestCommands(typo.query, candidates, candidateFilter, settings, 0, 0, arena.get(), &threadPool);
+        parallelAllocations += allocationCount.load(std::memory_order_relaxed) - engineAllocationsBefore;
+
+        auto passesFilter = [&candidateFilter](std::uint32_t nameId) { return candidateFilter.accepts(nameId); };
+        engineAllocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        symSpellIndex.findBest(candidates, typo.query, settings.getMaxEditDistance(), 0, 0, passesFilter, arena.get());
+        symSpellAllocations += allocationCount.load(std::memory_order_relaxed) - engineAllocationsBefore;
+
+        engineAllocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        prefixTrie.findBest(candidates, typo.query, settings.getMaxEditDistance(), 0, 0, candidateFilter.slice, passesFilter, arena.get());
+        prefixTrieAllocations += allocationCount.load(std::memory_order_relaxed) - engineAllocationsBefore;
+
+        heuristicFilter.push_back(filterTime);
+        distanceScoring.push_back(scoringTime);
+        ranking.push_back(rankingTime);
+        query.push_back(filterTime + scoringTime + rankingTime);
+        bkTreeScoring.push_back(bkTreeTime);
+
+        suggestions += similarCommands.size();
+        visitedNodes += nearestBinaries.visitedNodes;
+        if (!matches.empty() && matches.front().distance <= typo.distance)
+            ++recovered;
+    }
+
+    // The engine as smile runs it, with the default settings. Its first queries open the query cache, size the arena
+    // and, when they are scored in parallel, start the pool: the first half of the queries is run once before counting,
+    // so that the second half stores its suggestions in the query cache and the first half finds them there
+    std::size_t engineQueryAllocations = 0;
+    {
+        Engine engine(settings);
+        engine.refresh();
+        for (std::size_t i = 0; i < typos.size() / 2; ++i)
+            engine.query(typos[i].query);
+        for (const Typo& typo : typos) {
+            const std::size_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+            engine.query(typo.query);
+            engineQueryAllocations += allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+        }
+    }
+
+    std::size_t parallelMismatches = 0;
+    std::size_t symSpellMismatches = 0;
+    std::size_t symSpellFallbacks = 0;
+    std::size_t prefixTrieMismatches = 0;
+    std::size_t bkTreeMismatches = 0;
+    for (const Typo& typo : typos) {
+        const CommandSuggester::CandidateFilter candidateFilter = CommandSuggester::filterCandidates(typo.query, candidates, settings, &qGramIndex);
+        auto sameSuggestions = [](const auto& first, const auto& second) {
+            return std::ranges::equal(first, second, [](const auto& a, const auto& b) { return a.name == b.name && a.distance == b.distance; });
+        };
+
+        std::pmr::vector<CommandSuggester::Suggestion> linear, parallel;
+        linearScoring.push_back(measureMicroseconds([&]() {
+            linear = CommandSuggester::findClosestCommands(typo.query, candidates, candidateFilter, settings, 0, static_cast<std::size_t>(settings.getMaxSuggestions()), std::pmr::get_default_resource());
+        }));
+        parallelScoring.push_back(measureMicroseconds([&]() {
+            parallel = CommandSuggester::findClosestCommands(typo.query, candidates, candidateFilter, settings, 0, static_cast<std::size_t>(settings.getMaxSuggestions()), std::pmr::get_default_resource(), &threadPool);
+        }));
+        bool identical = sameSuggestions(linear, parallel);
+
+        SymSpellIndex::SearchResult symSpellResult{std::pmr::vector<SymSpellIndex::Match>()};
+        symSpellScoring.push_back(measureMicroseconds([&]() {
+            symSpellResult = symSpellIndex.findBest(candidates, typo.query, settings.getMaxEditDistance(), static_cast<std::size_t>(settings.getMaxSuggestions()), 0,
+                [&candidateFilter](std::uint32_t nameId) { return candidateFilter.accepts(nameId); });
+        }));
+        if (!symSpellResult.complete)
+            ++symSpellFallbacks;
+        else {
+            std::pmr::vector<CommandSuggester::Suggestion> symSpell;
+            for (const SymSpellIndex::Match& match : symSpellResult.matches)
+                symSpell.push_back({candidates.getName(match.nameId), match.distance});
+            std::ranges::sort(symSpell, {}, &CommandSuggester::Suggestion::name);
+            if (!sameSuggestions(linear, symSpell))
+                ++symSpellMismatches;
+        }
+
+        auto findWithBkTree = [&](int margin, std::size_t maxResults) {
+            std::pmr::vector<CommandSuggester::Suggestion> tree;
+            for (const BKTree::Match& match : bkTree.findBest(binaryIndex, typo.query, settings.getMaxEditDistance(), maxResults, margin,
+                    [&candidateFilter](std::uint32_t nameId) { return candidateFilter.accepts(nameId); }).matches)
+                tree.push_back({candidates.getName(match.nameId), match.distance});
+            std::ranges::sort(tree, {}, &CommandSuggester::Suggestion::name);
+            return tree;
+        };
+        bool bkTreeIdentical = sameSuggestions(linear, findWithBkTree(0, static_cast<std::size_t>(settings.getMaxSuggestions())));
+
+        auto findWithPrefixTrie = [&](int margin, std::size_t maxResults) {
+            std::pmr::vector<CommandSuggester::Suggestion> trie;
+            for (const PrefixTrie::Match& match : prefixTrie.findBest(candidates, typo.query, settings.getMaxEditDistance(), maxResults, margin, candidateFilter.slice,
+                    [&candidateFilter](std::uint32_t nameId) { return candidateFilter.accepts(nameId); }).matches)
+                trie.push_back({candidates.getName(match.nameId), match.distance});
+            std::ranges::sort(trie, {}, &CommandSuggester::Suggestion::name);
+            return trie;
+        };
+        std::pmr::vector<CommandSuggester::Suggestion> trie;
+        prefixTrieScoring.push_back(measureMicroseconds([&]() { trie = findWithPrefixTrie(0, static_cast<std::size_t>(settings.getMaxSuggestions())); }));
+        bool trieIdentical = sameSuggestions(linear, trie);
+
+        linear = CommandSuggester::findClosestCommands(typo.query, candidates, candidateFilter, settings, benchmarkTieMargin, benchmarkTieMaxResults, std::pmr::get_default_resource());
+        parallel = CommandSuggester::findClosestCommands(typo.query, candidates, candidateFilter, settings, benchmarkTieMargin, benchmarkTieMaxResults, std::pmr::get_default_resource(), &threadPool);
+        identical = identical && sameSuggestions(linear, parallel);
+        trieIdentical = trieIdentical && sameSuggestions(linear, findWithPrefixTrie(benchmarkTieMargin, benchmarkTieMaxResults));
+        bkTreeIdentical = bkTreeIdentical && sameSuggestions(linear, findWithBkTree(benchmarkTieMargin, benchmarkTieMaxResults));
+        if (!bkTreeIdentical)
+            ++bkTreeMismatches;
+        if (!trieIdentical)
+            ++prefixTrieMismatches;
+
+        if (!identical)
+            ++parallelMismatches;
+    }
+
+    json result;
+    result["executables"] = size;
+    result["indexedNames"] = binaryIndex.size();
+    result["directories"] = directories.size();
+    result["queries"] = typos.size();
+    result["qGramJaccardThreshold"] = qGramJaccardThreshold;
+    result["structuresBuildMicroseconds"] = buildMicroseconds;
+    result["averageSuggestions"] = static_cast<double>(suggestions) / static_cast<double>(typos.size());
+    result["averageVisitedNodes"] = static_cast<double>(visitedNodes) / static_cast<double>(typos.size());
+    result["visitedNodeFraction"] = bkTree.size() > 0 ? static_cast<double>(visitedNodes) / static_cast<double>(typos.size()) / static_cast<double>(bkTree.size()) : 0;
+    // Queries for which the BK-tree did not return the binaries of the linear scan, which must stay at 0
+    result["bkTreeMismatches"] = bkTreeMismatches;
+    // Queries for which a binary at most as far as the number of edits was found
+    result["recoveredQueries"] = recovered;
+    // Heap allocations made by the per-query stages and by each engine, which must all stay at 0
+    result["queryAllocations"] = queryAllocations;
+    result["engineQueryAllocations"] = engineQueryAllocations;
+    result["parallelAllocations"] = parallelAllocations;
+    result["symSpellAllocations"] = symSpellAllocations;
+    result["prefixTrieAllocations"] = prefixTrieAllocations;
+    result["scoringThreads"] = scoringThreads;
+    // Queries for which the parallel scan did not return the binaries of the linear one, which must stay at 0
+    result["parallelMismatches"] = parallelMismatches;
+    result["symSpellFallbacks"] = symSpellFallbacks;
+    // Queries answered by the SymSpell index with other binaries or distances than the linear scan, which must stay at 0
+    result["symSpellMismatches"] = symSpellMismatches;
+    result["prefixTrieNodes"] = prefixTrie.size();
+    // Queries for which the prefix trie did not return the binaries of the linear scan, which must stay at 0
+    result["prefixTrieMismatches"] = prefixTrieMismatches;
+    result["stages"] = {
+        {"settingsLoad", summarize(settingsLoad)},
+        {"directoryScan", summarize(directoryScan)},
+        {"indexRefresh", summarize(indexRefresh)},
+        {"structuresLoad", summarize(structuresLoad)},
+        {"heuristicFilter", summarize(heuristicFilter)},
+        {"distanceScoring", summarize(distanceScoring)},
+        {"ranking", summarize(ranking)},
+        {"query", summarize(query)},
+        {"bkTreeScoring", summarize(bkTreeScoring)},
+        {"linearScoring", summarize(linearScoring)},
+        {"parallelScoring", summarize(parallelScoring)},
+        {"symSpellScoring", summarize(symSpellScoring)},
+        {"prefixTrieScoring", summarize(prefixTrieScoring)}
+    };
+
+    std::filesystem::remove_all(root);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::size_t> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::stoul(argv[i]));
+    if (sizes.empty())
+        sizes = {1000, 10000, 100000, 1000000};
+
+    const char * threshold = getenv("SMILE_BENCH_QGRAM_THRESHOLD");
+    const double qGramJaccardThreshold = threshold != nullptr ? std::stod(threshold) : DEFAULT_Q_GRAM_JACCARD_THRESHOLD;
+
+    bool passed = true;
+    if (!checkTieRanking()) {
+        std::cerr<<"error: a lookup limited to one suggestion did not keep the tie sharing the longest prefix with the command\n";
+        passed = false;
+    }
+
+    for (std::size_t size : sizes) {
+        const json result = benchmarkCorpus(size, qGramJaccardThreshold);
+        std::cout<<result.dump()<<std::endl;
+        for (const char * allocations : {"queryAllocations", "engineQueryAllocations", "parallelAllocations", "symSpellAllocations", "prefixTrieAllocations"}) {
+            if (result[allocations].get<std::size_t>() != 0) {
+                std::cerr<<"error: the queries over "<<size<<" executables made "<<result[allocations].get<std::size_t>()<<" heap allocations ("<<allocations<<")\n";
+                passed = false;
+            }
+        }
+        if (result["parallelMismatches"].get<std::size_t>() != 0) {
+            std::cerr<<"error: the parallel scan over "<<size<<" executables differed from the linear one on "<<result["parallelMismatches"].get<std::size_t>()<<" queries\n";
+            passed = false;
+        }
+        if (result["symSpellMismatches"].get<std::size_t>() != 0) {
+            std::cerr<<"error: the SymSpell lookup over "<<size<<" executables differed from the linear scan on "<<result["symSpellMismatches"].get<std::size_t>()<<" queries\n";
+            passed = false;
+        }
+        if (result["bkTreeMismatches"].get<std::size_t>() != 0) {
+            std::cerr<<"error: the BK-tree lookup over "<<size<<" executables differed from the linear scan on "<<result["bkTreeMismatches"].get<std::size_t>()<<" queries\n";
+            passed = false;
+        }
+        if (result["prefixTrieMismatches"].get<std::size_t>() != 0) {
+            std::cerr<<"error: the prefix trie lookup over "<<size<<" executables differed from the linear scan on "<<result["prefixTrieMismatches"].get<std::size_t>()<<" queries\n";
+            passed = false;
+        }
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <unistd.h>
+#include "../include/CommonUtils.hpp"
+
+/**
+ * Compares the PATH scanner against the one it replaced: a sequential directory_iterator walk calling
+ * std::filesystem::is_regular_file (a stat) and access() on every entry.
+ *
+ * Usage: scanBenchmark [directory...]   (defaults to the directories of $PATH)
+ *
+ * Metadata calls are counted in-process (stat/access for the legacy scanner, fstatat/faccessat for the current one);
+ * run it under ```strace -f -c``` to get the full kernel-side syscall breakdown.
+ */
+
+static const int benchmarkRuns = 10;
+
+static std::vector<std::string> legacyListOfFilesInPath(const std::string& path, std::uint64_t& metadataCalls) {
+    std::vector<std::string> fileList;
+    for (const auto &entry : std::filesystem::directory_iterator(path)) {
+        try {
+            ++metadataCalls;
+            if (std::filesystem::is_regular_file(entry.path())) {
+                ++metadataCalls;
+                if (access(entry.path().c_str(), X_OK) == 0)
+                    fileList.push_back(entry.path().filename().string());
+            }
+        } catch (const std::filesystem::filesystem_error &e) { }
+    }
+    return fileList;
+}
+
+template <typename Function>
+static double measureBestMilliseconds(Function function) {
+    double best = 1e300;
+    for (int run = 0; run < benchmarkRuns; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> directories;
+    for (int i = 1; i < argc; ++i)
+        directories.push_back(argv[i]);
+
+    if (directories.empty()) {
+        std::stringstream ss(getenv("PATH") ? getenv("PATH") : "");
+        std::string directory;
+        while (getline(ss, directory, ':'))
+            if (std::filesystem::is_directory(directory))
+                directories.push_back(directory);
+    }
+
+    std::set<std::string> legacyNames;
+    std::uint64_t legacyMetadataCalls = 0;
+    for (const std::string& directory : directories) {
+        std::vector<std::string> files = legacyListOfFilesInPath(directory, legacyMetadataCalls);
+        legacyNames.insert(files.begin(), files.end());
+    }
+
+    CommonUtils::ScanCounters& counters = CommonUtils::getScanCounters();
+    counters.metadataCalls = 0;
+    counters.directoryReadCalls = 0;
+    counters.entriesRead = 0;
+
+    std::set<std::string> currentNames;
+    for (const std::vector<std::string>& files : CommonUtils::getListsOfFilesInPaths(directories, false, true))
+        currentNames.insert(files.begin(), files.end());
+
+    const std::uint64_t currentMetadataCalls = counters.metadataCalls;
+    const std::uint64_t currentDirectoryReadCalls = counters.directoryReadCalls;
+    const std::uint64_t entries = counters.entriesRead;
+
+    double legacyMilliseconds = measureBestMilliseconds([&directories]() {
+        std::uint64_t ignored = 0;
+        for (const std::string& directory : directories)
+            legacyListOfFilesInPath(directory, ignored);
+    });
+
+    double currentMilliseconds = measureBestMilliseconds([&directories]() {
+        CommonUtils::getListsOfFilesInPaths(directories, false, true);
+    });
+
+    std::cout<<"directories:                 "<<directories.size()<<"\n";
+    std::cout<<"entries:                     "<<entries<<"\n";
+    std::cout<<"executables (legacy):        "<<legacyNames.size()<<"\n";
+    std::cout<<"executables (current):       "<<currentNames.size()<<(legacyNames == currentNames ? " (identical)" : " (MISMATCH)")<<"\n";
+    std::cout<<"metadata calls (legacy):     "<<legacyMetadataCalls<<"\n";
+    std::cout<<"metadata calls (current):    "<<currentMetadataCalls<<"\n";
+    std::cout<<"getdents64 calls (current):  "<<currentDirectoryReadCalls<<"\n";
+    std::cout<<"best of "<<benchmarkRuns<<" runs (legacy):   "<<legacyMilliseconds<<" ms\n";
+    std::cout<<"best of "<<benchmarkRuns<<" runs (current):  "<<currentMilliseconds<<" ms\n";
+
+    return legacyNames == currentNames ? 0 : 1;
+}
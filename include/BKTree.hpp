@@ -0,0 +1,369 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include "Log.hpp"
+#include "BinaryIndex.hpp"
+#include "WordDistanceHandler.hpp"
+#include "SuggestionSelector.hpp"
+
+#define BK_TREE_MAGIC "SMILEBKT"
+#define BK_TREE_VERSION 1
+// Number of binaries of lengths close to the query scored before the walk, to start it with a bounded radius
+#define BK_TREE_SEED_COUNT 32
+
+/**
+ * @class BKTree
+ * @brief Burkhard-Keller tree over the names of a BinaryIndex, used to find the closest binaries without comparing the
+ * input command against all of them.
+ *
+ * Every child of a node is labelled with its distance from the node, and since the tree metric satisfies the triangle
+ * inequality, when the query is at distance d from a node only the children labelled within [d - r, d + r] can contain
+ * words at distance r or less from the query. The tree is built on the unrestricted Damerau-Levenshtein distance, which
+ * is a metric and never exceeds the optimal string alignment distance used for ranking, so searching the tree with a
+ * radius r finds every binary whose ranking distance is at most r; the ranking distance is then computed on those only.
+ *
+ * Nodes store positions in the BinaryIndex name table, and are laid out in a flat array with the children of each node
+ * in a contiguous run of edges sorted by label, which is also the serialized format.
+ *
+ * A nearest neighbour search only prunes once its radius is small: it is bounded before the walk by the binaries of the
+ * lengths closest to the query, and a node whose length alone puts it beyond the radius of the node and of all its
+ * children is skipped without computing its distance.
+ */
+class BKTree {
+
+public:
+
+    struct Node {
+        std::uint32_t nameId;
+        std::uint32_t firstEdge;
+        std::uint32_t edgeCount;
+    };
+
+    struct Edge {
+        std::uint32_t distance;
+        std::uint32_t node;
+    };
+
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t nodeCount;
+        std::uint64_t edgeCount;
+        std::uint64_t indexFingerprint;
+    };
+
+    using Match = SuggestionSelector::Match;
+
+    struct SearchResult {
+        std::pmr::vector<Match> matches;
+        std::size_t visitedNodes = 0;
+    };
+
+private:
+
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
+    std::uint64_t indexFingerprint = 0;
+
+    /**
+     * Walks the tree keeping only the subtrees that can contain words within the current radius. Matches accepted by the
+     * predicate whose ranking distance is within the radius are reported to onMatch, which returns the radius to use from
+     * then on, allowing a nearest neighbour search to shrink it as closer binaries are found, or a negative radius to stop.
+     */
+    template <typename AcceptPredicate, typename MatchCallback>
+    std::size_t search(const BinaryIndex& binaryIndex, std::string_view query, int radius, AcceptPredicate accept, MatchCallback onMatch, std::pmr::memory_resource * resource) const {
+        if (nodes.empty())
+            return 0;
+
+        const bool bitParallel = WordDistanceHandler::isBitParallelEligible(query);
+        const WordDistanceHandler::QueryPattern pattern = bitParallel ? WordDistanceHandler::buildQueryPattern(query) : WordDistanceHandler::QueryPattern{};
+
+        std::size_t visitedNodes = 0;
+        std::pmr::vector<std::uint32_t> pendingNodes(1, 0, resource);
+
+        while (!pendingNodes.empty()) {
+            const Node& node = nodes[pendingNodes.back()];
+            pendingNodes.pop_back();
+
+            // The distance is at least the difference in length: beyond the radius of the largest label, neither the
+            // node nor any of its children can be within the radius
+            const std::string_view word = binaryIndex.getName(node.nameId);
+            const int largestLabel = node.edgeCount > 0 ? static_cast<int>(edges[node.firstEdge + node.edgeCount - 1].distance) : 0;
+            const int lengthDifference = word.size() > query.size() ? static_cast<int>(word.size() - query.size()) : static_cast<int>(query.size() - word.size());
+            if (lengthDifference > largestLabel + radius)
+                continue;
+
+            ++visitedNodes;
+            const int treeDistance = WordDistanceHandler::calculateUnrestrictedWordDistance(query, word);
+
+            if (treeDistance <= radius && accept(node.nameId)) {
+                const int rankingDistance = bitParallel
+                    ? WordDistanceHandler::calculateWordDistance(pattern, word, radius)
+                    : WordDistanceHandler::calculateWordDistance(query, word, radius);
+                if (rankingDistance <= radius) {
+                    radius = onMatch(Match{node.nameId, rankingDistance});
+                    if (radius < 0)
+                        break;
+                }
+            }
+
+            const Edge * firstEdge = edges.data() + node.firstEdge;
+            const Edge * lastEdge = firstEdge + node.edgeCount;
+            const std::uint32_t lowestLabel = static_cast<std::uint32_t>(std::max(0, treeDistance - radius));
+            const Edge * edge = std::lower_bound(firstEdge, lastEdge, lowestLabel, [](const Edge& current, std::uint32_t label) { return current.distance < label; });
+
+            for (; edge != lastEdge && static_cast<int>(edge->distance) <= treeDistance + radius; ++edge)
+                pendingNodes.push_back(edge->node);
+        }
+
+        return visitedNodes;
+    }
+
+public:
+
+    BKTree() { }
+
+    /**
+     * Builds the tree over every name of the index.
+     *
+     * @param binaryIndex the index whose names are inserted, which must outlive every search.
+     */
+    void build(const BinaryIndex& binaryIndex) {
+        // While building, children are kept per node and only flattened at the end
+        std::vector<std::vector<Edge>> children;
+        std::vector<std::uint32_t> nameIds;
+
+        for (std::uint32_t nameId = 0; nameId < binaryIndex.size(); ++nameId) {
+            if (nameIds.empty()) {
+                nameIds.push_back(nameId);
+                children.emplace_back();
+                continue;
+            }
+
+            const std::string_view word = binaryIndex.getName(nameId);
+            std::uint32_t current = 0;
+            while (true) {
+                const std::uint32_t distance = static_cast<std::uint32_t>(WordDistanceHandler::calculateUnrestrictedWordDistance(word, binaryIndex.getName(nameIds[current])));
+                if (distance == 0)
+                    break;
+
+                auto child = std::find_if(children[current].begin(), children[current].end(), [distance](const Edge& edge) { return edge.distance == distance; });
+                if (child != children[current].end()) {
+                    current = child->node;
+                    continue;
+                }
+
+                const std::uint32_t newNode = static_cast<std::uint32_t>(nameIds.size());
+                children[current].push_back({distance, newNode});
+                nameIds.push_back(nameId);
+                children.emplace_back();
+                break;
+            }
+        }
+
+        nodes.clear();
+        edges.clear();
+        nodes.reserve(nameIds.size());
+        for (std::size_t i = 0; i < nameIds.size(); ++i) {
+            std::sort(children[i].begin(), children[i].end(), [](const Edge& first, const Edge& second) { return first.distance < second.distance; });
+            nodes.push_back({nameIds[i], static_cast<std::uint32_t>(edges.size()), static_cast<std::uint32_t>(children[i].size())});
+            edges.insert(edges.end(), children[i].begin(), children[i].end());
+        }
+
+        indexFingerprint = binaryIndex.getFingerprint();
+        Log::info("Built BK-tree of {} nodes", nodes.size());
+    }
+
+    /**
+     * Loads a tree previously saved with save, only if it was built from an index with the given fingerprint.
+     *
+     * @return true if the tree was loaded, false if the file is missing, invalid or belongs to another index.
+     */
+    bool load(const std::filesystem::path& treeFilePath, std::uint64_t expectedIndexFingerprint) {
+        std::ifstream file(treeFilePath, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        FileHeader header{};
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+            || std::memcmp(header.magic, BK_TREE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != BK_TREE_VERSION
+            || header.indexFingerprint != expectedIndexFingerprint)
+            return false;
+
+        std::vector<Node> loadedNodes(header.nodeCount);
+        std::vector<Edge> loadedEdges(header.edgeCount);
+        if (!file.read(reinterpret_cast<char *>(loadedNodes.data()), static_cast<std::streamsize>(loadedNodes.size() * sizeof(Node)))
+            || !file.read(reinterpret_cast<char *>(loadedEdges.data()), static_cast<std::streamsize>(loadedEdges.size() * sizeof(Edge))))
+            return false;
+
+        nodes = std::move(loadedNodes);
+        edges = std::move(loadedEdges);
+        indexFingerprint = header.indexFingerprint;
+        return true;
+    }
+
+    /**
+     * Saves the tree, tagged with the fingerprint of the index it was built from. The file is written next to its final
+     * location and renamed, so that concurrent shells never load a partial tree.
+     */
+    bool save(const std::filesystem::path& treeFilePath) const {
+        FileHeader header{};
+        std::memcpy(header.magic, BK_TREE_MAGIC, sizeof(header.magic));
+        header.version = BK_TREE_VERSION;
+        header.nodeCount = static_cast<std::uint32_t>(nodes.size());
+        header.edgeCount = edges.size();
+        header.indexFingerprint = indexFingerprint;
+
+        std::filesystem::path temporaryPath = treeFilePath.string() + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char *>(nodes.data()), static_cast<std::streamsize>(nodes.size() * sizeof(Node)));
+            file.write(reinterpret_cast<const char *>(edges.data()), static_cast<std::streamsize>(edges.size() * sizeof(Edge)));
+            if (!file.good())
+                return false;
+        }
+
+        std::error_code errorCode;
+        std::filesystem::rename(temporaryPath, treeFilePath, errorCode);
+        if (errorCode) {
+            std::filesystem::remove(temporaryPath, errorCode);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Loads the tree saved for the current state of the index, or builds and saves it if there is none.
+     */
+    void loadOrBuild(const BinaryIndex& binaryIndex, const std::filesystem::path& treeFilePath) {
+        if (load(treeFilePath, binaryIndex.getFingerprint())) {
+            Log::info("Loaded BK-tree of {} nodes from {}", nodes.size(), treeFilePath.string());
+            return;
+        }
+
+        build(binaryIndex);
+        if (!save(treeFilePath))
+            Log::warn("Could not save the BK-tree in {}", treeFilePath.string());
+    }
+
+    /**
+     * Finds every binary accepted by the predicate within the given distance of the query.
+     *
+     * @param binaryIndex the index the tree was built from
+     * @param query the input command
+     * @param maxDistance the search radius
+     * @param accept predicate on the position of the binary in the index, false to leave it out of the results
+     * @param resource where the matches and the search stack are allocated
+     * @return the matches with their distance from the query, and the number of nodes visited.
+     */
+    template <typename AcceptPredicate>
+    SearchResult findWithinDistance(const BinaryIndex& binaryIndex, std::string_view query, int maxDistance, AcceptPredicate accept, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) const {
+        SearchResult result{std::pmr::vector<Match>(resource)};
+        result.visitedNodes = search(binaryIndex, query, maxDistance, accept, [&result, maxDistance](const Match& match) {
+            result.matches.push_back(match);
+            return maxDistance;
+        }, resource);
+        return result;
+    }
+
+    /**
+     * Finds the binaries accepted by the predicate closest to the query, searching with the cutoff of a SuggestionSelector so
+     * that the radius shrinks each time a closer binary is found.
+     *
+     * The radius starts at the cutoff reached over the BK_TREE_SEED_COUNT accepted binaries whose length is the closest to
+     * the one of the query. The walk keeps the binaries tied with the farthest selected one, and they are selected again
+     * by increasing position at the end, so that the ties are broken as in a linear scan whatever the order of the walk.
+     *
+     * @param binaryIndex the index the tree was built from
+     * @param query the input command
+     * @param maxDistance the highest distance of the binaries to find, a negative value for no maximum
+     * @param maxResults the maximum number of binaries to find, 0 for no maximum
+     * @param margin how much farther than the closest binaries the returned ones can be
+     * @param accept predicate on the position of the binary in the index, false to leave it out of the results
+     * @param resource where the matches and the search stack are allocated
+     * @return the matches, closest first, and the number of nodes visited.
+     */
+    template <typename AcceptPredicate>
+    SearchResult findBest(const BinaryIndex& binaryIndex, std::string_view query, int maxDistance, std::size_t maxResults, int margin, AcceptPredicate accept, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) const {
+        // Looking the query up in the index first tells whether a distance 0 can still be found
+        const CandidateStore& candidates = binaryIndex.getCandidates();
+        const std::uint32_t exactMatch = candidates.find(query);
+        const bool exactMatchRuledOut = exactMatch == binaryIndex.size() || !accept(exactMatch);
+
+        const bool bitParallel = WordDistanceHandler::isBitParallelEligible(query);
+        const WordDistanceHandler::QueryPattern pattern = bitParallel ? WordDistanceHandler::buildQueryPattern(query) : WordDistanceHandler::QueryPattern{};
+
+        // The binaries of the lengths closest to the query, alternately longer and shorter, bound the radius of the walk
+        SuggestionSelector seedSelector(maxDistance, maxResults, margin, exactMatchRuledOut, resource);
+        std::size_t seeds = 0;
+        for (std::size_t offset = 0; seeds < BK_TREE_SEED_COUNT && offset <= UINT8_MAX; ++offset) {
+            for (const int side : {1, -1}) {
+                if ((offset == 0 && side < 0) || (side < 0 && offset > query.size()))
+                    continue;
+                const std::size_t length = side > 0 ? query.size() + offset : query.size() - offset;
+                const CandidateStore::Slice lengthSlice = candidates.getLengthSlice(length, length);
+                for (std::uint32_t nameId = lengthSlice.first; nameId < lengthSlice.last && seeds < BK_TREE_SEED_COUNT; ++nameId) {
+                    if (!accept(nameId))
+                        continue;
+                    ++seeds;
+                    const int cutoff = seedSelector.getSharedCutoff();
+                    const int distance = bitParallel
+                        ? WordDistanceHandler::calculateWordDistance(pattern, candidates.getName(nameId), cutoff)
+                        : WordDistanceHandler::calculateWordDistance(query, candidates.getName(nameId), cutoff);
+                    if (distance <= cutoff)
+                        seedSelector.add({nameId, distance});
+                }
+            }
+        }
+
+        SuggestionSelector walkSelector(maxDistance, maxResults, margin, exactMatchRuledOut, resource);
+        std::pmr::vector<Match> collected(resource);
+        SearchResult result{std::pmr::vector<Match>(resource)};
+        const int radius = std::min(seedSelector.getSharedCutoff(), walkSelector.getSharedCutoff());
+        if (radius >= 0) {
+            result.visitedNodes = search(binaryIndex, query, radius, accept, [&](const Match& match) {
+                collected.push_back(match);
+                walkSelector.add(match);
+                return std::min(radius, walkSelector.getSharedCutoff());
+            }, resource);
+        }
+
+        // Every binary of the final selection was within the radius when it was walked, selecting the collected ones by
+        // increasing position gives the selection of the linear scan
+        std::sort(collected.begin(), collected.end(), [](const Match& first, const Match& second) { return first.nameId < second.nameId; });
+        SuggestionSelector selector(maxDistance, maxResults, margin, exactMatchRuledOut, resource);
+        for (const Match& match : collected)
+            selector.add(match);
+        result.matches = selector.takeMatches();
+        return result;
+    }
+
+    /**
+     * Finds the binaries accepted by the predicate at the minimum distance from the query.
+     *
+     * @param binaryIndex the index the tree was built from
+     * @param query the input command
+     * @param accept predicate on the position of the binary in the index, false to leave it out of the results
+     * @param resource where the matches and the search stack are allocated
+     * @return the matches tied at the minimum distance, and the number of nodes visited.
+     */
+    template <typename AcceptPredicate>
+    SearchResult findNearest(const BinaryIndex& binaryIndex, std::string_view query, AcceptPredicate accept, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) const {
+        return findBest(binaryIndex, query, -1, 0, 0, accept, resource);
+    }
+
+    std::size_t size() const { return nodes.size(); }
+};
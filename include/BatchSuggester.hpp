@@ -0,0 +1,177 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "Log.hpp"
+#include "Stats.hpp"
+#include "Settings.hpp"
+#include "ThreadPool.hpp"
+#include "BinaryIndex.hpp"
+#include "CandidateStore.hpp"
+#include "QGramIndex.hpp"
+#include "BKTree.hpp"
+#include "SymSpellIndex.hpp"
+#include "PrefixTrie.hpp"
+#include "CommandHistory.hpp"
+#include "CommandSuggester.hpp"
+
+// Number of input lines read before their lookups are spread over the pool
+#define BATCH_CHUNK_SIZE 8192
+// Number of consecutive lines looked up by a single task
+#define BATCH_TASK_SIZE 64
+
+/**
+ * @class BatchSuggester
+ * @brief Looks up the suggestions of many input commands at once, e.g. to replay a shell history when tuning the
+ * thresholds, reusing the index, the lookup structures and the history for all of them.
+ *
+ * The input is read by chunks of lines, whose lookups are spread over a thread pool and whose results are written, one
+ * JSON line per input line and in input order, before the next chunk is read: memory stays bounded whatever the size of
+ * the input, and the output can be consumed while the batch runs. Each lookup is the one of a single --i run.
+ */
+class BatchSuggester {
+
+private:
+
+    Settings& settings;
+    BinaryIndex binaryIndex;
+    QGramIndex qGramIndex;
+    BKTree bkTree;
+    SymSpellIndex symSpellIndex;
+    PrefixTrie prefixTrie;
+    CommandHistory history;
+    int margin = 0;
+
+public:
+
+    /**
+     * Refreshes the index and loads the lookup structures, once for the whole batch.
+     */
+    explicit BatchSuggester(Settings& settings) : settings(settings), binaryIndex(settings.getBinaryIndexFilePath()) {
+        {
+            Stats::Span span("indexRefresh");
+            binaryIndex.refresh(settings.getSystemPathVariablePaths());
+        }
+        {
+            Stats::Span span("structuresLoad");
+            if (settings.getQGramJaccardThreshold() > 0)
+                qGramIndex.loadOrBuild(binaryIndex.getCandidates(), binaryIndex.getFingerprint(), settings.getQGramIndexFilePath());
+            // The linear scan, the default engine and the fallback of the SymSpell one, does not need any structure
+            if (settings.getPrefixTrieEngineEnabled())
+                prefixTrie.loadOrBuild(binaryIndex.getCandidates(), binaryIndex.getFingerprint(), settings.getPrefixTrieFilePath());
+            else if (settings.getBkTreeEngineEnabled())
+                bkTree.loadOrBuild(binaryIndex, settings.getBkTreeFilePath());
+            else if (settings.getSymSpellEngineEnabled())
+                symSpellIndex.loadOrBuild(binaryIndex.getCandidates(), binaryIndex.getFingerprint(), settings.getSymSpellMaxDistance(), settings.getSymSpellIndexFilePath());
+        }
+        history.load(settings);
+        margin = history.empty() ? 0 : settings.getHistoryRankingMargin();
+    }
+
+    BatchSuggester(const BatchSuggester&) = delete;
+    BatchSuggester& operator=(const BatchSuggester&) = delete;
+
+    /**
+     * Looks up the suggestions of an input command, safe to call from several threads at once.
+     *
+     * @param inputCommand the command to correct
+     * @return the names of the suggested binaries, most relevant first.
+     */
+    std::vector<std::string> suggest(std::string_view inputCommand) const {
+        const CandidateStore& candidates = binaryIndex.getCandidates();
+        const CommandSuggester::CandidateFilter candidateFilter = CommandSuggester::filterCandidates(inputCommand, candidates, settings, &qGramIndex);
+        auto heuristicCondition = [&candidateFilter](std::uint32_t nameId) { return candidateFilter.accepts(nameId); };
+
+        const std::size_t maxSuggestions = static_cast<std::size_t>(settings.getMaxSuggestions());
+        // Every tie is found, the ranking orders them by common prefix before bounding their number
+        std::pmr::vector<SuggestionSelector::Match> matches;
+        bool found = false;
+        if (settings.getPrefixTrieEngineEnabled()) {
+            matches = prefixTrie.findBest(candidates, inputCommand, settings.getMaxEditDistance(), 0, margin, candidateFilter.slice, heuristicCondition).matches;
+            found = true;
+        } else if (settings.getBkTreeEngineEnabled()) {
+            matches = bkTree.findBest(binaryIndex, inputCommand, settings.getMaxEditDistance(), 0, margin, heuristicCondition).matches;
+            found = true;
+        } else if (settings.getSymSpellEngineEnabled()) {
+            SymSpellIndex::SearchResult result = symSpellIndex.findBest(candidates, inputCommand, settings.getMaxEditDistance(), 0, margin, heuristicCondition);
+            if (result.complete) {
+                matches = std::move(result.matches);
+                found = true;
+            }
+        }
+
+        std::pmr::vector<CommandSuggester::Suggestion> suggestions;
+        if (found) {
+            suggestions.reserve(matches.size());
+            for (auto const &match : matches)
+                suggestions.push_back({binaryIndex.getName(match.nameId), match.distance});
+            std::sort(suggestions.begin(), suggestions.end(), [](const auto& first, const auto& second) { return first.name < second.name; });
+        } else
+            suggestions = CommandSuggester::findClosestCommands(inputCommand, candidates, candidateFilter, settings, margin, 0, std::pmr::get_default_resource());
+        const std::pmr::vector<std::string_view> similarCommands = CommandSuggester::rankSuggestions(inputCommand, suggestions, &history, margin, maxSuggestions);
+        return std::vector<std::string>(similarCommands.begin(), similarCommands.end());
+    }
+
+    /**
+     * Formats the result of a lookup as a JSON line: {"input": ..., "suggestions": [...]}.
+     */
+    static std::string formatResult(std::string_view inputCommand, const std::vector<std::string>& similarCommands) {
+        nlohmann::json record;
+        record["input"] = inputCommand;
+        record["suggestions"] = similarCommands;
+        return record.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n";
+    }
+
+    /**
+     * Looks up every line of the input and writes their results in the same order. Empty lines are kept, with no
+     * suggestions, so that the n-th output line always belongs to the n-th input line.
+     *
+     * @param input newline-delimited input commands
+     * @param output where the JSON lines are written
+     * @param threadCount the number of worker threads
+     * @return the number of input lines processed.
+     */
+    std::size_t run(std::istream& input, std::ostream& output, std::size_t threadCount) const {
+        ThreadPool threadPool(threadCount);
+        std::vector<std::string> lines;
+        std::vector<std::string> results;
+        std::size_t processedLines = 0;
+
+        Log::info("Running batch lookups on {} threads", threadCount);
+
+        while (input) {
+            lines.clear();
+            std::string line;
+            while (lines.size() < BATCH_CHUNK_SIZE && std::getline(input, line)) {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                lines.push_back(std::move(line));
+            }
+            if (lines.empty())
+                break;
+
+            results.assign(lines.size(), std::string());
+            for (std::size_t first = 0; first < lines.size(); first += BATCH_TASK_SIZE) {
+                const std::size_t last = std::min(first + BATCH_TASK_SIZE, lines.size());
+                threadPool.submit([this, &lines, &results, first, last]() {
+                    for (std::size_t i = first; i < last; ++i)
+                        results[i] = formatResult(lines[i], lines[i].empty() ? std::vector<std::string>() : suggest(lines[i]));
+                });
+            }
+            threadPool.wait();
+
+            for (const std::string& result : results)
+                output<<result;
+            output.flush();
+            processedLines += lines.size();
+        }
+
+        return processedLines;
+    }
+};
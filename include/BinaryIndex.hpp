@@ -0,0 +1,822 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include <fstream>
+#include <ranges>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <numeric>
+#include <chrono>
+#include <optional>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "CommonUtils.hpp"
+#include "CharacterSignature.hpp"
+#include "CandidateStore.hpp"
+#include "DirectoryProber.hpp"
+
+#define BINARY_INDEX_MAGIC "SMILEIDX"
+#define BINARY_INDEX_VERSION 5
+// statfs type of ZFS, which linux/magic.h does not define
+#define ZFS_SUPER_MAGIC 0x2FC12FC1
+
+/**
+ * @class BinaryIndex
+ * @brief Persistent index of the executables found in the configured binaries directories.
+ *
+ * The index is stored in a single file laid out so that it can be memory mapped and used without any parsing:
+ *
+ *     Header | DirectoryEntry[directoryCount] | NameEntry[directoryNameCount] | uint32 offsets[nameCount]
+ *            | uint32 lengths[nameCount] | CharacterSignature[nameCount] | uint32 lengthBuckets[lengthBucketCount]
+ *            | string pool
+ *
+ * Every directory records the mtime, inode and device it had when it was scanned together with its own slice of the
+ * directory name table, so that a refresh only rescans the directories whose mtime changed. The deduplicated union of
+ * all the directories, which is what queries iterate over, is stored in the CandidateStore format: sorted by length and
+ * then alphabetically, as parallel arrays of offsets, lengths and character signatures plus the table of the length
+ * buckets, with the characters of the names contiguous at the start of the string pool. Every table is aligned to 8
+ * bytes, and the whole store is used as a view into the mapping, without copies. The header also carries a fingerprint
+ * of the name table, which the structures derived from the index (and persisted next to it) use to know whether they
+ * are still valid.
+ *
+ * A refresh can be bounded by a deadline. The directories the index knows to be on a local filesystem are stat'ed and
+ * rescanned right away, as without a deadline, the others by the threads of the DirectoryProber: a directory which does
+ * not answer in time, e.g. on a hung network mount, keeps the state and the binaries it had in the index, and is rescanned
+ * on a later refresh, once its previous probe returned.
+ */
+class BinaryIndex {
+
+public:
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t directoryCount;
+        std::uint32_t directoryNameCount;
+        std::uint32_t nameCount;
+        std::uint32_t lengthBucketCount;
+        std::uint64_t directoryTableOffset;
+        std::uint64_t directoryNameTableOffset;
+        std::uint64_t nameOffsetTableOffset;
+        std::uint64_t nameLengthTableOffset;
+        std::uint64_t signatureTableOffset;
+        std::uint64_t lengthBucketTableOffset;
+        std::uint64_t stringPoolOffset;
+        std::uint64_t fileSize;
+        std::uint64_t fingerprint;
+    };
+
+    struct DirectoryEntry {
+        std::int64_t mtimeSeconds;
+        std::int64_t mtimeNanoseconds;
+        std::uint64_t inode;
+        std::uint64_t device;
+        std::uint32_t pathOffset;
+        std::uint32_t pathLength;
+        std::uint32_t firstName;
+        std::uint32_t nameCount;
+        // statfs type of the filesystem the directory was scanned on, 0 when unknown
+        std::uint32_t filesystemType;
+        std::uint32_t reserved;
+    };
+
+    struct NameEntry {
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+
+private:
+
+    /**
+     * State of a configured directory at refresh time. A directory which cannot be stat'ed is recorded with all fields
+     * set to zero, so that it is not rescanned until it appears.
+     */
+    struct DirectoryState {
+        std::string path;
+        std::int64_t mtimeSeconds = 0;
+        std::int64_t mtimeNanoseconds = 0;
+        std::uint64_t inode = 0;
+        std::uint64_t device = 0;
+        std::uint32_t filesystemType = 0;
+        // False for a directory which was not stat'ed, whose state is the one recorded in the index
+        bool refreshed = true;
+    };
+
+    /**
+     * Results of the directories stat'ed or scanned by the probe threads, shared with them so that a thread blocked on
+     * a hung directory can be abandoned at the deadline.
+     */
+    struct BackgroundWork {
+        std::mutex mutex;
+        std::condition_variable progress;
+        std::vector<DirectoryState> states;
+        std::vector<std::vector<std::string>> names;
+        std::vector<std::string> errors;
+        std::vector<std::uint8_t> finished;
+        std::size_t finishedCount = 0;
+    };
+
+    std::filesystem::path indexFilePath;
+
+    const std::byte * data = nullptr;
+    std::size_t dataSize = 0;
+    bool dataIsMapped = false;
+    // Identity of the mapped index file, to notice that another process replaced it
+    dev_t mappedDevice = 0;
+    ino_t mappedInode = 0;
+    // Used as backing storage instead of the mapping when the index file could not be written
+    std::vector<std::byte> fallbackBuffer;
+
+    const Header * header = nullptr;
+    const DirectoryEntry * directoryTable = nullptr;
+    const NameEntry * directoryNameTable = nullptr;
+    const char * stringPool = nullptr;
+    CandidateStore candidates;
+
+    static DirectoryState getDirectoryState(const std::string& path) {
+        DirectoryState state;
+        state.path = path;
+
+        struct stat status;
+        if (stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode)) {
+            state.mtimeSeconds = status.st_mtim.tv_sec;
+            state.mtimeNanoseconds = status.st_mtim.tv_nsec;
+            state.inode = status.st_ino;
+            state.device = status.st_dev;
+        }
+        return state;
+    }
+
+    /**
+     * @return the statfs type of the filesystem of the directory or, when it is missing, of its closest existing parent
+     * which its stat goes through, 0 when unknown.
+     */
+    static std::uint32_t getFilesystemType(const std::string& path) {
+        std::filesystem::path existingPath = path;
+        struct statfs status;
+        while (statfs(existingPath.c_str(), &status) != 0) {
+            if (!existingPath.has_relative_path())
+                return 0;
+            existingPath = existingPath.parent_path();
+        }
+        return static_cast<std::uint32_t>(status.f_type);
+    }
+
+    /**
+     * @return true for the disk and memory filesystems, which cannot hang the way a network or FUSE mount can.
+     */
+    static bool isLocalFilesystem(std::uint32_t filesystemType) {
+        switch (filesystemType) {
+            case EXT4_SUPER_MAGIC: case XFS_SUPER_MAGIC: case BTRFS_SUPER_MAGIC: case ZFS_SUPER_MAGIC: case F2FS_SUPER_MAGIC:
+            case REISERFS_SUPER_MAGIC: case TMPFS_MAGIC: case RAMFS_MAGIC: case OVERLAYFS_SUPER_MAGIC: case SQUASHFS_MAGIC:
+            case ISOFS_SUPER_MAGIC: case MSDOS_SUPER_MAGIC: case EXFAT_SUPER_MAGIC:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool isSameState(const DirectoryEntry& entry, const DirectoryState& state) {
+        return entry.mtimeSeconds == state.mtimeSeconds && entry.mtimeNanoseconds == state.mtimeNanoseconds
+            && entry.inode == state.inode && entry.device == state.device;
+    }
+
+    static bool isDirectoryMissing(const DirectoryState& state) {
+        return state.inode == 0 && state.device == 0;
+    }
+
+    void unmap() {
+        if (dataIsMapped && data != nullptr)
+            munmap(const_cast<std::byte *>(data), dataSize);
+
+        data = nullptr;
+        dataSize = 0;
+        dataIsMapped = false;
+        header = nullptr;
+        candidates = CandidateStore();
+    }
+
+    /**
+     * Checks that the loaded bytes form a well formed index of the current version and sets the table pointers.
+     *
+     * @return true if the index can be used, false otherwise.
+     */
+    bool attach() {
+        if (data == nullptr || dataSize < sizeof(Header))
+            return false;
+
+        const Header * candidateHeader = reinterpret_cast<const Header *>(data);
+        if (std::memcmp(candidateHeader->magic, BINARY_INDEX_MAGIC, sizeof(candidateHeader->magic)) != 0
+            || candidateHeader->version != BINARY_INDEX_VERSION
+            || candidateHeader->fileSize != dataSize)
+            return false;
+
+        const std::uint64_t directoryTableEnd = candidateHeader->directoryTableOffset + std::uint64_t{candidateHeader->directoryCount} * sizeof(DirectoryEntry);
+        const std::uint64_t directoryNameTableEnd = candidateHeader->directoryNameTableOffset + std::uint64_t{candidateHeader->directoryNameCount} * sizeof(NameEntry);
+        const std::uint64_t nameOffsetTableEnd = candidateHeader->nameOffsetTableOffset + std::uint64_t{candidateHeader->nameCount} * sizeof(std::uint32_t);
+        const std::uint64_t nameLengthTableEnd = candidateHeader->nameLengthTableOffset + std::uint64_t{candidateHeader->nameCount} * sizeof(std::uint32_t);
+        const std::uint64_t signatureTableEnd = candidateHeader->signatureTableOffset + std::uint64_t{candidateHeader->nameCount} * sizeof(CharacterSignature);
+        const std::uint64_t lengthBucketTableEnd = candidateHeader->lengthBucketTableOffset + std::uint64_t{candidateHeader->lengthBucketCount} * sizeof(std::uint32_t);
+
+        if (directoryTableEnd > dataSize || directoryNameTableEnd > dataSize || nameOffsetTableEnd > dataSize || nameLengthTableEnd > dataSize
+            || signatureTableEnd > dataSize || lengthBucketTableEnd > dataSize || candidateHeader->stringPoolOffset > dataSize
+            || candidateHeader->lengthBucketCount == 0)
+            return false;
+
+        if (candidateHeader->directoryTableOffset % alignof(DirectoryEntry) != 0 || candidateHeader->directoryNameTableOffset % alignof(NameEntry) != 0
+            || candidateHeader->nameOffsetTableOffset % alignof(std::uint32_t) != 0 || candidateHeader->nameLengthTableOffset % alignof(std::uint32_t) != 0
+            || candidateHeader->signatureTableOffset % alignof(CharacterSignature) != 0 || candidateHeader->lengthBucketTableOffset % alignof(std::uint32_t) != 0)
+            return false;
+
+        // Every string of the tables has to lie in the string pool, and the slices in their tables: a truncated or
+        // corrupted file is rebuilt instead of being read past the mapping
+        const std::uint64_t stringPoolSize = dataSize - candidateHeader->stringPoolOffset;
+        const auto isInStringPool = [stringPoolSize](std::uint64_t offset, std::uint64_t length) { return offset <= stringPoolSize && length <= stringPoolSize - offset; };
+
+        const DirectoryEntry * directories = reinterpret_cast<const DirectoryEntry *>(data + candidateHeader->directoryTableOffset);
+        for (std::uint32_t i = 0; i < candidateHeader->directoryCount; ++i) {
+            if (!isInStringPool(directories[i].pathOffset, directories[i].pathLength)
+                || std::uint64_t{directories[i].firstName} + directories[i].nameCount > candidateHeader->directoryNameCount)
+                return false;
+        }
+
+        const NameEntry * directoryNames = reinterpret_cast<const NameEntry *>(data + candidateHeader->directoryNameTableOffset);
+        for (std::uint32_t i = 0; i < candidateHeader->directoryNameCount; ++i) {
+            if (!isInStringPool(directoryNames[i].offset, directoryNames[i].length))
+                return false;
+        }
+
+        const std::uint32_t * nameOffsets = reinterpret_cast<const std::uint32_t *>(data + candidateHeader->nameOffsetTableOffset);
+        const std::uint32_t * nameLengths = reinterpret_cast<const std::uint32_t *>(data + candidateHeader->nameLengthTableOffset);
+        for (std::uint32_t i = 0; i < candidateHeader->nameCount; ++i) {
+            if (!isInStringPool(nameOffsets[i], nameLengths[i]))
+                return false;
+        }
+
+        const std::uint32_t * lengthBuckets = reinterpret_cast<const std::uint32_t *>(data + candidateHeader->lengthBucketTableOffset);
+        for (std::uint32_t i = 0; i < candidateHeader->lengthBucketCount; ++i) {
+            if (lengthBuckets[i] > candidateHeader->nameCount || (i > 0 && lengthBuckets[i] < lengthBuckets[i - 1]))
+                return false;
+        }
+        if (lengthBuckets[candidateHeader->lengthBucketCount - 1] != candidateHeader->nameCount)
+            return false;
+
+        header = candidateHeader;
+        directoryTable = reinterpret_cast<const DirectoryEntry *>(data + header->directoryTableOffset);
+        directoryNameTable = reinterpret_cast<const NameEntry *>(data + header->directoryNameTableOffset);
+        stringPool = reinterpret_cast<const char *>(data + header->stringPoolOffset);
+        candidates = CandidateStore(stringPool,
+                                    reinterpret_cast<const std::uint32_t *>(data + header->nameOffsetTableOffset),
+                                    reinterpret_cast<const std::uint32_t *>(data + header->nameLengthTableOffset),
+                                    reinterpret_cast<const CharacterSignature *>(data + header->signatureTableOffset),
+                                    reinterpret_cast<const std::uint32_t *>(data + header->lengthBucketTableOffset),
+                                    header->lengthBucketCount, header->nameCount);
+        return true;
+    }
+
+    bool mapIndexFile() {
+        unmap();
+
+        int fd = open(indexFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct stat status;
+        if (fstat(fd, &status) != 0 || status.st_size <= 0) {
+            close(fd);
+            return false;
+        }
+
+        void * mapping = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+
+        data = static_cast<const std::byte *>(mapping);
+        dataSize = static_cast<std::size_t>(status.st_size);
+        dataIsMapped = true;
+        mappedDevice = status.st_dev;
+        mappedInode = status.st_ino;
+
+        if (!attach()) {
+            Log::warn("Binary index {} is invalid or outdated, it will be rebuilt", indexFilePath.string());
+            unmap();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @return true if the index file is no longer the mapped one, e.g. because another process rebuilt it since.
+     */
+    bool isIndexFileReplaced() const {
+        struct stat status;
+        return stat(indexFilePath.c_str(), &status) != 0 || status.st_ino != mappedInode || status.st_dev != mappedDevice;
+    }
+
+    bool isUpToDate(const std::vector<DirectoryState>& states) const {
+        if (header == nullptr || header->directoryCount != states.size())
+            return false;
+
+        for (std::size_t i = 0; i < states.size(); ++i) {
+            if (getDirectoryPath(i) != states[i].path || !isSameState(directoryTable[i], states[i]))
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @return the position of the directory in the directory table of the currently loaded index, or -1 if it is not in
+     * the index.
+     */
+    long findIndexedDirectory(std::string_view path) const {
+        if (header == nullptr)
+            return -1;
+
+        for (std::size_t i = 0; i < header->directoryCount; ++i) {
+            if (getDirectoryPath(i) == path)
+                return static_cast<long>(i);
+        }
+        return -1;
+    }
+
+    /**
+     * @return the state recorded in the index for a directory left as it is, all zero if it is not in the index.
+     */
+    DirectoryState getIndexedState(const std::string& path) const {
+        DirectoryState state;
+        state.path = path;
+        state.refreshed = false;
+
+        const long position = findIndexedDirectory(path);
+        if (position >= 0) {
+            const DirectoryEntry& entry = directoryTable[position];
+            state.mtimeSeconds = entry.mtimeSeconds;
+            state.mtimeNanoseconds = entry.mtimeNanoseconds;
+            state.inode = entry.inode;
+            state.device = entry.device;
+            state.filesystemType = entry.filesystemType;
+        }
+        return state;
+    }
+
+    std::vector<std::string> getIndexedNames(std::size_t position) const {
+        const DirectoryEntry& entry = directoryTable[position];
+        std::vector<std::string> names;
+        names.reserve(entry.nameCount);
+        for (std::uint32_t j = 0; j < entry.nameCount; ++j) {
+            const NameEntry& name = directoryNameTable[entry.firstName + j];
+            names.emplace_back(stringPool + name.offset, name.length);
+        }
+        return names;
+    }
+
+    /**
+     * Submits a probe of each directory to the DirectoryProber and waits for them until the deadline.
+     *
+     * @param probe called on a probe thread with the shared results to fill, and the position and path of a directory, the
+     * directory being marked finished once its probe is no longer pending
+     * @param lateDirectories appended with the directories whose probe is still running at the deadline, or whose
+     * previous probe still was when they were submitted
+     * @return for each directory, whether its probe finished in time.
+     */
+    static std::vector<std::uint8_t> probeUntil(const std::vector<std::string>& paths, const std::vector<std::size_t>& positions,
+                                                 std::chrono::steady_clock::time_point deadline, const std::shared_ptr<BackgroundWork>& work,
+                                                 void (* probe)(BackgroundWork&, std::size_t, const std::string&), std::vector<std::string>& lateDirectories) {
+        std::vector<std::uint64_t> probeIds(paths.size(), 0);
+        std::size_t submittedCount = 0;
+        for (std::size_t position : positions) {
+            probeIds[position] = DirectoryProber::submit(paths[position], [work, probe, position, path = paths[position]]() { probe(*work, position, path); },
+                [work, position]() {
+                    std::lock_guard<std::mutex> lock(work->mutex);
+                    work->finished[position] = 1;
+                    ++work->finishedCount;
+                    work->progress.notify_all();
+                });
+            if (probeIds[position] != 0)
+                ++submittedCount;
+        }
+
+        std::unique_lock<std::mutex> lock(work->mutex);
+        work->progress.wait_until(lock, deadline, [&work, submittedCount]() { return work->finishedCount == submittedCount; });
+        for (std::size_t position : positions) {
+            if (work->finished[position])
+                continue;
+            // A probe no thread started yet is withdrawn: only a directory still blocking its thread is late
+            if (probeIds[position] != 0 && DirectoryProber::cancel(probeIds[position]))
+                Log::warn("Binaries directory {} was not probed before the deadline, every probe thread being busy", paths[position]);
+            else {
+                Log::warn("Binaries directory {} is still being probed", paths[position]);
+                lateDirectories.push_back(paths[position]);
+            }
+        }
+        return work->finished;
+    }
+
+    /**
+     * Stats the directories which are not on a local filesystem on the probe threads until the deadline. Those which do
+     * not answer in time, like the skipped ones, keep the state recorded in the index.
+     */
+    std::vector<DirectoryState> getDirectoryStatesUntil(const std::vector<std::string>& directories, std::chrono::steady_clock::time_point deadline,
+                                                        const std::unordered_set<std::string>& skippedDirectories, std::vector<std::string>& lateDirectories) const {
+        std::vector<DirectoryState> states(directories.size());
+        std::vector<std::size_t> positions;
+        for (std::size_t i = 0; i < directories.size(); ++i) {
+            if (skippedDirectories.contains(directories[i])) {
+                Log::info("Skipping slow binaries directory {}", directories[i]);
+                states[i] = getIndexedState(directories[i]);
+            } else if (isLocalFilesystem(getIndexedState(directories[i]).filesystemType))
+                states[i] = getDirectoryState(directories[i]);
+            else
+                positions.push_back(i);
+        }
+        // Usually every directory is local, and nothing is probed
+        if (positions.empty())
+            return states;
+
+        auto work = std::make_shared<BackgroundWork>();
+        work->states.resize(directories.size());
+        work->finished.assign(directories.size(), 0);
+        const std::vector<std::uint8_t> finished = probeUntil(directories, positions, deadline, work, [](BackgroundWork& work, std::size_t position, const std::string& path) {
+            DirectoryState state = getDirectoryState(path);
+            std::lock_guard<std::mutex> lock(work.mutex);
+            work.states[position] = std::move(state);
+        }, lateDirectories);
+
+        std::lock_guard<std::mutex> lock(work->mutex);
+        for (std::size_t position : positions) {
+            if (finished[position])
+                states[position] = std::move(work->states[position]);
+            else {
+                Log::warn("Binaries directory {} could not be stat'ed before the deadline, keeping its indexed binaries", directories[position]);
+                states[position] = getIndexedState(directories[position]);
+            }
+        }
+        return states;
+    }
+
+    /**
+     * Scans the directories on the probe threads until the deadline.
+     *
+     * @param scanned set for each directory whose scan finished in time
+     * @param filesystemTypes set to the statfs type of each directory whose scan finished in time
+     * @param lateDirectories appended with the directories still being scanned at the deadline
+     * @return the names found in the directories whose scan finished.
+     */
+    static std::vector<std::vector<std::string>> scanDirectoriesUntil(const std::vector<std::string>& paths, std::chrono::steady_clock::time_point deadline,
+                                                                      std::vector<std::uint8_t>& scanned, std::vector<std::uint32_t>& filesystemTypes,
+                                                                      std::vector<std::string>& lateDirectories) {
+        auto work = std::make_shared<BackgroundWork>();
+        work->names.resize(paths.size());
+        work->states.resize(paths.size());
+        work->errors.resize(paths.size());
+        work->finished.assign(paths.size(), 0);
+        std::vector<std::size_t> positions(paths.size());
+        std::iota(positions.begin(), positions.end(), 0);
+        scanned = probeUntil(paths, positions, deadline, work, [](BackgroundWork& work, std::size_t position, const std::string& path) {
+            const std::uint32_t filesystemType = getFilesystemType(path);
+            std::vector<std::string> names;
+            std::string error;
+            try {
+                names = CommonUtils::getListOfFilesInPath(path, false, true);
+            } catch (const std::filesystem::filesystem_error &e) {
+                error = e.what();
+            }
+            std::lock_guard<std::mutex> lock(work.mutex);
+            work.names[position] = std::move(names);
+            work.errors[position] = std::move(error);
+            work.states[position].filesystemType = filesystemType;
+        }, lateDirectories);
+
+        std::lock_guard<std::mutex> lock(work->mutex);
+        std::vector<std::vector<std::string>> names(paths.size());
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            if (!scanned[i])
+                continue;
+            // Logged here rather than by the probe, which may outlive the logger when the caller stopped waiting
+            if (!work->errors[i].empty())
+                Log::warn("Error while opening {}: {}. Ignoring...", paths[i], work->errors[i]);
+            names[i] = std::move(work->names[i]);
+            filesystemTypes[i] = work->states[i].filesystemType;
+        }
+        return names;
+    }
+
+    /**
+     * Looks for a directory in the currently loaded index whose recorded state matches the current one.
+     *
+     * @return the position of the directory in the directory table, or -1 if it has to be rescanned.
+     */
+    long findReusableDirectory(const DirectoryState& state) const {
+        if (header == nullptr)
+            return -1;
+
+        for (std::size_t i = 0; i < header->directoryCount; ++i) {
+            if (getDirectoryPath(i) == state.path && isSameState(directoryTable[i], state))
+                return static_cast<long>(i);
+        }
+        return -1;
+    }
+
+    /**
+     * FNV-1a hash of the sorted name table, so that two indexes listing the same binaries have the same fingerprint.
+     */
+    static std::uint64_t computeFingerprint(const CandidateStore& sortedNames) {
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (std::string_view name : sortedNames.getNames()) {
+            for (char character : name) {
+                hash ^= static_cast<unsigned char>(character);
+                hash *= 1099511628211ULL;
+            }
+            // Separator, so that {"ab", "c"} and {"a", "bc"} do not collide
+            hash ^= 0xFF;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    template <typename T>
+    static void appendBytes(std::vector<std::byte>& buffer, const T& value) {
+        const std::byte * bytes = reinterpret_cast<const std::byte *>(&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    static void appendArray(std::vector<std::byte>& buffer, const std::vector<T>& values) {
+        const std::byte * bytes = reinterpret_cast<const std::byte *>(values.data());
+        buffer.insert(buffer.end(), bytes, bytes + values.size() * sizeof(T));
+        buffer.resize(alignTable(buffer.size()));
+    }
+
+    static std::uint64_t alignTable(std::uint64_t offset) {
+        return (offset + 7) & ~std::uint64_t{7};
+    }
+
+    /**
+     * Serializes the directories and their names into the on-disk layout described in the class documentation.
+     */
+    static std::vector<std::byte> serialize(const std::vector<DirectoryState>& states, const std::vector<std::vector<std::string>>& directoryNames) {
+        // The characters of the names come first in the pool, in store order, followed by the directory paths
+        CandidateStore::Storage store = CandidateStore::build(directoryNames | std::views::join);
+        const CandidateStore storeView(store);
+
+        std::unordered_map<std::string_view, std::uint32_t> poolOffsets;
+        poolOffsets.reserve(storeView.size());
+        for (std::size_t i = 0; i < storeView.size(); ++i)
+            poolOffsets.emplace(storeView.getName(i), store.offsets[i]);
+
+        std::string pool = store.arena;
+
+        std::vector<DirectoryEntry> directories;
+        std::vector<NameEntry> directoryNameEntries;
+
+        for (std::size_t i = 0; i < states.size(); ++i) {
+            DirectoryEntry entry{};
+            entry.mtimeSeconds = states[i].mtimeSeconds;
+            entry.mtimeNanoseconds = states[i].mtimeNanoseconds;
+            entry.inode = states[i].inode;
+            entry.device = states[i].device;
+            entry.filesystemType = states[i].filesystemType;
+            entry.pathOffset = static_cast<std::uint32_t>(pool.size());
+            entry.pathLength = static_cast<std::uint32_t>(states[i].path.size());
+            entry.firstName = static_cast<std::uint32_t>(directoryNameEntries.size());
+            entry.nameCount = static_cast<std::uint32_t>(directoryNames[i].size());
+            directories.push_back(entry);
+            pool.append(states[i].path);
+
+            for (const std::string& name : directoryNames[i])
+                directoryNameEntries.push_back({poolOffsets.at(name), static_cast<std::uint32_t>(name.size())});
+        }
+
+        Header indexHeader{};
+        std::memcpy(indexHeader.magic, BINARY_INDEX_MAGIC, sizeof(indexHeader.magic));
+        indexHeader.version = BINARY_INDEX_VERSION;
+        indexHeader.directoryCount = static_cast<std::uint32_t>(directories.size());
+        indexHeader.directoryNameCount = static_cast<std::uint32_t>(directoryNameEntries.size());
+        indexHeader.nameCount = static_cast<std::uint32_t>(storeView.size());
+        indexHeader.lengthBucketCount = static_cast<std::uint32_t>(store.lengthBuckets.size());
+        indexHeader.directoryTableOffset = alignTable(sizeof(Header));
+        indexHeader.directoryNameTableOffset = alignTable(indexHeader.directoryTableOffset + directories.size() * sizeof(DirectoryEntry));
+        indexHeader.nameOffsetTableOffset = alignTable(indexHeader.directoryNameTableOffset + directoryNameEntries.size() * sizeof(NameEntry));
+        indexHeader.nameLengthTableOffset = alignTable(indexHeader.nameOffsetTableOffset + store.offsets.size() * sizeof(std::uint32_t));
+        indexHeader.signatureTableOffset = alignTable(indexHeader.nameLengthTableOffset + store.lengths.size() * sizeof(std::uint32_t));
+        indexHeader.lengthBucketTableOffset = alignTable(indexHeader.signatureTableOffset + store.signatures.size() * sizeof(CharacterSignature));
+        indexHeader.stringPoolOffset = alignTable(indexHeader.lengthBucketTableOffset + store.lengthBuckets.size() * sizeof(std::uint32_t));
+        indexHeader.fileSize = indexHeader.stringPoolOffset + pool.size();
+        indexHeader.fingerprint = computeFingerprint(storeView);
+
+        std::vector<std::byte> buffer;
+        buffer.reserve(indexHeader.fileSize);
+        appendBytes(buffer, indexHeader);
+        buffer.resize(alignTable(buffer.size()));
+        appendArray(buffer, directories);
+        appendArray(buffer, directoryNameEntries);
+        appendArray(buffer, store.offsets);
+        appendArray(buffer, store.lengths);
+        appendArray(buffer, store.signatures);
+        appendArray(buffer, store.lengthBuckets);
+
+        const std::byte * poolBytes = reinterpret_cast<const std::byte *>(pool.data());
+        buffer.insert(buffer.end(), poolBytes, poolBytes + pool.size());
+        return buffer;
+    }
+
+    /**
+     * Writes the index next to its final location and renames it, so that concurrent shells never map a partial file.
+     */
+    bool writeIndexFile(const std::vector<std::byte>& buffer) const {
+        std::filesystem::path temporaryPath = indexFilePath.string() + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+            if (!file.good())
+                return false;
+        }
+
+        std::error_code errorCode;
+        std::filesystem::rename(temporaryPath, indexFilePath, errorCode);
+        if (errorCode) {
+            std::filesystem::remove(temporaryPath, errorCode);
+            return false;
+        }
+        return true;
+    }
+
+    void rebuild(std::vector<DirectoryState>& states, std::optional<std::chrono::steady_clock::time_point> deadline, std::vector<std::string>& lateDirectories) {
+        std::vector<std::vector<std::string>> directoryNames(states.size());
+        std::vector<std::size_t> directoriesToScan;
+        std::vector<std::string> pathsToScan;
+
+        for (std::size_t i = 0; i < states.size(); ++i) {
+            long reusable = findReusableDirectory(states[i]);
+            if (reusable >= 0) {
+                directoryNames[i] = getIndexedNames(static_cast<std::size_t>(reusable));
+                states[i].filesystemType = directoryTable[reusable].filesystemType;
+            }
+            else if (isDirectoryMissing(states[i])) {
+                if (states[i].refreshed) {
+                    Log::warn("Binaries directory {} does not exist. Ignoring...", states[i].path);
+                    states[i].filesystemType = getFilesystemType(states[i].path);
+                }
+            } else {
+                Log::info("Scanning binaries directory {}", states[i].path);
+                directoriesToScan.push_back(i);
+                pathsToScan.push_back(states[i].path);
+            }
+        }
+
+        // The modified directories are scanned in parallel. Under a deadline, those which were not indexed on a local
+        // filesystem are scanned on the probe threads, and those still being scanned at the deadline keep their indexed
+        // state and binaries, so that they are rescanned by the next refresh
+        std::vector<std::uint8_t> scanned(pathsToScan.size(), 1);
+        std::vector<std::uint32_t> filesystemTypes(pathsToScan.size(), 0);
+        std::vector<std::vector<std::string>> scannedNames(pathsToScan.size());
+        std::vector<std::size_t> localPositions;
+        std::vector<std::size_t> probedPositions;
+        for (std::size_t i = 0; i < pathsToScan.size(); ++i) {
+            if (!deadline || isLocalFilesystem(getIndexedState(pathsToScan[i]).filesystemType))
+                localPositions.push_back(i);
+            else
+                probedPositions.push_back(i);
+        }
+
+        if (!localPositions.empty()) {
+            std::vector<std::string> localPaths;
+            for (std::size_t position : localPositions)
+                localPaths.push_back(pathsToScan[position]);
+            std::vector<std::vector<std::string>> localNames = CommonUtils::getListsOfFilesInPaths(localPaths, false, true);
+            for (std::size_t i = 0; i < localPositions.size(); ++i) {
+                scannedNames[localPositions[i]] = std::move(localNames[i]);
+                filesystemTypes[localPositions[i]] = getFilesystemType(localPaths[i]);
+            }
+        }
+
+        if (!probedPositions.empty()) {
+            std::vector<std::string> probedPaths;
+            for (std::size_t position : probedPositions)
+                probedPaths.push_back(pathsToScan[position]);
+            std::vector<std::uint8_t> probedScanned;
+            std::vector<std::uint32_t> probedFilesystemTypes(probedPaths.size(), 0);
+            std::vector<std::vector<std::string>> probedNames = scanDirectoriesUntil(probedPaths, *deadline, probedScanned, probedFilesystemTypes, lateDirectories);
+            for (std::size_t i = 0; i < probedPositions.size(); ++i) {
+                scanned[probedPositions[i]] = probedScanned[i];
+                scannedNames[probedPositions[i]] = std::move(probedNames[i]);
+                filesystemTypes[probedPositions[i]] = probedFilesystemTypes[i];
+            }
+        }
+        for (std::size_t i = 0; i < directoriesToScan.size(); ++i) {
+            const std::size_t position = directoriesToScan[i];
+            if (scanned[i]) {
+                directoryNames[position] = std::move(scannedNames[i]);
+                states[position].filesystemType = filesystemTypes[i];
+                continue;
+            }
+
+            Log::warn("Binaries directory {} could not be scanned before the deadline, keeping its indexed binaries", pathsToScan[i]);
+            states[position] = getIndexedState(pathsToScan[i]);
+            const long indexed = findIndexedDirectory(pathsToScan[i]);
+            if (indexed >= 0)
+                directoryNames[position] = getIndexedNames(static_cast<std::size_t>(indexed));
+        }
+
+        std::vector<std::byte> buffer = serialize(states, directoryNames);
+        unmap();
+
+        if (writeIndexFile(buffer) && mapIndexFile()) {
+            Log::info("Binary index written in {}", indexFilePath.string());
+            return;
+        }
+
+        Log::warn("Could not write the binary index in {}, keeping it in memory", indexFilePath.string());
+        fallbackBuffer = std::move(buffer);
+        data = fallbackBuffer.data();
+        dataSize = fallbackBuffer.size();
+        dataIsMapped = false;
+        attach();
+    }
+
+public:
+
+    BinaryIndex(const std::filesystem::path& indexFilePath) : indexFilePath(indexFilePath) { }
+
+    ~BinaryIndex() { unmap(); }
+
+    BinaryIndex(const BinaryIndex&) = delete;
+    BinaryIndex& operator=(const BinaryIndex&) = delete;
+
+    /**
+     * Makes the index reflect the given directories: the index file is mapped and, if any directory was added, removed
+     * or modified since it was written, it is rebuilt rescanning only the directories whose state changed. An index kept
+     * mapped from a previous refresh is mapped again if another process rebuilt the file in between.
+     *
+     * @param directories the binaries directories to index, in lookup order
+     * @param deadline when set, the directories not stat'ed or scanned by then keep the state and binaries they have in
+     * the index
+     * @param skippedDirectories directories kept as they are in the index without even being stat'ed
+     * @return the directories which did not answer before the deadline.
+     */
+    std::vector<std::string> refresh(const std::vector<std::string>& directories, std::optional<std::chrono::steady_clock::time_point> deadline = std::nullopt,
+                                     const std::unordered_set<std::string>& skippedDirectories = {}) {
+        if (header == nullptr || !dataIsMapped || isIndexFileReplaced())
+            mapIndexFile();
+
+        std::vector<std::string> lateDirectories;
+        std::vector<DirectoryState> states;
+        if (deadline)
+            states = getDirectoryStatesUntil(directories, *deadline, skippedDirectories, lateDirectories);
+        else {
+            states.reserve(directories.size());
+            for (const std::string& directory : directories)
+                states.push_back(getDirectoryState(directory));
+        }
+
+        if (isUpToDate(states)) {
+            Log::info("Binary index {} is up to date", indexFilePath.string());
+            return lateDirectories;
+        }
+
+        rebuild(states, deadline, lateDirectories);
+        return lateDirectories;
+    }
+
+    std::size_t size() const { return header == nullptr ? 0 : header->nameCount; }
+
+    std::uint64_t getFingerprint() const { return header == nullptr ? 0 : header->fingerprint; }
+
+    std::string_view getName(std::size_t position) const { return candidates.getName(position); }
+
+    const CharacterSignature& getSignature(std::size_t position) const { return candidates.getSignature(position); }
+
+    /**
+     * @return the indexed names in the candidate store format, as a view into the index which must outlive it.
+     */
+    const CandidateStore& getCandidates() const { return candidates; }
+
+    std::string_view getDirectoryPath(std::size_t position) const {
+        const DirectoryEntry& entry = directoryTable[position];
+        return std::string_view(stringPool + entry.pathOffset, entry.pathLength);
+    }
+
+    /**
+     * @return a view over every indexed binary name, sorted by length and then alphabetically and without duplicates,
+     * pointing directly into the index.
+     */
+    auto getNames() const { return candidates.getNames(); }
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <ranges>
+#include <cstdint>
+#include <cstddef>
+#include "CharacterSignature.hpp"
+
+/**
+ * @class CandidateStore
+ * @brief Compact, read-only view over the binary names a query is matched against.
+ *
+ * The names are stored as a structure of arrays: one contiguous arena of characters, and parallel arrays holding the
+ * offset in the arena, the length and the character signature of each name. Names are sorted by length first and then
+ * alphabetically, and a bucket table records where each length starts, so that all the names within a range of lengths
+ * form a single contiguous slice and the length heuristic needs no per-name test.
+ *
+ * The store does not own its arrays: they point either into the memory mapped BinaryIndex, or into a Storage built in
+ * memory with build.
+ */
+class CandidateStore {
+
+public:
+
+    /**
+     * Range [first, last) of positions in the store.
+     */
+    struct Slice {
+        std::uint32_t first = 0;
+        std::uint32_t last = 0;
+
+        std::uint32_t size() const { return last - first; }
+    };
+
+    /**
+     * Owned arrays backing a store built in memory, laid out exactly as they are serialized in the BinaryIndex.
+     */
+    struct Storage {
+        std::string arena;
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> lengths;
+        std::vector<CharacterSignature> signatures;
+        // lengthBuckets[l] is the position of the first name of length l or more, the last element is the name count
+        std::vector<std::uint32_t> lengthBuckets{0};
+    };
+
+private:
+
+    const char * arena = nullptr;
+    const std::uint32_t * offsets = nullptr;
+    const std::uint32_t * lengths = nullptr;
+    const CharacterSignature * signatures = nullptr;
+    const std::uint32_t * lengthBuckets = nullptr;
+    std::size_t lengthBucketCount = 0;
+    std::size_t count = 0;
+
+public:
+
+    CandidateStore() { }
+
+    CandidateStore(const char * arena, const std::uint32_t * offsets, const std::uint32_t * lengths, const CharacterSignature * signatures,
+                   const std::uint32_t * lengthBuckets, std::size_t lengthBucketCount, std::size_t count)
+        : arena(arena), offsets(offsets), lengths(lengths), signatures(signatures), lengthBuckets(lengthBuckets), lengthBucketCount(lengthBucketCount), count(count) { }
+
+    explicit CandidateStore(const Storage& storage)
+        : CandidateStore(storage.arena.data(), storage.offsets.data(), storage.lengths.data(), storage.signatures.data(),
+                         storage.lengthBuckets.data(), storage.lengthBuckets.size(), storage.offsets.size()) { }
+
+    /**
+     * Sorts and deduplicates the given names and lays them out in the store format.
+     *
+     * @tparam NameRange Any iterable container of names convertible to std::string_view.
+     * @param names the names to store, in any order and possibly repeated
+     * @return the arrays of the store, to be wrapped with CandidateStore(const Storage&) or serialized.
+     */
+    template <typename NameRange>
+    static Storage build(const NameRange& names) {
+        std::vector<std::string_view> sortedNames;
+        for (const auto& name : names)
+            sortedNames.emplace_back(name);
+
+        std::sort(sortedNames.begin(), sortedNames.end(), [](std::string_view first, std::string_view second) {
+            return first.size() != second.size() ? first.size() < second.size() : first < second;
+        });
+        sortedNames.erase(std::unique(sortedNames.begin(), sortedNames.end()), sortedNames.end());
+
+        Storage storage;
+        std::size_t arenaSize = 0;
+        for (std::string_view name : sortedNames)
+            arenaSize += name.size();
+
+        storage.arena.reserve(arenaSize);
+        storage.offsets.reserve(sortedNames.size());
+        storage.lengths.reserve(sortedNames.size());
+        storage.signatures.reserve(sortedNames.size());
+        storage.lengthBuckets.clear();
+
+        for (std::string_view name : sortedNames) {
+            while (storage.lengthBuckets.size() <= name.size())
+                storage.lengthBuckets.push_back(static_cast<std::uint32_t>(storage.offsets.size()));
+
+            storage.offsets.push_back(static_cast<std::uint32_t>(storage.arena.size()));
+            storage.lengths.push_back(static_cast<std::uint32_t>(name.size()));
+            storage.signatures.push_back(CharacterSignature::compute(name));
+            storage.arena.append(name);
+        }
+        storage.lengthBuckets.push_back(static_cast<std::uint32_t>(storage.offsets.size()));
+
+        return storage;
+    }
+
+    std::size_t size() const { return count; }
+
+    std::string_view getName(std::size_t position) const { return std::string_view(arena + offsets[position], lengths[position]); }
+
+    std::uint32_t getLength(std::size_t position) const { return lengths[position]; }
+
+    const CharacterSignature& getSignature(std::size_t position) const { return signatures[position]; }
+
+    /**
+     * @return the character signatures of the names, in store order, as a contiguous array.
+     */
+    const CharacterSignature * getSignatures() const { return signatures; }
+
+    /**
+     * @return the positions of the names whose length is within [minimumLength, maximumLength].
+     */
+    Slice getLengthSlice(std::size_t minimumLength, std::size_t maximumLength) const {
+        if (lengthBucketCount < 2 || minimumLength > maximumLength)
+            return Slice{};
+
+        // lengthBuckets has one element per length up to the longest name, plus the terminating count
+        const std::size_t longestLength = lengthBucketCount - 2;
+        if (minimumLength > longestLength)
+            return Slice{static_cast<std::uint32_t>(count), static_cast<std::uint32_t>(count)};
+
+        return Slice{lengthBuckets[minimumLength], lengthBuckets[std::min(maximumLength, longestLength) + 1]};
+    }
+
+    Slice getAll() const { return Slice{0, static_cast<std::uint32_t>(count)}; }
+
+    /**
+     * @return the position of the name, found with a binary search within its length bucket, or size() if it is not in the store.
+     */
+    std::uint32_t find(std::string_view name) const {
+        const Slice slice = getLengthSlice(name.size(), name.size());
+        std::uint32_t first = slice.first;
+        std::uint32_t last = slice.last;
+        while (first < last) {
+            const std::uint32_t middle = first + (last - first) / 2;
+            if (getName(middle) < name)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        return first < slice.last && getName(first) == name ? first : static_cast<std::uint32_t>(count);
+    }
+
+    /**
+     * @return a view over every name of the store, sorted by length and then alphabetically.
+     */
+    auto getNames() const {
+        return std::views::iota(std::size_t{0}, size()) | std::views::transform([this](std::size_t position) { return getName(position); });
+    }
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <string_view>
+#include <bitset>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @class CharacterSignature
+ * @brief Fixed-width bitmap of the characters appearing in a word, used by the letter heuristic instead of sets of characters.
+ *
+ * Bit c is set when the ASCII character c appears in the word. File names cannot contain the NUL character, so bit 0 is
+ * used instead to flag words containing bytes outside of ASCII. The number of distinct characters two words share is the
+ * popcount of the AND of their signatures, which is exact whenever the first word is ASCII only: a character of the second
+ * word outside of ASCII can never be shared with it. Queries containing other bytes fall back to an exact comparison.
+ */
+class CharacterSignature {
+
+public:
+
+    std::uint64_t low = 0;
+    std::uint64_t high = 0;
+
+    static constexpr std::uint64_t nonAsciiFlag = 1;
+
+    CharacterSignature() { }
+
+    CharacterSignature(std::uint64_t low, std::uint64_t high) : low(low), high(high) { }
+
+    static CharacterSignature compute(std::string_view word) {
+        CharacterSignature signature;
+        for (char character : word) {
+            const unsigned char byte = static_cast<unsigned char>(character);
+            if (byte >= 128)
+                signature.low |= nonAsciiFlag;
+            else if (byte < 64)
+                signature.low |= std::uint64_t{1} << byte;
+            else
+                signature.high |= std::uint64_t{1} << (byte - 64);
+        }
+        return signature;
+    }
+
+    bool hasNonAsciiCharacters() const { return (low & nonAsciiFlag) != 0; }
+
+    /**
+     * @return the number of distinct ASCII characters in the signature.
+     */
+    int countCharacters() const {
+        return std::popcount(low & ~nonAsciiFlag) + std::popcount(high);
+    }
+
+    /**
+     * @return the number of distinct ASCII characters appearing in both signatures.
+     */
+    int countSharedCharacters(const CharacterSignature& other) const {
+        return std::popcount(low & other.low & ~nonAsciiFlag) + std::popcount(high & other.high);
+    }
+
+    /**
+     * Counts the distinct bytes of a word, and how many of them appear in another word, for words which are not ASCII only.
+     */
+    static void countCharactersExactly(std::string_view word, std::string_view other, int& characters, int& sharedCharacters) {
+        std::bitset<256> wordCharacters;
+        std::bitset<256> otherCharacters;
+        for (char character : word)
+            wordCharacters.set(static_cast<unsigned char>(character));
+        for (char character : other)
+            otherCharacters.set(static_cast<unsigned char>(character));
+
+        characters = static_cast<int>(wordCharacters.count());
+        sharedCharacters = static_cast<int>((wordCharacters & otherCharacters).count());
+    }
+
+    /**
+     * Letter heuristic: the candidate must contain at least half (rounded down) of the distinct characters of the query.
+     *
+     * @param query the input command
+     * @param querySignature the signature of the input command
+     * @param candidate the binary name
+     * @param candidateSignature the signature of the binary name
+     * @return true if the candidate shares enough characters with the query.
+     */
+    static bool passesLetterCondition(std::string_view query, const CharacterSignature& querySignature, std::string_view candidate, const CharacterSignature& candidateSignature) {
+        if (querySignature.hasNonAsciiCharacters()) {
+            int characters, sharedCharacters;
+            countCharactersExactly(query, candidate, characters, sharedCharacters);
+            return sharedCharacters >= characters / 2;
+        }
+        return querySignature.countSharedCharacters(candidateSignature) >= querySignature.countCharacters() / 2;
+    }
+
+private:
+
+    static void filterScalar(const CharacterSignature * signatures, std::size_t count, const CharacterSignature& querySignature, int minimumSharedCharacters, std::uint8_t * passes, std::size_t start) {
+        for (std::size_t i = start; i < count; ++i)
+            passes[i] = querySignature.countSharedCharacters(signatures[i]) >= minimumSharedCharacters;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    /**
+     * AVX2 version of filterScalar, two signatures per iteration. AVX2 has no popcount instruction, so the bits are counted
+     * per nibble with a shuffle-based lookup table and summed per 64-bit lane with vpsadbw.
+     */
+    [[gnu::target("avx2")]]
+    static void filterAvx2(const CharacterSignature * signatures, std::size_t count, const CharacterSignature& querySignature, int minimumSharedCharacters, std::uint8_t * passes) {
+        const __m256i query = _mm256_set_epi64x(
+            static_cast<long long>(querySignature.high), static_cast<long long>(querySignature.low & ~nonAsciiFlag),
+            static_cast<long long>(querySignature.high), static_cast<long long>(querySignature.low & ~nonAsciiFlag));
+        const __m256i nibbleCounts = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i lowNibbleMask = _mm256_set1_epi8(0x0F);
+
+        std::size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            const __m256i shared = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(signatures + i)), query);
+            const __m256i lowNibbles = _mm256_shuffle_epi8(nibbleCounts, _mm256_and_si256(shared, lowNibbleMask));
+            const __m256i highNibbles = _mm256_shuffle_epi8(nibbleCounts, _mm256_and_si256(_mm256_srli_epi16(shared, 4), lowNibbleMask));
+            const __m256i laneCounts = _mm256_sad_epu8(_mm256_add_epi8(lowNibbles, highNibbles), _mm256_setzero_si256());
+
+            // Each signature spans two 64-bit lanes
+            alignas(32) std::uint64_t counts[4];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(counts), laneCounts);
+            passes[i] = static_cast<int>(counts[0] + counts[1]) >= minimumSharedCharacters;
+            passes[i + 1] = static_cast<int>(counts[2] + counts[3]) >= minimumSharedCharacters;
+        }
+
+        filterScalar(signatures, count, querySignature, minimumSharedCharacters, passes, i);
+    }
+#endif
+
+public:
+
+    /**
+     * Applies the letter heuristic to a contiguous array of signatures, using AVX2 on x86 processors supporting it. The query
+     * must be ASCII only, otherwise passesLetterCondition has to be used for each candidate.
+     *
+     * @param signatures the signatures of the candidates
+     * @param count the number of candidates
+     * @param querySignature the signature of the input command
+     * @param passes output array of count elements, set to 1 for the candidates passing the heuristic and 0 otherwise
+     */
+    static void filterLetterCondition(const CharacterSignature * signatures, std::size_t count, const CharacterSignature& querySignature, std::uint8_t * passes) {
+        const int minimumSharedCharacters = querySignature.countCharacters() / 2;
+
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("avx2")) {
+            filterAvx2(signatures, count, querySignature, minimumSharedCharacters, passes);
+            return;
+        }
+#endif
+        filterScalar(signatures, count, querySignature, minimumSharedCharacters, passes, 0);
+    }
+};
+
+static_assert(sizeof(CharacterSignature) == 16, "signatures are stored as a contiguous array in the binary index");
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <SQLiteCpp/SQLiteCpp.h>
+#include "Log.hpp"
+#include "Stats.hpp"
+#include "Settings.hpp"
+#include "DatabaseStatements.hpp"
+
+#define HISTORY_SNAPSHOT_MAGIC "SMILEHIS"
+#define HISTORY_SNAPSHOT_VERSION 1
+
+/**
+ * @class CommandHistory
+ * @brief In-memory copy of the history table, used to rank the suggestions by how often and how recently they were run.
+ *
+ * The table is read with a single scan of getAllQuery into an array sorted by command, then saved in a binary snapshot
+ * tagged with the state (mtime, size and inode) of the database and of its write-ahead log. As long as neither changes,
+ * the snapshot is loaded instead, without opening the database.
+ */
+class CommandHistory {
+
+public:
+
+    struct Entry {
+        std::string command;
+        std::uint64_t executionCounter = 0;
+        // Unix time of the last execution, 0 when unknown
+        std::int64_t lastExecution = 0;
+    };
+
+private:
+
+    struct FileState {
+        std::int64_t mtimeSeconds = 0;
+        std::int64_t mtimeNanoseconds = 0;
+        std::uint64_t size = 0;
+        std::uint64_t inode = 0;
+
+        bool operator==(const FileState&) const = default;
+    };
+
+    struct SnapshotHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t entryCount;
+        FileState database;
+        FileState writeAheadLog;
+    };
+
+    // Sorted by command
+    std::vector<Entry> entries;
+
+    static FileState getFileState(const std::filesystem::path& path) {
+        FileState state;
+        struct stat status;
+        if (stat(path.c_str(), &status) == 0) {
+            state.mtimeSeconds = status.st_mtim.tv_sec;
+            state.mtimeNanoseconds = status.st_mtim.tv_nsec;
+            state.size = static_cast<std::uint64_t>(status.st_size);
+            state.inode = status.st_ino;
+        }
+        return state;
+    }
+
+    /**
+     * Parses the "YYYY-MM-DD HH:MM:SS" UTC timestamps written by SQLite's current_timestamp.
+     *
+     * @return the Unix time of the timestamp, 0 if it is not in that format (e.g. 'N/A').
+     */
+    static std::int64_t parseTimestamp(const char * timestamp) {
+        struct tm time{};
+        if (std::sscanf(timestamp, "%d-%d-%d %d:%d:%d", &time.tm_year, &time.tm_mon, &time.tm_mday, &time.tm_hour, &time.tm_min, &time.tm_sec) != 6)
+            return 0;
+        time.tm_year -= 1900;
+        time.tm_mon -= 1;
+        return static_cast<std::int64_t>(timegm(&time));
+    }
+
+    bool loadSnapshot(const std::filesystem::path& snapshotFilePath, const FileState& database, const FileState& writeAheadLog) {
+        std::ifstream file(snapshotFilePath, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        SnapshotHeader header{};
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+            || std::memcmp(header.magic, HISTORY_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+            || header.version != HISTORY_SNAPSHOT_VERSION
+            || !(header.database == database) || !(header.writeAheadLog == writeAheadLog))
+            return false;
+
+        std::vector<Entry> loadedEntries(header.entryCount);
+        for (Entry& entry : loadedEntries) {
+            std::uint32_t length = 0;
+            if (!file.read(reinterpret_cast<char *>(&length), sizeof(length))
+                || !file.read(reinterpret_cast<char *>(&entry.executionCounter), sizeof(entry.executionCounter))
+                || !file.read(reinterpret_cast<char *>(&entry.lastExecution), sizeof(entry.lastExecution)))
+                return false;
+            entry.command.resize(length);
+            if (!file.read(entry.command.data(), length))
+                return false;
+        }
+
+        entries = std::move(loadedEntries);
+        return true;
+    }
+
+    void writeSnapshot(const std::filesystem::path& snapshotFilePath, const FileState& database, const FileState& writeAheadLog) const {
+        SnapshotHeader header{};
+        std::memcpy(header.magic, HISTORY_SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = HISTORY_SNAPSHOT_VERSION;
+        header.entryCount = static_cast<std::uint32_t>(entries.size());
+        header.database = database;
+        header.writeAheadLog = writeAheadLog;
+
+        std::filesystem::path temporaryPath = snapshotFilePath.string() + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            for (const Entry& entry : entries) {
+                const std::uint32_t length = static_cast<std::uint32_t>(entry.command.size());
+                file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+                file.write(reinterpret_cast<const char *>(&entry.executionCounter), sizeof(entry.executionCounter));
+                file.write(reinterpret_cast<const char *>(&entry.lastExecution), sizeof(entry.lastExecution));
+                file.write(entry.command.data(), static_cast<std::streamsize>(entry.command.size()));
+            }
+            if (!file.good())
+                return;
+        }
+
+        std::error_code errorCode;
+        std::filesystem::rename(temporaryPath, snapshotFilePath, errorCode);
+        if (errorCode)
+            std::filesystem::remove(temporaryPath, errorCode);
+    }
+
+    bool loadFromDatabase(Settings& settings) {
+        DatabaseStatements * databaseStatements = settings.getDatabaseStatements();
+        if (databaseStatements == nullptr)
+            return false;
+
+        try {
+            SQLite::Statement& query = databaseStatements->getAllPreparedQuery();
+
+            std::vector<Entry> loadedEntries;
+            while (query.executeStep()) {
+                Entry entry;
+                entry.command = query.getColumn(0).getString();
+                entry.executionCounter = static_cast<std::uint64_t>(std::max<std::int64_t>(0, query.getColumn(1).getInt64()));
+                entry.lastExecution = parseTimestamp(query.getColumn(2).getText());
+                loadedEntries.push_back(std::move(entry));
+            }
+
+            std::sort(loadedEntries.begin(), loadedEntries.end(), [](const Entry& first, const Entry& second) { return first.command < second.command; });
+            entries = std::move(loadedEntries);
+            return true;
+        } catch (const SQLite::Exception& e) {
+            Log::error("Error while reading the history: {}", e.what());
+            return false;
+        }
+    }
+
+public:
+
+    CommandHistory() { }
+
+    /**
+     * Loads the history, from the snapshot when the database did not change since it was taken, from the database
+     * otherwise. Nothing is loaded, and the database is not created, when history storage is disabled or empty.
+     *
+     * @return true if the history was loaded.
+     */
+    bool load(Settings& settings) {
+        Stats::Span span("historyLoad");
+        entries.clear();
+
+        if (!settings.getDatabaseHistoryStorageEnabled())
+            return false;
+
+        const FileState database = getFileState(settings.getDatabaseFilePath());
+        if (database.inode == 0)
+            return false;
+        const FileState writeAheadLog = getFileState(settings.getDatabaseFilePath().string() + "-wal");
+
+        if (loadSnapshot(settings.getHistorySnapshotFilePath(), database, writeAheadLog)) {
+            Log::info("Loaded {} history entries from the snapshot", entries.size());
+            return true;
+        }
+
+        if (!loadFromDatabase(settings))
+            return false;
+
+        Log::info("Loaded {} history entries from the database", entries.size());
+        // The state is taken again, opening the database may have created the write-ahead log
+        writeSnapshot(settings.getHistorySnapshotFilePath(), getFileState(settings.getDatabaseFilePath()), getFileState(settings.getDatabaseFilePath().string() + "-wal"));
+        return true;
+    }
+
+    /**
+     * Frecency of a command: its number of executions, weighted by how recently it was last run (four times more within
+     * the hour, twice within the day, half as much after a week and a quarter after a month).
+     *
+     * @param command the name of the binary
+     * @param now the current Unix time
+     * @return the frecency of the command, 0 if it was never run.
+     */
+    double getFrecency(std::string_view command, std::int64_t now) const {
+        auto entry = std::lower_bound(entries.begin(), entries.end(), command, [](const Entry& current, std::string_view value) { return current.command < value; });
+        if (entry == entries.end() || entry->command != command || entry->executionCounter == 0)
+            return 0;
+
+        const std::int64_t age = entry->lastExecution == 0 ? INT64_MAX : now - entry->lastExecution;
+        double weight = 1;
+        if (age < 60 * 60)
+            weight = 4;
+        else if (age < 24 * 60 * 60)
+            weight = 2;
+        else if (age >= 30 * 24 * 60 * 60)
+            weight = 0.25;
+        else if (age >= 7 * 24 * 60 * 60)
+            weight = 0.5;
+        return static_cast<double>(entry->executionCounter) * weight;
+    }
+
+    static std::int64_t getCurrentTime() {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    bool empty() const { return entries.empty(); }
+
+    std::size_t size() const { return entries.size(); }
+};
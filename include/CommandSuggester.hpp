@@ -0,0 +1,399 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <ranges>
+#include <memory_resource>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include "Settings.hpp"
+#include "CommonUtils.hpp"
+#include "WordDistanceHandler.hpp"
+#include "CharacterSignature.hpp"
+#include "CandidateStore.hpp"
+#include "QGramIndex.hpp"
+#include "CommandHistory.hpp"
+#include "SuggestionSelector.hpp"
+#include "ThreadPool.hpp"
+#include "QueryArena.hpp"
+
+// Number of consecutive names of the store a worker claims at once when the scoring is parallel
+#define PARALLEL_SCORING_CHUNK_SIZE 1024
+
+/**
+ * @class CommandSuggester
+ * @brief Selection and presentation of the suggestions, shared by the in-process lookup and the daemon.
+ */
+class CommandSuggester {
+
+public:
+
+    /**
+     * A binary close to the input command, with its distance from it. The name points into the store the binary was found in.
+     */
+    struct Suggestion {
+        std::string_view name;
+        int distance;
+    };
+
+    /**
+     * Checks whether a binary passes the heuristics enabled in the settings, used to avoid computing the distance of
+     * binaries that are very unlikely to be what the user meant.
+     *
+     * @param inputCommand the command typed by the user
+     * @param inputCommandSignature the character signature of the input command, computed once per query
+     * @param binary the name of the binary to check
+     * @param binarySignature the character signature of the binary
+     * @param settings the settings holding the heuristics configuration
+     * @return true if the distance between the binary and the input command is worth computing.
+     */
+    static bool passesHeuristics(std::string_view inputCommand, const CharacterSignature& inputCommandSignature, std::string_view binary, const CharacterSignature& binarySignature, const Settings& settings) {
+        if (!settings.getLengthConditionHeuristicEnabled())
+            return true;
+
+        return passesLengthCondition(inputCommand, binary, settings)
+            && CharacterSignature::passesLetterCondition(inputCommand, inputCommandSignature, binary, binarySignature);
+    }
+
+    static bool passesHeuristics(std::string_view inputCommand, std::string_view binary, const Settings& settings) {
+        return passesHeuristics(inputCommand, CharacterSignature::compute(inputCommand), binary, CharacterSignature::compute(binary), settings);
+    }
+
+    /**
+     * This heuristic is used to improve runtimes by reducing the numbers of binaries to check based on the total amount of
+     * length differencies between the two words. By default, if their length is different by two or more letters, their
+     * distance do not get calculated
+     */
+    static bool passesLengthCondition(std::string_view inputCommand, std::string_view binary, const Settings& settings) {
+        int absoluteLengthLetterDifference = std::abs(static_cast<int>(binary.length()) - static_cast<int>(inputCommand.length()));
+        return absoluteLengthLetterDifference <= settings.getLengthConditionHeuristic();
+    }
+
+    /**
+     * Names of a CandidateStore passing the heuristics for a query: the length condition selects a slice of adjacent
+     * length buckets, and the letter condition is evaluated over the signatures of that slice only.
+     */
+    struct CandidateFilter {
+        CandidateStore::Slice slice;
+        // One flag for each name of the slice, set to 1 when the name passes the heuristics
+        std::pmr::vector<std::uint8_t> passes;
+
+        bool accepts(std::uint32_t position) const {
+            return position >= slice.first && position < slice.last && passes[position - slice.first] != 0;
+        }
+
+        std::size_t count() const { return static_cast<std::size_t>(std::count(passes.begin(), passes.end(), 1)); }
+    };
+
+    /**
+     * Applies the heuristics to every name of the store at once. When a q-gram index is given and the Jaccard threshold is
+     * set, only the names it returns are considered, and the letter condition is evaluated on those only.
+     *
+     * @param inputCommand the command typed by the user
+     * @param candidates the names of the binaries
+     * @param settings the settings holding the heuristics configuration
+     * @param qGramIndex the q-gram index of the store, or nullptr to skip the Jaccard prefilter
+     * @param resource where the flags and the temporary arrays of the prefilter are allocated
+     * @return the slice of the store within the length condition, and which of its names pass the other heuristics.
+     */
+    static CandidateFilter filterCandidates(std::string_view inputCommand, const CandidateStore& candidates, const Settings& settings, const QGramIndex * qGramIndex = nullptr, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) {
+        CandidateFilter filter{CandidateStore::Slice{}, std::pmr::vector<std::uint8_t>(resource)};
+        const bool lengthConditionEnabled = settings.getLengthConditionHeuristicEnabled();
+
+        if (!lengthConditionEnabled)
+            filter.slice = candidates.getAll();
+        else if (settings.getLengthConditionHeuristic() >= 0) {
+            const std::size_t inputLength = inputCommand.length();
+            const std::size_t difference = static_cast<std::size_t>(settings.getLengthConditionHeuristic());
+            filter.slice = candidates.getLengthSlice(inputLength > difference ? inputLength - difference : 0, inputLength + difference);
+        }
+
+        if (filter.slice.size() == 0)
+            return filter;
+
+        const CharacterSignature inputCommandSignature = CharacterSignature::compute(inputCommand);
+
+        if (qGramIndex != nullptr && settings.getQGramJaccardThreshold() > 0) {
+            filter.passes.assign(filter.slice.size(), 0);
+            qGramIndex->filterJaccard(inputCommand, filter.slice, settings.getQGramJaccardThreshold(), filter.passes.data(), resource);
+
+            if (lengthConditionEnabled) {
+                for (std::uint32_t i = filter.slice.first; i < filter.slice.last; ++i) {
+                    std::uint8_t& passes = filter.passes[i - filter.slice.first];
+                    passes = passes && CharacterSignature::passesLetterCondition(inputCommand, inputCommandSignature, candidates.getName(i), candidates.getSignature(i));
+                }
+            }
+            return filter;
+        }
+
+        filter.passes.assign(filter.slice.size(), 1);
+        if (!lengthConditionEnabled)
+            return filter;
+
+        if (inputCommandSignature.hasNonAsciiCharacters()) {
+            for (std::uint32_t i = filter.slice.first; i < filter.slice.last; ++i)
+                filter.passes[i - filter.slice.first] = CharacterSignature::passesLetterCondition(inputCommand, inputCommandSignature, candidates.getName(i), candidates.getSignature(i));
+            return filter;
+        }
+
+        CharacterSignature::filterLetterCondition(candidates.getSignatures() + filter.slice.first, filter.slice.size(), inputCommandSignature, filter.passes.data());
+        return filter;
+    }
+
+    /**
+     * @return true if the lookup of the filtered names is worth spreading over several threads, according to the settings.
+     */
+    static bool shouldScoreInParallel(const CandidateFilter& filter, const Settings& settings) {
+        const int threshold = settings.getParallelScoringThreshold();
+        return threshold > 0 && filter.count() >= static_cast<std::size_t>(threshold);
+    }
+
+    /**
+     * Finds, with a linear scan, the binaries passing the heuristics at the minimum distance from the input command, or
+     * farther by at most the given margin, within the maximum edit distance of the settings. The cutoff of the selection is
+     * passed to the distance kernel, and the scan stops as soon as no binary left can be selected.
+     *
+     * @param inputCommand the command typed by the user
+     * @param candidates the names of the binaries
+     * @param settings the settings holding the heuristics configuration
+     * @param qGramIndex the q-gram index of the store, or nullptr to skip the Jaccard prefilter
+     * @param margin how much farther than the closest binaries the returned ones can be
+     * @param maxResults the maximum number of binaries to return, 0 for no maximum
+     * @param resource where the suggestions and the temporary arrays of the lookup are allocated
+     * @param threadPool the pool the scoring is spread over when enough binaries pass the heuristics, or nullptr to always
+     * score on the calling thread
+     * @return the binaries found with their distance, sorted alphabetically.
+     */
+    static std::pmr::vector<Suggestion> findClosestCommands(std::string_view inputCommand, const CandidateStore& candidates, const Settings& settings, const QGramIndex * qGramIndex = nullptr, int margin = 0, std::size_t maxResults = 0, std::pmr::memory_resource * resource = std::pmr::get_default_resource(), ThreadPool * threadPool = nullptr) {
+        const CandidateFilter filter = filterCandidates(inputCommand, candidates, settings, qGramIndex, resource);
+        return findClosestCommands(inputCommand, candidates, filter, settings, margin, maxResults, resource,
+            threadPool != nullptr && shouldScoreInParallel(filter, settings) ? threadPool : nullptr);
+    }
+
+    /**
+     * Same lookup over names already filtered. With a thread pool, the slice is split in chunks of
+     * PARALLEL_SCORING_CHUNK_SIZE names claimed by the workers one after the other, each worker keeping its own selection
+     * and sharing its bound with the others through an atomic cutoff. The selection of a worker is allocated in a buffer of
+     * QUERY_ARENA_THREAD_SIZE bytes the calling thread takes from the resource beforehand, the resource not having to be
+     * thread-safe. The selections are then merged by identifier, so
+     * that the result is the one of the scan on the calling thread, whatever the number of threads and the scheduling.
+     *
+     * @param inputCommand the command typed by the user
+     * @param candidates the names of the binaries
+     * @param filter the names of the store passing the heuristics for the input command
+     * @param settings the settings holding the maximum edit distance
+     * @param margin how much farther than the closest binaries the returned ones can be
+     * @param maxResults the maximum number of binaries to return, 0 for no maximum
+     * @param resource where the suggestions and the temporary arrays of the lookup are allocated
+     * @param threadPool the pool the scoring is spread over, or nullptr to score on the calling thread
+     * @return the binaries found with their distance, sorted alphabetically.
+     */
+    static std::pmr::vector<Suggestion> findClosestCommands(std::string_view inputCommand, const CandidateStore& candidates, const CandidateFilter& filter, const Settings& settings, int margin, std::size_t maxResults, std::pmr::memory_resource * resource, ThreadPool * threadPool = nullptr) {
+        const bool bitParallel = WordDistanceHandler::isBitParallelEligible(inputCommand);
+        const WordDistanceHandler::QueryPattern pattern = bitParallel ? WordDistanceHandler::buildQueryPattern(inputCommand) : WordDistanceHandler::QueryPattern{};
+        auto calculateDistance = [&](std::string_view binary, int cutoff) {
+            return bitParallel
+                ? WordDistanceHandler::calculateWordDistance(pattern, binary, cutoff)
+                : WordDistanceHandler::calculateWordDistance(inputCommand, binary, cutoff);
+        };
+
+        const bool exactMatchRuledOut = !filter.accepts(candidates.find(inputCommand));
+        SuggestionSelector selector(settings.getMaxEditDistance(), maxResults, margin, exactMatchRuledOut, resource);
+
+        if (threadPool == nullptr || threadPool->size() < 2) {
+            for (std::uint32_t i = filter.slice.first; i < filter.slice.last; ++i) {
+                if (!filter.passes[i - filter.slice.first])
+                    continue;
+
+                const int cutoff = selector.getCutoff();
+                if (cutoff < 0)
+                    break;
+
+                selector.add({i, calculateDistance(candidates.getName(i), cutoff)});
+            }
+        } else {
+            const std::size_t chunkCount = (filter.slice.size() + PARALLEL_SCORING_CHUNK_SIZE - 1) / PARALLEL_SCORING_CHUNK_SIZE;
+            std::atomic<std::size_t> nextChunk{0};
+            std::atomic<int> sharedCutoff{INT_MAX};
+
+            // A selection outgrowing its buffer goes on in the heap
+            struct WorkerSelection {
+                void * buffer;
+                std::pmr::monotonic_buffer_resource resource{buffer, QUERY_ARENA_THREAD_SIZE};
+                std::pmr::vector<SuggestionSelector::Match> matches{&resource};
+
+                explicit WorkerSelection(void * buffer) : buffer(buffer) { }
+            };
+            const std::size_t workerCount = threadPool->size();
+            std::pmr::polymorphic_allocator<WorkerSelection> allocator(resource);
+            WorkerSelection * workerSelections = allocator.allocate(workerCount);
+            for (std::size_t worker = 0; worker < workerCount; ++worker)
+                allocator.construct(workerSelections + worker, allocator.allocate_bytes(QUERY_ARENA_THREAD_SIZE));
+
+            auto scanChunks = [&](std::size_t worker) {
+                // Chunks are claimed in increasing order, so each worker scans its names by increasing identifier
+                SuggestionSelector workerSelector(settings.getMaxEditDistance(), maxResults, margin, exactMatchRuledOut, &workerSelections[worker].resource);
+                for (std::size_t chunk = nextChunk.fetch_add(1, std::memory_order_relaxed); chunk < chunkCount && !workerSelector.isComplete();
+                    chunk = nextChunk.fetch_add(1, std::memory_order_relaxed)) {
+                    const std::uint32_t first = filter.slice.first + static_cast<std::uint32_t>(chunk * PARALLEL_SCORING_CHUNK_SIZE);
+                    const std::uint32_t last = std::min<std::uint32_t>(first + PARALLEL_SCORING_CHUNK_SIZE, filter.slice.last);
+
+                    for (std::uint32_t i = first; i < last; ++i) {
+                        if (!filter.passes[i - filter.slice.first])
+                            continue;
+
+                        const int cutoff = std::min(workerSelector.getCutoff(), sharedCutoff.load(std::memory_order_relaxed));
+                        if (cutoff < 0)
+                            break;
+
+                        const int distance = calculateDistance(candidates.getName(i), cutoff);
+                        if (distance > cutoff)
+                            continue;
+
+                        workerSelector.add({i, distance});
+                        const int workerCutoff = workerSelector.getSharedCutoff();
+                        int current = sharedCutoff.load(std::memory_order_relaxed);
+                        while (workerCutoff < current && !sharedCutoff.compare_exchange_weak(current, workerCutoff, std::memory_order_relaxed)) { }
+                    }
+                }
+                workerSelections[worker].matches = workerSelector.takeMatches();
+            };
+            // The task only holds a reference and an index, which std::function stores without allocating
+            for (std::size_t worker = 0; worker < workerCount; ++worker)
+                threadPool->submit([&scanChunks, worker]() { scanChunks(worker); });
+            threadPool->wait();
+
+            // Every binary of the final selection is in the selection of the worker that scanned it, offering them all by
+            // increasing identifier selects the same binaries as the scan on the calling thread
+            std::pmr::vector<SuggestionSelector::Match> matches(resource);
+            for (std::size_t worker = 0; worker < workerCount; ++worker)
+                matches.insert(matches.end(), workerSelections[worker].matches.begin(), workerSelections[worker].matches.end());
+            std::sort(matches.begin(), matches.end(), [](const auto& first, const auto& second) { return first.nameId < second.nameId; });
+            for (const SuggestionSelector::Match& match : matches)
+                selector.add(match);
+
+            for (std::size_t worker = 0; worker < workerCount; ++worker) {
+                void * buffer = workerSelections[worker].buffer;
+                std::destroy_at(workerSelections + worker);
+                allocator.deallocate_bytes(buffer, QUERY_ARENA_THREAD_SIZE);
+            }
+            allocator.deallocate(workerSelections, workerCount);
+        }
+
+        const std::pmr::vector<SuggestionSelector::Match> matches = selector.takeMatches();
+        std::pmr::vector<Suggestion> similarCommands(resource);
+        similarCommands.reserve(matches.size());
+        for (const SuggestionSelector::Match& match : matches)
+            similarCommands.push_back({candidates.getName(match.nameId), match.distance});
+
+        // The store is sorted by length first
+        std::sort(similarCommands.begin(), similarCommands.end(), [](const Suggestion& first, const Suggestion& second) { return first.name < second.name; });
+        return similarCommands;
+    }
+
+    /**
+     * @return the number of characters the binary starts with that the input command starts with too.
+     */
+    static std::size_t getCommonPrefixLength(std::string_view inputCommand, std::string_view binary) {
+        return static_cast<std::size_t>(std::ranges::mismatch(inputCommand, binary).in1 - inputCommand.begin());
+    }
+
+    /**
+     * Orders the suggestions by frecency, so that the binaries the user runs the most come first. Only the binaries at the
+     * minimum distance are always kept: the ones farther by at most the margin are kept only if they are in the history.
+     * Among the binaries as frequent and as close, the ones sharing the longest prefix with the input command come first,
+     * a typo being less likely in the first characters.
+     *
+     * @param inputCommand the command typed by the user
+     * @param suggestions the binaries found with their distance, sorted alphabetically
+     * @param history the command history, or nullptr to only keep the closest binaries in alphabetical order
+     * @param margin how much farther than the closest binaries a binary in the history can be
+     * @param maxSuggestions the maximum number of binaries to suggest, 0 for no maximum
+     * @param resource where the ranking and the returned names are allocated
+     * @return the names of the suggested binaries, most relevant first, pointing where the names of the suggestions point.
+     */
+    static std::pmr::vector<std::string_view> rankSuggestions(std::string_view inputCommand, std::span<const Suggestion> suggestions, const CommandHistory * history, int margin, std::size_t maxSuggestions = 0, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) {
+        std::pmr::vector<std::string_view> similarCommands(resource);
+        if (suggestions.empty())
+            return similarCommands;
+
+        const int minimumDistance = std::min_element(suggestions.begin(), suggestions.end(), [](const Suggestion& first, const Suggestion& second) {
+            return first.distance < second.distance;
+        })->distance;
+
+        // The names are unique, so the orders below are total and the sorts need no temporary buffer, unlike stable sorts
+        auto hasLongerPrefix = [inputCommand](std::string_view first, std::string_view second) {
+            const std::size_t firstPrefixLength = getCommonPrefixLength(inputCommand, first);
+            const std::size_t secondPrefixLength = getCommonPrefixLength(inputCommand, second);
+            if (firstPrefixLength != secondPrefixLength)
+                return firstPrefixLength > secondPrefixLength;
+            return first < second;
+        };
+
+        if (history == nullptr || history->empty()) {
+            for (const Suggestion& suggestion : suggestions)
+                if (suggestion.distance == minimumDistance)
+                    similarCommands.push_back(suggestion.name);
+            std::sort(similarCommands.begin(), similarCommands.end(), hasLongerPrefix);
+            if (maxSuggestions > 0 && similarCommands.size() > maxSuggestions)
+                similarCommands.resize(maxSuggestions);
+            return similarCommands;
+        }
+
+        const std::int64_t now = CommandHistory::getCurrentTime();
+        std::pmr::vector<std::pair<double, Suggestion>> rankedSuggestions(resource);
+        rankedSuggestions.reserve(suggestions.size());
+        for (const Suggestion& suggestion : suggestions) {
+            const double frecency = history->getFrecency(suggestion.name, now);
+            if (suggestion.distance == minimumDistance || (suggestion.distance <= minimumDistance + margin && frecency > 0))
+                rankedSuggestions.emplace_back(frecency, suggestion);
+        }
+
+        // Higher frecency first, then closer, then sharing a longer prefix with the input command, then alphabetically
+        std::sort(rankedSuggestions.begin(), rankedSuggestions.end(), [&hasLongerPrefix](const auto& first, const auto& second) {
+            if (first.first != second.first)
+                return first.first > second.first;
+            if (first.second.distance != second.second.distance)
+                return first.second.distance < second.second.distance;
+            return hasLongerPrefix(first.second.name, second.second.name);
+        });
+
+        if (maxSuggestions > 0 && rankedSuggestions.size() > maxSuggestions)
+            rankedSuggestions.resize(maxSuggestions);
+        similarCommands.reserve(rankedSuggestions.size());
+        for (const auto& [frecency, suggestion] : rankedSuggestions)
+            similarCommands.push_back(suggestion.name);
+        return similarCommands;
+    }
+
+    /**
+     * Prints the suggestions for the input command to the user.
+     *
+     * @param inputCommand the command typed by the user
+     * @param similarCommands the names of the suggested binaries
+     * @return true if there was at least one suggestion, false otherwise.
+     */
+    template <typename NameRange>
+    static bool printSuggestions(std::string_view inputCommand, const NameRange& similarCommands) {
+        if (std::ranges::empty(similarCommands)) {
+            std::cout<<"Could not find any similar commands to \""<<inputCommand<<"\"\n";
+            return false;
+        }
+
+        if (std::ranges::size(similarCommands) > 1) {
+            std::cout<<"Could not find command "<<inputCommand<<". Were you looking for these?\n";
+            for (auto const &entry : similarCommands)
+                std::cout<<"- "<<entry<<"\n";
+        } else
+            std::cout<<"Could not find command "<<inputCommand<<". Were you looking for \""<<*std::ranges::begin(similarCommands)<<"\"?\n";
+
+        return true;
+    }
+};
@@ -1,4 +1,24 @@
-#include <spdlog/spdlog.h>
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <system_error>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "ThreadPool.hpp"
+#include "Stats.hpp"
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
@@ -6,9 +26,151 @@ using json = nlohmann::json;
 class CommonUtils {
 
     static const u_int8_t configIndentationSize = 4;
+    static const std::size_t maxScanThreads = 8;
+    static const std::size_t directoryReadBufferSize = 64 * 1024;
+
+public:
+
+    /**
+     * Counters of the work done by the directory scanner since the start of the process.
+     */
+    struct ScanCounters {
+        std::atomic<std::uint64_t> directoriesScanned{0};
+        std::atomic<std::uint64_t> directoryReadCalls{0};
+        std::atomic<std::uint64_t> entriesRead{0};
+        std::atomic<std::uint64_t> metadataCalls{0};
+    };
+
+    static ScanCounters& getScanCounters() {
+        static ScanCounters scanCounters;
+        return scanCounters;
+    }
 
 private:
 
+    /**
+     * Checks whether an entry of an open directory is a file the current user can execute, using faccessat relative to the
+     * directory descriptor (same semantics as access(), real user and group IDs).
+     */
+    static bool isExecutableAt(int directoryFd, const char * name) {
+        getScanCounters().metadataCalls.fetch_add(1, std::memory_order_relaxed);
+        return faccessat(directoryFd, name, X_OK, 0) == 0;
+    }
+
+    /**
+     * Checks the execute permission of an already stat'ed file from its mode bits, as access() does for the real user and
+     * group IDs, so that an entry resolved with fstatat does not cost a faccessat on top. ACLs are not taken into account.
+     */
+    static bool isExecutableStatus(const struct stat& status) {
+        static const uid_t userId = getuid();
+        static const std::vector<gid_t> groupIds = []() {
+            std::vector<gid_t> groups(static_cast<std::size_t>(std::max(getgroups(0, nullptr), 0)));
+            groups.resize(static_cast<std::size_t>(std::max(getgroups(static_cast<int>(groups.size()), groups.data()), 0)));
+            groups.push_back(getgid());
+            return groups;
+        }();
+
+        // root can execute a file as soon as any execute bit is set
+        if (userId == 0)
+            return (status.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) != 0;
+        if (status.st_uid == userId)
+            return (status.st_mode & S_IXUSR) != 0;
+        if (std::find(groupIds.begin(), groupIds.end(), status.st_gid) != groupIds.end())
+            return (status.st_mode & S_IXGRP) != 0;
+        return (status.st_mode & S_IXOTH) != 0;
+    }
+
+    /**
+     * Reads a single directory with getdents64, relying on d_type to avoid a stat for regular files and directories: a regular
+     * file costs one faccessat when executablePermission is set and no call otherwise. Only symbolic links and entries
+     * of unknown type are resolved with fstatat, whose mode bits also give their execute permission: every entry costs at
+     * most one metadata call.
+     *
+     * @param path the directory to read
+     * @param recursive whether subdirectories (including symbolic links to directories) are to be returned in subdirectories
+     * @param executablePermission whether only the files the current user can execute are to be listed
+     * @param fileList where the names of the matching files are appended
+     * @param subdirectories where the full path of the subdirectories are appended when recursive
+     * @throws ```std::filesystem::filesystem_error``` if the directory cannot be opened
+     */
+    static void readDirectory(const std::string& path, bool recursive, bool executablePermission, std::vector<std::string>& fileList, std::vector<std::string>& subdirectories) {
+        int directoryFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directoryFd < 0)
+            throw std::filesystem::filesystem_error("directory scan cannot open directory", path, std::error_code(errno, std::generic_category()));
+
+        ScanCounters& counters = getScanCounters();
+        counters.directoriesScanned.fetch_add(1, std::memory_order_relaxed);
+
+        std::unique_ptr<char[]> buffer(new char[directoryReadBufferSize]);
+
+        while (true) {
+            ssize_t bytesRead = getdents64(directoryFd, buffer.get(), directoryReadBufferSize);
+            counters.directoryReadCalls.fetch_add(1, std::memory_order_relaxed);
+            if (bytesRead <= 0) {
+                if (bytesRead < 0)
+                    Log::warn("Error while reading {}: {}. Ignoring...", path, std::strerror(errno));
+                break;
+            }
+
+            for (ssize_t offset = 0; offset < bytesRead;) {
+                const struct dirent64 * entry = reinterpret_cast<const struct dirent64 *>(buffer.get() + offset);
+                offset += entry->d_reclen;
+
+                const char * name = entry->d_name;
+                if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0)
+                    continue;
+
+                counters.entriesRead.fetch_add(1, std::memory_order_relaxed);
+
+                unsigned char type = entry->d_type;
+                if (type == DT_LNK || type == DT_UNKNOWN) {
+                    counters.metadataCalls.fetch_add(1, std::memory_order_relaxed);
+                    struct stat status;
+                    if (fstatat(directoryFd, name, &status, 0) != 0)
+                        continue;
+                    if (S_ISDIR(status.st_mode)) {
+                        if (recursive)
+                            subdirectories.push_back(path + "/" + name);
+                    } else if (S_ISREG(status.st_mode) && (!executablePermission || isExecutableStatus(status)))
+                        fileList.emplace_back(name);
+                    continue;
+                }
+
+                if (type == DT_DIR) {
+                    if (recursive)
+                        subdirectories.push_back(path + "/" + name);
+                } else if (type == DT_REG && (!executablePermission || isExecutableAt(directoryFd, name)))
+                    fileList.emplace_back(name);
+            }
+        }
+
+        close(directoryFd);
+    }
+
+    /**
+     * Reads a directory and submits a task to the pool for each of its subdirectories, appending all names to fileList.
+     */
+    static void scanDirectoryTree(ThreadPool& pool, const std::string& path, bool recursive, bool executablePermission, std::vector<std::string>& fileList, std::mutex& fileListMutex) {
+        std::vector<std::string> directoryFiles;
+        std::vector<std::string> subdirectories;
+        readDirectory(path, recursive, executablePermission, directoryFiles, subdirectories);
+
+        {
+            std::lock_guard<std::mutex> lock(fileListMutex);
+            fileList.insert(fileList.end(), std::make_move_iterator(directoryFiles.begin()), std::make_move_iterator(directoryFiles.end()));
+        }
+
+        for (std::string& subdirectory : subdirectories) {
+            pool.submit([&pool, subdirectory = std::move(subdirectory), recursive, executablePermission, &fileList, &fileListMutex]() {
+                try {
+                    scanDirectoryTree(pool, subdirectory, recursive, executablePermission, fileList, fileListMutex);
+                } catch (const std::filesystem::filesystem_error &e) {
+                    Log::warn("Error while opening {}: {}. Ignoring...", subdirectory, e.what());
+                }
+            });
+        }
+    }
+
 public:
 
     /**
@@ -27,7 +189,7 @@ public:
             valueToAssign = data[field];
             return true;
         } else {
-            spdlog::error(field + " is not present in the settings file or has not been set");
+            Log::error(field + " is not present in the settings file or has not been set");
             return false;
         }
     }
@@ -45,7 +207,7 @@ public:
             if (indentSize >= 0)
                 return true;
         } catch (const std::exception &e) {
-            spdlog::error("Could not validate the settings parameter 'indentationSize'");
+            Log::error("Could not validate the settings parameter 'indentationSize'");
             std::cerr<<e.what()<<"\n";
             return false;
         }
@@ -70,28 +232,63 @@ public:
         return std::filesystem::is_regular_file(filePath) && (access(filePath.c_str(), X_OK) == 0);
     }
 
-    static std::vector<std::string> getListOfFilesInPath(std::string path, bool recursive, bool executablePermission) {
+    /**
+     * Lists the regular files in a directory, subdirectories being scanned in parallel when recursive.
+     *
+     * @param path the directory to scan
+     * @param recursive whether files in subdirectories are listed too
+     * @param executablePermission whether only the files the current user can execute are listed
+     * @return the names of the files found, without their directory
+     * @throws ```std::filesystem::filesystem_error``` if the directory cannot be opened
+     */
+    static std::vector<std::string> getListOfFilesInPath(const std::string& path, bool recursive, bool executablePermission) {
+        Stats::Span span("directoryScan");
         std::vector<std::string> fileList;
+        std::vector<std::string> subdirectories;
 
-        for (const auto &entry : std::filesystem::directory_iterator(path)) {
-            if (recursive && entry.is_directory()) {
-                std::vector<std::string> tmpVector = getListOfFilesInPath(entry.path().string(), recursive, executablePermission);
-                try {
-                    fileList.insert(fileList.end(), tmpVector.begin(), tmpVector.end());
-                } catch (std::filesystem::__cxx11::filesystem_error &e) {
-                    spdlog::warn("Error while opening {}: {}. Ignoring...", entry.path().string(), e.what());
-                }
-            } else {
+        if (!recursive) {
+            readDirectory(path, recursive, executablePermission, fileList, subdirectories);
+            return fileList;
+        }
+
+        std::mutex fileListMutex;
+        ThreadPool pool(ThreadPool::getThreadCount(maxScanThreads));
+        scanDirectoryTree(pool, path, recursive, executablePermission, fileList, fileListMutex);
+        pool.wait();
+
+        return fileList;
+    }
+
+    /**
+     * Lists the regular files of several directories at once, each directory (and each subdirectory, when recursive)
+     * being scanned by a small pool of threads. Directories that cannot be opened are reported and yield no files.
+     *
+     * @param paths the directories to scan
+     * @param recursive whether files in subdirectories are listed too
+     * @param executablePermission whether only the files the current user can execute are listed
+     * @return for each path, the names of the files found in it
+     */
+    static std::vector<std::vector<std::string>> getListsOfFilesInPaths(const std::vector<std::string>& paths, bool recursive, bool executablePermission) {
+        Stats::Span span("directoryScan");
+        std::vector<std::vector<std::string>> fileLists(paths.size());
+        if (paths.empty())
+            return fileLists;
+
+        std::vector<std::mutex> fileListMutexes(paths.size());
+        ThreadPool pool(ThreadPool::getThreadCount(std::min(paths.size(), maxScanThreads)));
+
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            pool.submit([&pool, &paths, &fileLists, &fileListMutexes, i, recursive, executablePermission]() {
                 try {
-                    if (executablePermission && doesCurrentUserHaveExecutablePermissionForFile(entry.path()))
-                        fileList.push_back(entry.path().filename().string());
-                } catch (std::filesystem::__cxx11::filesystem_error &e) {
-                    spdlog::warn("Error while opening {}: {}. Ignoring...", entry.path().string(), e.what());
+                    scanDirectoryTree(pool, paths[i], recursive, executablePermission, fileLists[i], fileListMutexes[i]);
+                } catch (const std::filesystem::filesystem_error &e) {
+                    Log::warn("Error while opening {}: {}. Ignoring...", paths[i], e.what());
                 }
-            }
+            });
         }
+        pool.wait();
 
-        return fileList;
+        return fileLists;
     }
 
     /**
@@ -122,11 +319,13 @@ public:
         std::cout<<"\n";
     }
 
-    static std::unordered_set<char> getSetOfUniqueCharFromString(std::string string) {
-        std::unordered_set<char> charSet;
-        for(std::size_t i = 0; i < string.size(); ++i)
-            charSet.insert(string[i]);
-
-        return charSet;
+    /**
+     * @return the peak resident set size of the process so far, in kilobytes, or 0 if it cannot be read.
+     */
+    static long getPeakResidentSetSizeKilobytes() {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+        return usage.ru_maxrss;
     }
 };
\ No newline at end of file
@@ -1,7 +1,17 @@
+#pragma once
+
 #include <string>
+#include <memory>
 #include <SQLiteCpp/SQLiteCpp.h>
 
 
+/**
+ * @class DatabaseStatements
+ * @brief Queries of the history database, each compiled on its first use and then reused: a getter resets the cached
+ * statement and binds the new parameters instead of compiling the SQL again.
+ *
+ * A returned statement stays valid until the same getter is called again, and as long as the database is open.
+ */
 class DatabaseStatements {
 
 private:
@@ -17,6 +27,7 @@ private:
 
     /* ---------- INSERT ----------*/
     std::string insertCommandQuery;
+    std::string upsertCommandUsesQuery;
 
     /* ---------- UPDATE ----------*/
     std::string updateNewCommandUseQuery;
@@ -24,11 +35,25 @@ private:
     /* ---------- DELETE ----------*/
     std::string deleteCommandQuery;
 
+    /* ---------- COMPILED ----------*/
+    std::unique_ptr<SQLite::Statement> createHistoryTableIfNotExistsStatement;
+    std::unique_ptr<SQLite::Statement> getAllStatement;
+    std::unique_ptr<SQLite::Statement> getCommandStatement;
+    std::unique_ptr<SQLite::Statement> insertCommandStatement;
+    std::unique_ptr<SQLite::Statement> upsertCommandUsesStatement;
+    std::unique_ptr<SQLite::Statement> updateNewCommandUseStatement;
+    std::unique_ptr<SQLite::Statement> deleteCommandStatement;
+
     template <typename... Args>
-    SQLite::Statement prepareStatement (const std::string& command, Args&&... args) {
-        SQLite::Statement query(*db, command);
-        bindArguments(query, 1, std::forward<Args>(args)...);
-        return query;
+    SQLite::Statement& prepareStatement(std::unique_ptr<SQLite::Statement>& statement, const std::string& command, Args&&... args) {
+        if (statement == nullptr)
+            statement = std::make_unique<SQLite::Statement>(*db, command);
+        else {
+            statement->reset();
+            statement->clearBindings();
+        }
+        bindArguments(*statement, 1, std::forward<Args>(args)...);
+        return *statement;
     }
 
     void bindArguments(SQLite::Statement& query [[maybe_unused]], int index [[maybe_unused]]) { /* Base case: no more arguments to bind */ }
@@ -40,8 +65,8 @@ private:
     }
 
 public:
-    DatabaseStatements(SQLite::Database& database) { 
-        db = &database; 
+    DatabaseStatements(SQLite::Database& database) {
+        db = &database;
 
         /* ---------- CREATE ----------*/
         createHistoryTableIfNotExistsQuery = "CREATE TABLE IF NOT EXISTS history (                      \
@@ -57,6 +82,14 @@ public:
         /* ---------- INSERT ----------*/
         insertCommandQuery = "INSERT OR IGNORE INTO history VALUES(?, 0, current_timestamp)";
 
+        // Adds uses to a command in a single statement, inserting it if it is new. The time is a Unix time, stored in
+        // the format of current_timestamp, whose text order is the chronological one: the last execution never goes
+        // back in time when an older journal is flushed after a newer use was stored
+        upsertCommandUsesQuery = "INSERT INTO history VALUES(?, ?, datetime(?, 'unixepoch'))                            \
+                                  ON CONFLICT(command) DO UPDATE SET                                                    \
+                                  execution_counter = execution_counter + excluded.execution_counter,                   \
+                                  last_execution = max(last_execution, excluded.last_execution)";
+
         /* ---------- UPDATE ----------*/
         updateNewCommandUseQuery = "UPDATE history SET execution_counter = (SELECT execution_counter FROM history WHERE command = ?) + 1,    \
                                     last_execution = current_timestamp                                                                         \
@@ -66,27 +99,32 @@ public:
         deleteCommandQuery = "DELETE FROM history WHERE command = ?";
     }
 
-    SQLite::Statement getCreateHistoryTableIfNotExistsPreparedQuery() { return prepareStatement(createHistoryTableIfNotExistsQuery); }
-    
-    SQLite::Statement getAllPreparedQuery() { return prepareStatement(getAllQuery); }
+    SQLite::Statement& getCreateHistoryTableIfNotExistsPreparedQuery() { return prepareStatement(createHistoryTableIfNotExistsStatement, createHistoryTableIfNotExistsQuery); }
+
+    SQLite::Statement& getAllPreparedQuery() { return prepareStatement(getAllStatement, getAllQuery); }
+
+    template<typename T>
+    SQLite::Statement& getCommandPreparedQuery(T&& parameter) {
+        return prepareStatement(getCommandStatement, getCommandQuery, std::forward<T>(parameter));
+    }
 
     template<typename T>
-    SQLite::Statement getCommandPreparedQuery(T&& parameter) { 
-        return prepareStatement(getCommandQuery(std::forward<T>(parameter))); 
+    SQLite::Statement& getInsertCommandPreparedQuery(T&& parameter) {
+        return prepareStatement(insertCommandStatement, insertCommandQuery, std::forward<T>(parameter));
     }
 
-    template<typename T> 
-    SQLite::Statement getInsertCommandPreparedQuery(T&& parameter) { 
-        return prepareStatement(insertCommandQuery, std::forward<T>(parameter)); 
+    template<typename T1, typename T2, typename T3>
+    SQLite::Statement& getUpsertCommandUsesPreparedQuery(T1&& command, T2&& uses, T3&& lastExecution) {
+        return prepareStatement(upsertCommandUsesStatement, upsertCommandUsesQuery, std::forward<T1>(command), std::forward<T2>(uses), std::forward<T3>(lastExecution));
     }
 
-    template<typename T1, typename T2> 
-    SQLite::Statement getUpdateNewCommandUsePreparedQuery(T1&& parameter1, T2&& parameter2) { 
-        return prepareStatement(updateNewCommandUseQuery, std::forward<T1>(parameter1), std::forward<T2>(parameter2)); 
+    template<typename T1, typename T2>
+    SQLite::Statement& getUpdateNewCommandUsePreparedQuery(T1&& parameter1, T2&& parameter2) {
+        return prepareStatement(updateNewCommandUseStatement, updateNewCommandUseQuery, std::forward<T1>(parameter1), std::forward<T2>(parameter2));
     }
 
     template<typename T>
-    SQLite::Statement getDeleteCommandPreparedQuery(T&& parameter) { 
-        return prepareStatement(deleteCommandQuery, std::forward<T>(parameter)); 
+    SQLite::Statement& getDeleteCommandPreparedQuery(T&& parameter) {
+        return prepareStatement(deleteCommandStatement, deleteCommandQuery, std::forward<T>(parameter));
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <unordered_set>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <exception>
+#include <cstdint>
+#include <pthread.h>
+#include "Log.hpp"
+
+// Threads probing the directories of a refresh bounded by a deadline, which is also the most a hung mount can keep blocked
+#define DIRECTORY_PROBE_MAX_THREADS 4
+// Seconds an idle probe thread waits for a new probe before exiting
+#define DIRECTORY_PROBE_IDLE_SECONDS 30
+
+/**
+ * @class DirectoryProber
+ * @brief Process-wide set of at most DIRECTORY_PROBE_MAX_THREADS threads stat'ing or scanning directories which may
+ * hang, e.g. on a network mount, for a caller which stops waiting at a deadline.
+ *
+ * The threads are reused from one refresh to the next and exit once idle, so that a long-lived process such as the
+ * bash builtin never accumulates them. A thread blocked on a hung directory stays counted, and no new thread replaces
+ * it past the limit: the probes submitted meanwhile wait in the queue, and the caller withdraws those still waiting at
+ * its deadline. A directory whose previous probe is still queued or running is not probed again.
+ *
+ * The threads are detached, and only use state which is never destroyed, so that a thread still blocked when the
+ * process exits never finds it gone. A forked child, such as the command_not_found_handle of a shell which enabled the
+ * builtin, does not have the threads of its parent: it starts from a fresh state, with its own threads, rather than
+ * one counting threads which do not exist and maybe holding a mutex locked at the time of the fork.
+ */
+class DirectoryProber {
+
+private:
+
+    struct Probe {
+        std::uint64_t id;
+        std::string path;
+        std::function<void()> run;
+        std::function<void()> done;
+    };
+
+    struct State {
+        std::mutex mutex;
+        std::condition_variable probeAvailable;
+        std::deque<Probe> queue;
+        // Directories whose probe is queued or running
+        std::unordered_set<std::string> pendingPaths;
+        std::size_t threadCount = 0;
+        std::size_t idleThreadCount = 0;
+        std::uint64_t nextId = 1;
+    };
+
+    inline static State * state = nullptr;
+
+    static State& getState() {
+        static std::once_flag initialized;
+        std::call_once(initialized, []() {
+            state = new State();
+            // A child abandons the state of its parent rather than destroying it, as its mutex may be locked
+            pthread_atfork(nullptr, nullptr, []() { state = new State(); });
+        });
+        return *state;
+    }
+
+    static void workerLoop(State& state) {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        while (true) {
+            ++state.idleThreadCount;
+            const bool available = state.probeAvailable.wait_for(lock, std::chrono::seconds(DIRECTORY_PROBE_IDLE_SECONDS),
+                                                                 [&state]() { return !state.queue.empty(); });
+            --state.idleThreadCount;
+            if (!available) {
+                --state.threadCount;
+                return;
+            }
+
+            Probe probe = std::move(state.queue.front());
+            state.queue.pop_front();
+            lock.unlock();
+            try {
+                probe.run();
+            } catch (const std::exception &e) {
+                Log::error("Error while probing {}: {}", probe.path, e.what());
+            }
+
+            // The directory is no longer pending once its caller learns that the probe is done, so that the caller can
+            // probe it again right away
+            lock.lock();
+            state.pendingPaths.erase(probe.path);
+            lock.unlock();
+            probe.done();
+            probe = Probe{};
+            lock.lock();
+        }
+    }
+
+public:
+
+    /**
+     * Queues a probe of a directory, started as soon as a thread is available.
+     *
+     * @param path the probed directory
+     * @param run the probe, which must only use state it shares ownership of, since its caller may stop waiting for it
+     * @param done called once the probe returned and the directory is no longer pending, even if the probe threw
+     * @return the identifier of the probe, or 0 if the previous probe of the directory is still queued or running.
+     */
+    static std::uint64_t submit(const std::string& path, std::function<void()> run, std::function<void()> done) {
+        State& state = getState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.pendingPaths.contains(path))
+            return 0;
+
+        if (state.idleThreadCount <= state.queue.size() && state.threadCount < DIRECTORY_PROBE_MAX_THREADS) {
+            std::thread([&state]() { workerLoop(state); }).detach();
+            ++state.threadCount;
+        }
+
+        const std::uint64_t id = state.nextId++;
+        state.pendingPaths.insert(path);
+        state.queue.push_back({id, path, std::move(run), std::move(done)});
+        state.probeAvailable.notify_one();
+        return id;
+    }
+
+    /**
+     * Withdraws a probe which no thread started yet.
+     *
+     * @return false if the probe is running or done.
+     */
+    static bool cancel(std::uint64_t id) {
+        State& state = getState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        const auto probe = std::ranges::find(state.queue, id, &Probe::id);
+        if (probe == state.queue.end())
+            return false;
+
+        state.pendingPaths.erase(probe->path);
+        state.queue.erase(probe);
+        return true;
+    }
+};
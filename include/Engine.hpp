@@ -0,0 +1,316 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <algorithm>
+#include <unordered_set>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <unistd.h>
+#include "Log.hpp"
+#include "Stats.hpp"
+#include "Settings.hpp"
+#include "ThreadPool.hpp"
+#include "BinaryIndex.hpp"
+#include "CandidateStore.hpp"
+#include "QGramIndex.hpp"
+#include "BKTree.hpp"
+#include "SymSpellIndex.hpp"
+#include "PrefixTrie.hpp"
+#include "CommandHistory.hpp"
+#include "CommandSuggester.hpp"
+#include "QueryArena.hpp"
+#include "QueryCache.hpp"
+#include "SlowDirectories.hpp"
+
+/**
+ * @class Engine
+ * @brief The lookup pipeline behind smile --i, built once and queried many times: the index of the binaries, the lookup
+ * structures derived from it, the history and the query cache are kept from one query to the next, so that a program
+ * embedding the engine only pays for them when the binaries change.
+ *
+ * The structures are loaded on the first query which needs them, and again after a refresh which changed the binaries:
+ * the default linear scan needs none of them, and a query answered from the query cache loads nothing. The engine is
+ * meant to be used from a single thread, and the results of a query point into it until the next query or refresh.
+ */
+class Engine {
+
+private:
+
+    Settings& settings;
+    BinaryIndex binaryIndex;
+    QGramIndex qGramIndex;
+    BKTree bkTree;
+    SymSpellIndex symSpellIndex;
+    PrefixTrie prefixTrie;
+    // Fingerprint of the binaries each structure was loaded for, 0 when it is not loaded
+    std::uint64_t qGramIndexFingerprint = 0;
+    std::uint64_t bkTreeFingerprint = 0;
+    std::uint64_t symSpellIndexFingerprint = 0;
+    std::uint64_t prefixTrieFingerprint = 0;
+    CommandHistory history;
+    QueryCache queryCache;
+    bool queryCacheOpened = false;
+    std::unique_ptr<QueryArena> arena;
+    std::size_t arenaCandidateCount = 0;
+    std::vector<std::string> lateDirectories;
+    // Started by the first query scored in parallel, and kept for the next ones
+    std::unique_ptr<ThreadPool> scoringThreadPool;
+    // Process which started the threads of the pool
+    pid_t scoringThreadPoolProcess = 0;
+
+    void loadBkTree() {
+        if (bkTreeFingerprint == binaryIndex.getFingerprint())
+            return;
+        bkTree.loadOrBuild(binaryIndex, settings.getBkTreeFilePath());
+        bkTreeFingerprint = binaryIndex.getFingerprint();
+    }
+
+    /**
+     * @return the pool the scoring is spread over, started on its first use. A forked child, such as the
+     * command_not_found_handle of a shell which enabled the builtin, does not have the threads of the pool of its parent,
+     * which it can neither use nor join: it is left as is, and the child starts its own.
+     */
+    ThreadPool& getScoringThreadPool(std::size_t threadCount) {
+        if (scoringThreadPool != nullptr && scoringThreadPoolProcess != getpid())
+            (void) scoringThreadPool.release();
+        if (scoringThreadPool == nullptr) {
+            scoringThreadPool = std::make_unique<ThreadPool>(threadCount);
+            scoringThreadPoolProcess = getpid();
+        }
+        return *scoringThreadPool;
+    }
+
+    /**
+     * Finds the binaries closest to the input command with the configured lookup engine, before their ranking by the
+     * history. Every binary tied at the minimum distance is found, their number being bounded by the ranking only.
+     *
+     * @return the suggestions, sorted by name, pointing into the index.
+     */
+    std::pmr::vector<CommandSuggester::Suggestion> findSuggestions(std::string_view inputCommand, int margin, std::pmr::memory_resource * resource) {
+        Log::info("Applying length distance heuristic based on a maximum difference in length of {}", settings.getLengthConditionHeuristic());
+
+        // The length heuristic selects a slice of the length buckets of the index, and the letter heuristic is evaluated
+        // over the precomputed character signatures of that slice only
+        const CandidateStore& candidates = binaryIndex.getCandidates();
+        const std::uint64_t fingerprint = binaryIndex.getFingerprint();
+
+        // When the Jaccard prefilter is enabled, the candidates are generated from the posting lists of the q-gram index,
+        // persisted next to the index like the BK-tree
+        {
+            Stats::Span span("structuresLoad");
+            if (settings.getQGramJaccardThreshold() > 0 && qGramIndexFingerprint != fingerprint) {
+                Log::info("Applying q-gram Jaccard prefilter with a threshold of {}", settings.getQGramJaccardThreshold());
+                qGramIndex.loadOrBuild(candidates, fingerprint, settings.getQGramIndexFilePath());
+                qGramIndexFingerprint = fingerprint;
+            }
+
+            // The structures of the engines are persisted next to the index and rebuilt only when the indexed binaries
+            // change. The linear scan, the default engine, does not need any
+            if (settings.getPrefixTrieEngineEnabled()) {
+                if (prefixTrieFingerprint != fingerprint) {
+                    prefixTrie.loadOrBuild(candidates, fingerprint, settings.getPrefixTrieFilePath());
+                    prefixTrieFingerprint = fingerprint;
+                }
+            } else if (settings.getBkTreeEngineEnabled())
+                loadBkTree();
+            else if (settings.getSymSpellEngineEnabled() && symSpellIndexFingerprint != fingerprint) {
+                symSpellIndex.loadOrBuild(candidates, fingerprint, settings.getSymSpellMaxDistance(), settings.getSymSpellIndexFilePath());
+                symSpellIndexFingerprint = fingerprint;
+            }
+        }
+
+        CommandSuggester::CandidateFilter candidateFilter{CandidateStore::Slice{}, std::pmr::vector<std::uint8_t>(resource)};
+        {
+            Stats::Span span("heuristicFilter");
+            candidateFilter = CommandSuggester::filterCandidates(inputCommand, candidates, settings, &qGramIndex, resource);
+        }
+        auto heuristicCondition = [&candidateFilter](std::uint32_t nameId) { return candidateFilter.accepts(nameId); };
+        Log::info("{} of {} binaries are within the length condition", candidateFilter.slice.size(), candidates.size());
+
+        // With tens of thousands of binaries passing the heuristics, the linear scan, the default engine, is spread over all
+        // the cores, which is also faster than the opt-in BK-tree walk. Below the threshold, starting the threads would
+        // cost more than it saves
+        const std::size_t scoringThreads = ThreadPool::getThreadCount(SIZE_MAX);
+        const bool parallelScoring = scoringThreads > 1 && !settings.getPrefixTrieEngineEnabled() && CommandSuggester::shouldScoreInParallel(candidateFilter, settings);
+
+        // The SymSpell index only holds the binaries within its distance: when the selection could include farther ones,
+        // the lookup falls back to the linear scan, so that the suggestions are the same whatever the engine
+        SymSpellIndex::SearchResult symSpellResult{std::pmr::vector<SymSpellIndex::Match>(resource)};
+        if (settings.getSymSpellEngineEnabled()) {
+            Stats::Span span("distanceScoring");
+            Log::info("Looking up the closest binaries in the SymSpell index");
+            symSpellResult = symSpellIndex.findBest(candidates, inputCommand, settings.getMaxEditDistance(), 0, margin, heuristicCondition, resource);
+            Log::info("Computed the distance of {} binaries sharing a delete with the input command", symSpellResult.verifiedNames);
+            if (!symSpellResult.complete)
+                Log::info("No binary within distance {} of the input command, scanning all of them", symSpellIndex.getMaxDistance());
+        }
+
+        BKTree::SearchResult nearestBinaries{std::pmr::vector<BKTree::Match>(resource)};
+        std::size_t trieVisitedNodes = 0;
+        std::pmr::vector<CommandSuggester::Suggestion> suggestions(resource);
+        {
+            Stats::Span span("distanceScoring");
+            if (symSpellResult.complete)
+                nearestBinaries.matches = std::move(symSpellResult.matches);
+            else if (settings.getPrefixTrieEngineEnabled()) {
+                // The rows of the prefixes shared by many binaries are computed once, so the walk is not spread over threads
+                Log::info("Looking up the closest binaries in the prefix trie");
+                PrefixTrie::SearchResult trieResult = prefixTrie.findBest(candidates, inputCommand, settings.getMaxEditDistance(), 0, margin, candidateFilter.slice, heuristicCondition, resource);
+                Log::info("Visited {} of {} prefix trie nodes", trieResult.visitedNodes, prefixTrie.size());
+                nearestBinaries.matches = std::move(trieResult.matches);
+                trieVisitedNodes = trieResult.visitedNodes;
+            } else if (parallelScoring) {
+                Log::info("Scoring the binaries on {} threads", scoringThreads);
+                suggestions = CommandSuggester::findClosestCommands(inputCommand, candidates, candidateFilter, settings, margin, 0, resource, &getScoringThreadPool(scoringThreads));
+            } else if (settings.getBkTreeEngineEnabled()) {
+                Log::info("Looking up the closest binaries in the BK-tree");
+                nearestBinaries = bkTree.findBest(binaryIndex, inputCommand, settings.getMaxEditDistance(), 0, margin, heuristicCondition, resource);
+                Log::info("Visited {} of {} BK-tree nodes", nearestBinaries.visitedNodes, bkTree.size());
+            } else {
+                Log::info("Scoring the binaries with a linear scan");
+                suggestions = CommandSuggester::findClosestCommands(inputCommand, candidates, candidateFilter, settings, margin, 0, resource);
+            }
+
+            if (!nearestBinaries.matches.empty()) {
+                suggestions.reserve(nearestBinaries.matches.size());
+                for (auto const &match : nearestBinaries.matches)
+                    suggestions.push_back({binaryIndex.getName(match.nameId), match.distance});
+                // The index is sorted by length first, the suggestions are listed alphabetically before being ranked
+                std::sort(suggestions.begin(), suggestions.end(), [](const auto& first, const auto& second) { return first.name < second.name; });
+            }
+        }
+
+        Stats& stats = Stats::get();
+        if (stats.isEnabled()) {
+            stats.setCounter("candidatesWithinLength", candidateFilter.slice.size());
+            stats.setCounter("candidatesAfterFilter", candidateFilter.count());
+            stats.setCounter("parallelScoring", parallelScoring ? scoringThreads : 0);
+            if (settings.getBkTreeEngineEnabled())
+                stats.setCounter("bkTreeVisitedNodes", nearestBinaries.visitedNodes);
+            if (settings.getPrefixTrieEngineEnabled())
+                stats.setCounter("prefixTrieVisitedNodes", trieVisitedNodes);
+            if (settings.getSymSpellEngineEnabled()) {
+                stats.setCounter("symSpellVerifiedNames", symSpellResult.verifiedNames);
+                stats.setCounter("symSpellFallback", symSpellResult.complete ? 0 : 1);
+            }
+        }
+
+        return suggestions;
+    }
+
+public:
+
+    /**
+     * @param settings the settings of the engine, which must outlive it
+     */
+    explicit Engine(Settings& settings) : settings(settings), binaryIndex(settings.getBinaryIndexFilePath()) { }
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    /**
+     * Brings the index up to date with the binaries directories, rescanning only the modified ones, and reloads the
+     * history. Within the latency budget of the settings, a directory on a hung mount keeps the binaries it had in the
+     * index, and a directory which keeps timing out is not even stat'ed for a while.
+     *
+     * @return the directories which did not answer in time.
+     */
+    const std::vector<std::string>& refresh() {
+        {
+            Stats::Span span("indexRefresh");
+            if (settings.getMaxLatencyMs() > 0) {
+                const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(settings.getMaxLatencyMs());
+                const std::int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                SlowDirectories slowDirectories(settings.getSlowDirectoriesFilePath());
+                slowDirectories.load();
+                const std::unordered_set<std::string> skippedDirectories = slowDirectories.getSkippedDirectories(now);
+                lateDirectories = binaryIndex.refresh(settings.getSystemPathVariablePaths(), deadline, skippedDirectories);
+                slowDirectories.update(settings.getSystemPathVariablePaths(), skippedDirectories, lateDirectories, now);
+                slowDirectories.save();
+            } else
+                lateDirectories = binaryIndex.refresh(settings.getSystemPathVariablePaths());
+        }
+        Stats::get().setCounter("lateDirectories", lateDirectories.size());
+
+        history.load(settings);
+        return lateDirectories;
+    }
+
+    /**
+     * Looks up the binaries closest to an input command, ranked by the history. A command already looked up for the
+     * same binaries and settings is answered from the query cache, without loading the lookup structures.
+     *
+     * @param inputCommand the command to correct
+     * @param maxSuggestions the maximum number of suggestions, 0 for the maxSuggestions of the settings
+     * @return the names of the suggested binaries, most relevant first, valid until the next query or refresh.
+     */
+    std::pmr::vector<std::string_view> query(std::string_view inputCommand, std::size_t maxSuggestions = 0) {
+        const auto candidateStageStart = std::chrono::steady_clock::now();
+        const CandidateStore& candidates = binaryIndex.getCandidates();
+
+        // Ties, and binaries farther by at most the margin when they are in the history, are ranked by frecency, then by
+        // the prefix they share with the command. The number of suggestions is only bounded after the ranking: bounding
+        // the search would keep the ties with the lowest identifiers instead
+        const int margin = history.empty() ? 0 : settings.getHistoryRankingMargin();
+        if (maxSuggestions == 0)
+            maxSuggestions = static_cast<std::size_t>(settings.getMaxSuggestions());
+
+        // Every array of the lookup itself is allocated in the arena, released by the next query, and the suggestions
+        // point into the index
+        if (arena == nullptr || candidates.size() > arenaCandidateCount) {
+            arena = std::make_unique<QueryArena>(candidates.size());
+            arenaCandidateCount = candidates.size();
+        } else
+            arena->release();
+        std::pmr::vector<CommandSuggester::Suggestion> suggestions(arena->get());
+
+        const std::uint64_t parametersHash = QueryCache::hashParameters(settings, margin);
+        bool cacheHit = false;
+        if (settings.getQueryCacheSize() > 0) {
+            Stats::Span span("queryCache");
+            if (!queryCacheOpened)
+                queryCacheOpened = queryCache.open(settings.getQueryCacheFilePath(), static_cast<std::size_t>(settings.getQueryCacheSize()));
+            cacheHit = queryCache.find(inputCommand, binaryIndex.getFingerprint(), parametersHash, suggestions);
+        }
+
+        if (cacheHit)
+            Log::info("Found the {} suggestions of the input command in the query cache", suggestions.size());
+        else {
+            suggestions = findSuggestions(inputCommand, margin, arena->get());
+            if (settings.getQueryCacheSize() > 0) {
+                Stats::Span span("queryCache");
+                queryCache.store(inputCommand, binaryIndex.getFingerprint(), parametersHash, suggestions);
+            }
+        }
+
+        std::pmr::vector<std::string_view> similarCommands(arena->get());
+        {
+            Stats::Span span("ranking");
+            similarCommands = CommandSuggester::rankSuggestions(inputCommand, suggestions, &history, margin, maxSuggestions, arena->get());
+        }
+
+        // The arguments would be evaluated even with logging off, and the peak RSS costs a getrusage
+        if (Log::isEnabled()) {
+            const auto candidateStageTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - candidateStageStart);
+            Log::info("Candidate stage took {} us, peak RSS {} KB", candidateStageTime.count(), CommonUtils::getPeakResidentSetSizeKilobytes());
+        }
+
+        Stats& stats = Stats::get();
+        if (stats.isEnabled()) {
+            stats.setCounter("candidates", candidates.size());
+            stats.setCounter("queryCacheHit", cacheHit ? 1 : 0);
+            stats.setCounter("suggestions", similarCommands.size());
+        }
+
+        return similarCommands;
+    }
+
+    const BinaryIndex& getBinaryIndex() const { return binaryIndex; }
+
+    const std::vector<std::string>& getLateDirectories() const { return lateDirectories; }
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <utility>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <SQLiteCpp/SQLiteCpp.h>
+#include "Log.hpp"
+#include "Stats.hpp"
+#include "Settings.hpp"
+#include "CommandHistory.hpp"
+#include "DatabaseStatements.hpp"
+
+// Size the journal grows to before it is flushed into the history database
+#define HISTORY_JOURNAL_FLUSH_SIZE 4096
+// Longer commands are not recorded, so that every record is appended with a single atomic write
+#define HISTORY_JOURNAL_MAX_COMMAND_SIZE 256
+#define HISTORY_JOURNAL_FLUSHING_SUFFIX ".flushing"
+#define HISTORY_JOURNAL_LOCK_SUFFIX ".lock"
+// Milliseconds a flush waits for the write lock of the database before leaving the journal for the next one
+#define HISTORY_JOURNAL_BUSY_TIMEOUT_MS 200
+// Seconds before a journal left by a failed flush is flushed again
+#define HISTORY_JOURNAL_RETRY_SECONDS 60
+
+/**
+ * @class HistoryJournal
+ * @brief Records the executed commands in an append-only journal, flushed into the history database in batches.
+ *
+ * Recording a command is a single O_APPEND write of a "time\tcommand\n" line, and never opens the database. Once the
+ * journal passes HISTORY_JOURNAL_FLUSH_SIZE, it is flushed by the daemon or by a background child: the journal is
+ * renamed aside, so that new records go to a fresh one, and its uses are added to the history in one transaction with a
+ * single upsert statement per command.
+ *
+ * Writers hold a shared lock on the journal while appending, which the flusher takes exclusively once it renamed the
+ * journal, so that no record is lost to a writer which opened it just before the rename. A single process flushes at a
+ * time, the others skip the flush instead of waiting, and a flush which still finds the database busy after
+ * HISTORY_JOURNAL_BUSY_TIMEOUT_MS leaves the journal for a retry HISTORY_JOURNAL_RETRY_SECONDS later: concurrent shells
+ * never wait on the write lock of the database, nor start a flusher at every lookup meanwhile.
+ */
+class HistoryJournal {
+
+private:
+
+    static std::filesystem::path getFlushingFilePath(Settings& settings) {
+        return settings.getHistoryJournalFilePath().string() + HISTORY_JOURNAL_FLUSHING_SUFFIX;
+    }
+
+    static std::filesystem::path getLockFilePath(Settings& settings) {
+        return settings.getHistoryJournalFilePath().string() + HISTORY_JOURNAL_LOCK_SUFFIX;
+    }
+
+    /**
+     * @return true if another process holds the flush lock.
+     */
+    static bool isFlushing(Settings& settings) {
+        const int lockFd = open(getLockFilePath(settings).c_str(), O_RDONLY | O_CLOEXEC);
+        if (lockFd < 0)
+            return false;
+        const bool locked = flock(lockFd, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+        close(lockFd);
+        return locked;
+    }
+
+    static bool writeAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            const ssize_t written = write(fd, data.data(), data.size());
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            data.remove_prefix(static_cast<std::size_t>(written));
+        }
+        return true;
+    }
+
+    /**
+     * Adds up the uses of every command of a journal, with the time of its last one.
+     */
+    static std::map<std::string, std::pair<std::int64_t, std::int64_t>> readJournal(const std::filesystem::path& journalFilePath) {
+        std::map<std::string, std::pair<std::int64_t, std::int64_t>> uses;
+        std::ifstream file(journalFilePath);
+        std::string line;
+        while (std::getline(file, line)) {
+            // A record cut by a crash has no tab or no command, and is skipped
+            const std::size_t separator = line.find('\t');
+            if (separator == std::string::npos || separator + 1 == line.size())
+                continue;
+
+            std::int64_t time = 0;
+            try {
+                time = std::stoll(line.substr(0, separator));
+            } catch (const std::exception&) {
+                continue;
+            }
+
+            auto& [count, lastExecution] = uses[line.substr(separator + 1)];
+            ++count;
+            lastExecution = std::max(lastExecution, time);
+        }
+        return uses;
+    }
+
+    /**
+     * Adds the uses read from a journal to the history, in a single transaction.
+     *
+     * @return false if the database is not available or busy, the journal being left for a retry
+     * HISTORY_JOURNAL_RETRY_SECONDS later.
+     */
+    static bool applyJournal(Settings& settings, const std::filesystem::path& journalFilePath) {
+        const auto uses = readJournal(journalFilePath);
+        if (!uses.empty()) {
+            DatabaseStatements * databaseStatements = settings.getDatabaseStatements();
+            if (databaseStatements == nullptr)
+                return false;
+
+            // The connection is shared with the lookups, which never wait on the database
+            SQLite::Database& database = *settings.getDatabase();
+            database.setBusyTimeout(HISTORY_JOURNAL_BUSY_TIMEOUT_MS);
+            try {
+                SQLite::Transaction transaction(database);
+                for (const auto& [command, use] : uses)
+                    databaseStatements->getUpsertCommandUsesPreparedQuery(command, use.first, use.second).exec();
+                transaction.commit();
+            } catch (const SQLite::Exception& e) {
+                database.setBusyTimeout(0);
+                Log::warn("Could not flush the history journal: {}", e.what());
+                // The retry is timed from the failed flush
+                utimensat(AT_FDCWD, journalFilePath.c_str(), nullptr, 0);
+                return false;
+            }
+            database.setBusyTimeout(0);
+        }
+
+        std::error_code errorCode;
+        std::filesystem::remove(journalFilePath, errorCode);
+        Stats::get().setCounter("historyFlushedCommands", uses.size());
+        return true;
+    }
+
+public:
+
+    /**
+     * Appends a use of a command to the journal, if history storage is enabled.
+     *
+     * @param command the name of the executed binary
+     * @param time the Unix time of the execution
+     * @return true if the command was recorded.
+     */
+    static bool record(Settings& settings, std::string_view command, std::int64_t time = CommandHistory::getCurrentTime()) {
+        if (!settings.getDatabaseHistoryStorageEnabled() || command.empty() || command.size() > HISTORY_JOURNAL_MAX_COMMAND_SIZE
+            || command.find_first_of("\t\n") != std::string_view::npos)
+            return false;
+
+        const std::string record = std::to_string(time) + "\t" + std::string(command) + "\n";
+        const std::filesystem::path journalFilePath = settings.getHistoryJournalFilePath();
+
+        // Retried if the journal was renamed for a flush between its opening and the lock
+        for (int attempt = 0; attempt < 3; ++attempt) {
+            const int fd = open(journalFilePath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+            if (fd < 0)
+                return false;
+
+            struct stat openedStatus;
+            struct stat pathStatus;
+            if (flock(fd, LOCK_SH) != 0 || fstat(fd, &openedStatus) != 0) {
+                close(fd);
+                return false;
+            }
+            if (stat(journalFilePath.c_str(), &pathStatus) != 0 || pathStatus.st_ino != openedStatus.st_ino || pathStatus.st_dev != openedStatus.st_dev) {
+                close(fd);
+                continue;
+            }
+
+            const bool written = writeAll(fd, record);
+            close(fd);
+            return written;
+        }
+        return false;
+    }
+
+    /**
+     * @return true if no flush is running, and the journal grew past HISTORY_JOURNAL_FLUSH_SIZE or a previous flush was
+     * interrupted, or failed at least HISTORY_JOURNAL_RETRY_SECONDS ago.
+     */
+    static bool needsFlush(Settings& settings) {
+        if (isFlushing(settings))
+            return false;
+
+        // The journal of the previous flush is applied before the current one, which waits for it
+        struct stat status;
+        if (stat(getFlushingFilePath(settings).c_str(), &status) == 0)
+            return time(nullptr) - status.st_mtime >= HISTORY_JOURNAL_RETRY_SECONDS;
+        return stat(settings.getHistoryJournalFilePath().c_str(), &status) == 0 && status.st_size >= HISTORY_JOURNAL_FLUSH_SIZE;
+    }
+
+    /**
+     * Flushes the journal into the history database, unless another process is already flushing it.
+     *
+     * @return true if the journal was flushed, or is empty.
+     */
+    static bool flush(Settings& settings) {
+        Stats::Span span("historyFlush");
+        if (!settings.getDatabaseHistoryStorageEnabled())
+            return false;
+
+        const std::filesystem::path lockFilePath = getLockFilePath(settings);
+        const int lockFd = open(lockFilePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (lockFd < 0)
+            return false;
+        if (flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+            close(lockFd);
+            return false;
+        }
+
+        // The uses left by an interrupted flush are applied first, and the journal is renamed once they are
+        const std::filesystem::path flushingFilePath = getFlushingFilePath(settings);
+        bool flushed = !std::filesystem::exists(flushingFilePath) || applyJournal(settings, flushingFilePath);
+        if (flushed && rename(settings.getHistoryJournalFilePath().c_str(), flushingFilePath.c_str()) == 0) {
+            // Waits for the writers which opened the journal before it was renamed
+            const int journalFd = open(flushingFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (journalFd >= 0) {
+                flock(journalFd, LOCK_EX);
+                close(journalFd);
+            }
+            flushed = applyJournal(settings, flushingFilePath);
+        }
+
+        close(lockFd);
+        return flushed;
+    }
+
+    /**
+     * Flushes the journal in a child process, which the caller does not wait for. The child opens its own connection
+     * to the database.
+     */
+    static void flushInBackground() {
+        const pid_t pid = fork();
+        if (pid != 0)
+            return;
+
+        setsid();
+        try {
+            Settings settings;
+            flush(settings);
+        } catch (const std::exception& e) {
+            Log::error("Error while flushing the history journal: {}", e.what());
+        }
+        _exit(0);
+    }
+};
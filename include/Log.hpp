@@ -0,0 +1,60 @@
+#pragma once
+
+#include <utility>
+#include <spdlog/spdlog.h>
+
+/**
+ * @class Log
+ * @brief Front to the spdlog functions used by the project, forwarding to spdlog only once logging is enabled.
+ *
+ * spdlog creates its registry and default logger on first use, which is a measurable part of the startup of a lookup.
+ * Outside of verbose mode nothing is logged, so the calls are dropped here without ever touching spdlog.
+ */
+class Log {
+
+private:
+
+    inline static bool enabled = false;
+
+public:
+
+    static void enable() { enabled = true; }
+
+    static bool isEnabled() { return enabled; }
+
+    template <typename... Args>
+    static void info(spdlog::format_string_t<Args...> format, Args&&... args) {
+        if (enabled)
+            spdlog::info(format, std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static void info(const T& message) {
+        if (enabled)
+            spdlog::info(message);
+    }
+
+    template <typename... Args>
+    static void warn(spdlog::format_string_t<Args...> format, Args&&... args) {
+        if (enabled)
+            spdlog::warn(format, std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static void warn(const T& message) {
+        if (enabled)
+            spdlog::warn(message);
+    }
+
+    template <typename... Args>
+    static void error(spdlog::format_string_t<Args...> format, Args&&... args) {
+        if (enabled)
+            spdlog::error(format, std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static void error(const T& message) {
+        if (enabled)
+            spdlog::error(message);
+    }
+};
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <memory_resource>
+#include <algorithm>
+#include <numeric>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "CandidateStore.hpp"
+#include "WordDistanceHandler.hpp"
+#include "SuggestionSelector.hpp"
+
+#define PREFIX_TRIE_MAGIC "SMILETRI"
+#define PREFIX_TRIE_VERSION 1
+#define PREFIX_TRIE_NO_NAME UINT32_MAX
+
+/**
+ * @class PrefixTrie
+ * @brief Compact trie (radix tree) over the names of a CandidateStore, walked depth first with one row of the distance
+ * table per character of the path, so that the rows of a prefix shared by many binaries (git-*, python3.*,
+ * x86_64-linux-gnu-*) are computed once for all of them instead of once per binary.
+ *
+ * Every node holds the characters leading to it from its parent, the chains of nodes with a single child being merged,
+ * and the position in the store of the name ending there, if any. The children of a node are contiguous and sorted by
+ * their first character, in breadth first order, which is also the serialized format. The minimum of the rows never
+ * decreases along a path, so a whole subtree is left out as soon as the row of its prefix is past the cutoff of the
+ * selection, which shrinks as closer binaries are found, or when the lengths of its names are all outside the length
+ * slice of the heuristics or too different from the length of the query. The child continuing the query is walked
+ * first, so that close binaries, and the cutoff they bring, are found early.
+ *
+ * The walk offers the binaries in alphabetical order, while the ties at the largest selected distance are broken by
+ * position in a linear scan: the binaries within the cutoff are collected, the cutoff keeping the ties, and selected
+ * again by increasing position, so that the trie selects the same binaries as the linear scan.
+ *
+ * The trie is persisted next to the BinaryIndex, tagged with its fingerprint, and memory mapped so that a lookup only
+ * reads the nodes it walks. It is opt-in: on typical binary sets, its walk is slower than the bit-parallel linear scan of
+ * the default engine.
+ */
+class PrefixTrie {
+
+public:
+
+    struct Node {
+        std::uint32_t firstChild;
+        std::uint32_t labelOffset;
+        // PREFIX_TRIE_NO_NAME when no name ends at this node
+        std::uint32_t nameId;
+        std::uint16_t childCount;
+        std::uint8_t labelLength;
+        // Lengths of the shortest and longest names of the subtree, capped at 255 like the names of most filesystems
+        std::uint8_t minimumLength;
+        std::uint8_t maximumLength;
+    };
+
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t nodeCount;
+        std::uint32_t maxDepth;
+        std::uint32_t reserved;
+        std::uint64_t labelPoolSize;
+        std::uint64_t indexFingerprint;
+    };
+
+    using Match = SuggestionSelector::Match;
+
+    struct SearchResult {
+        std::pmr::vector<Match> matches;
+        std::size_t visitedNodes = 0;
+    };
+
+private:
+
+    std::span<const Node> nodes;
+    std::string_view labelPool;
+    // Length of the longest name, the number of rows a walk can need
+    std::uint32_t maxDepth = 0;
+    std::uint64_t indexFingerprint = 0;
+
+    // The tables point either into the mapping of the trie file, or into these arrays for a trie built in memory
+    const std::byte * mapping = nullptr;
+    std::size_t mappingSize = 0;
+    std::vector<Node> builtNodes;
+    std::string builtLabelPool;
+
+    void unmap() {
+        if (mapping != nullptr)
+            munmap(const_cast<std::byte *>(mapping), mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+
+public:
+
+    PrefixTrie() { }
+
+    ~PrefixTrie() { unmap(); }
+
+    PrefixTrie(const PrefixTrie&) = delete;
+    PrefixTrie& operator=(const PrefixTrie&) = delete;
+
+    /**
+     * Builds the trie of every name of the store.
+     *
+     * @param candidates the names to index, the positions stored in the nodes are their positions in the store
+     * @param fingerprint the fingerprint of the BinaryIndex the names come from
+     */
+    void build(const CandidateStore& candidates, std::uint64_t fingerprint) {
+        std::vector<std::uint32_t> order(candidates.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&candidates](std::uint32_t first, std::uint32_t second) {
+            return candidates.getName(first) < candidates.getName(second);
+        });
+
+        // Range of the alphabetically sorted names below a node, all sharing its first depth characters
+        struct Range {
+            std::size_t first;
+            std::size_t last;
+            std::size_t depth;
+            std::uint32_t node;
+        };
+
+        builtNodes.assign(1, Node{0, 0, PREFIX_TRIE_NO_NAME, 0, 0, 0, 0});
+        builtLabelPool.clear();
+        maxDepth = 0;
+        std::vector<Range> ranges{{0, order.size(), 0, 0}};
+        for (std::size_t head = 0; head < ranges.size(); ++head) {
+            const Range range = ranges[head];
+            std::size_t first = range.first;
+
+            // The names are unique, and the one ending at the node sorts before the others
+            if (first < range.last && candidates.getName(order[first]).size() == range.depth) {
+                builtNodes[range.node].nameId = order[first];
+                maxDepth = std::max<std::uint32_t>(maxDepth, static_cast<std::uint32_t>(range.depth));
+                ++first;
+            }
+
+            builtNodes[range.node].firstChild = static_cast<std::uint32_t>(builtNodes.size());
+            while (first < range.last) {
+                const std::string_view firstName = candidates.getName(order[first]);
+                std::size_t last = first + 1;
+                while (last < range.last && candidates.getName(order[last])[range.depth] == firstName[range.depth])
+                    ++last;
+
+                // The first and last names of the group share the prefix of all of them, which ends the merged chain
+                const std::string_view lastName = candidates.getName(order[last - 1]);
+                std::size_t depth = range.depth + 1;
+                while (depth < std::min(firstName.size(), lastName.size()) && firstName[depth] == lastName[depth])
+                    ++depth;
+
+                ranges.push_back({first, last, depth, static_cast<std::uint32_t>(builtNodes.size())});
+                builtNodes.push_back(Node{0, static_cast<std::uint32_t>(builtLabelPool.size()), PREFIX_TRIE_NO_NAME, 0, static_cast<std::uint8_t>(depth - range.depth), 0, 0});
+                builtLabelPool.append(firstName.substr(range.depth, depth - range.depth));
+                ++builtNodes[range.node].childCount;
+                first = last;
+            }
+        }
+
+        // The children follow their parent, so the lengths are gathered from the last node to the root
+        for (std::size_t i = builtNodes.size(); i-- > 0;) {
+            Node& node = builtNodes[i];
+            std::uint32_t minimumLength = UINT8_MAX;
+            std::uint32_t maximumLength = 0;
+            if (node.nameId != PREFIX_TRIE_NO_NAME) {
+                minimumLength = std::min<std::uint32_t>(candidates.getLength(node.nameId), UINT8_MAX);
+                maximumLength = minimumLength;
+            }
+            for (std::uint32_t child = node.firstChild; child < node.firstChild + node.childCount; ++child) {
+                minimumLength = std::min<std::uint32_t>(minimumLength, builtNodes[child].minimumLength);
+                maximumLength = std::max<std::uint32_t>(maximumLength, builtNodes[child].maximumLength);
+            }
+            node.minimumLength = static_cast<std::uint8_t>(minimumLength);
+            node.maximumLength = static_cast<std::uint8_t>(maximumLength);
+        }
+
+        nodes = builtNodes;
+        labelPool = builtLabelPool;
+        unmap();
+        indexFingerprint = fingerprint;
+        Log::info("Built prefix trie of {} nodes over {} names", nodes.size(), candidates.size());
+    }
+
+    /**
+     * Maps a trie previously saved with save, whatever the BinaryIndex it was built from.
+     *
+     * @return true if the trie was mapped, false if the file is missing or invalid.
+     */
+    bool load(const std::filesystem::path& trieFilePath) {
+        int fd = open(trieFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct stat status;
+        if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(FileHeader)) {
+            close(fd);
+            return false;
+        }
+
+        void * fileMapping = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (fileMapping == MAP_FAILED)
+            return false;
+
+        const std::byte * data = static_cast<const std::byte *>(fileMapping);
+        const std::size_t dataSize = static_cast<std::size_t>(status.st_size);
+        const FileHeader * header = reinterpret_cast<const FileHeader *>(data);
+        const std::uint64_t labelPoolOffset = sizeof(FileHeader) + std::uint64_t{header->nodeCount} * sizeof(Node);
+
+        if (std::memcmp(header->magic, PREFIX_TRIE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != PREFIX_TRIE_VERSION
+            || header->nodeCount == 0
+            || header->labelPoolSize > dataSize
+            || labelPoolOffset + header->labelPoolSize != dataSize) {
+            munmap(fileMapping, dataSize);
+            return false;
+        }
+
+        unmap();
+        mapping = data;
+        mappingSize = dataSize;
+        nodes = std::span<const Node>(reinterpret_cast<const Node *>(data + sizeof(FileHeader)), header->nodeCount);
+        labelPool = std::string_view(reinterpret_cast<const char *>(data + labelPoolOffset), header->labelPoolSize);
+        maxDepth = header->maxDepth;
+        indexFingerprint = header->indexFingerprint;
+        return true;
+    }
+
+    /**
+     * Saves the trie, tagged with the fingerprint of the BinaryIndex it was built from. The file is written next to its
+     * final location and renamed, so that concurrent shells never load a partial trie.
+     */
+    bool save(const std::filesystem::path& trieFilePath) const {
+        FileHeader header{};
+        std::memcpy(header.magic, PREFIX_TRIE_MAGIC, sizeof(header.magic));
+        header.version = PREFIX_TRIE_VERSION;
+        header.nodeCount = static_cast<std::uint32_t>(nodes.size());
+        header.maxDepth = maxDepth;
+        header.labelPoolSize = labelPool.size();
+        header.indexFingerprint = indexFingerprint;
+
+        std::filesystem::path temporaryPath = trieFilePath.string() + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char *>(nodes.data()), static_cast<std::streamsize>(nodes.size() * sizeof(Node)));
+            file.write(labelPool.data(), static_cast<std::streamsize>(labelPool.size()));
+            if (!file.good())
+                return false;
+        }
+
+        std::error_code errorCode;
+        std::filesystem::rename(temporaryPath, trieFilePath, errorCode);
+        if (errorCode) {
+            std::filesystem::remove(temporaryPath, errorCode);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Loads the trie saved for the current state of the BinaryIndex, or builds and saves it if there is none.
+     */
+    void loadOrBuild(const CandidateStore& candidates, std::uint64_t fingerprint, const std::filesystem::path& trieFilePath) {
+        if (load(trieFilePath) && indexFingerprint == fingerprint) {
+            Log::info("Loaded prefix trie of {} nodes from {}", nodes.size(), trieFilePath.string());
+            return;
+        }
+
+        build(candidates, fingerprint);
+        if (!save(trieFilePath))
+            Log::warn("Could not save the prefix trie in {}", trieFilePath.string());
+    }
+
+    /**
+     * Finds the binaries accepted by the predicate closest to the query, walking the trie with the cutoff of a
+     * SuggestionSelector and leaving out the subtrees whose prefix is already farther than it.
+     *
+     * @param candidates the store the trie was built from
+     * @param query the input command
+     * @param maxDistance the highest distance of the binaries to find, a negative value for no maximum
+     * @param maxResults the maximum number of binaries to find, 0 for no maximum
+     * @param margin how much farther than the closest binaries the returned ones can be
+     * @param slice the slice of the store holding every binary the predicate accepts
+     * @param accept predicate on the position of the binary in the store, false to leave it out of the results
+     * @param resource where the matches, the rows and the walk stack are allocated
+     * @return the matches, closest first, and the number of nodes visited.
+     */
+    template <typename AcceptPredicate>
+    SearchResult findBest(const CandidateStore& candidates, std::string_view query, int maxDistance, std::size_t maxResults, int margin, CandidateStore::Slice slice, AcceptPredicate accept, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) const {
+        const std::uint32_t exactMatch = candidates.find(query);
+        const bool exactMatchRuledOut = exactMatch == candidates.size() || !accept(exactMatch);
+
+        SuggestionSelector walkSelector(maxDistance, maxResults, margin, exactMatchRuledOut, resource);
+        SearchResult result{std::pmr::vector<Match>(resource)};
+        if (nodes.empty() || slice.size() == 0)
+            return result;
+
+        // The store is sorted by length, the lengths of the slice are the ones of its first and last names
+        const int sliceMinimumLength = static_cast<int>(std::min<std::uint32_t>(candidates.getLength(slice.first), UINT8_MAX));
+        const int sliceMaximumLength = static_cast<int>(std::min<std::uint32_t>(candidates.getLength(slice.last - 1), UINT8_MAX));
+        const int queryLength = static_cast<int>(query.size());
+
+        // rows[i] is the row of the i-th character of the current path, and path[i] that character
+        const std::size_t rowSize = query.size() + 1;
+        std::pmr::vector<int> rows((std::size_t{maxDepth} + 1) * rowSize, 0, resource);
+        std::pmr::vector<char> path(std::size_t{maxDepth} + 1, '\0', resource);
+        for (std::size_t j = 0; j < rowSize; ++j)
+            rows[j] = static_cast<int>(j);
+
+        // Nodes still to walk, with the depth their label starts at
+        std::pmr::vector<std::pair<std::uint32_t, std::uint32_t>> stack(resource);
+        stack.emplace_back(0, 0);
+        std::pmr::vector<Match> collected(resource);
+        std::uint64_t names = 0;
+        std::uint64_t cells = 0;
+
+        while (!stack.empty()) {
+            const auto [nodeId, startDepth] = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[nodeId];
+            ++result.visitedNodes;
+
+            const std::uint32_t depth = startDepth + node.labelLength;
+            if (depth > maxDepth || std::size_t{node.labelOffset} + node.labelLength > labelPool.size())
+                continue;
+
+            // A name is at least as far from the query as their difference in length
+            const int cutoff = walkSelector.getSharedCutoff();
+            const int minimumLength = std::max<int>(node.minimumLength, sliceMinimumLength);
+            const int maximumLength = std::min<int>(node.maximumLength, sliceMaximumLength);
+            if (minimumLength > maximumLength || minimumLength - queryLength > cutoff || queryLength - maximumLength > cutoff)
+                continue;
+
+            bool pruned = false;
+            for (std::uint32_t i = startDepth + 1; i <= depth; ++i) {
+                path[i] = labelPool[node.labelOffset + (i - startDepth - 1)];
+                const int rowMinimum = WordDistanceHandler::calculateNextRow(query, rows.data() + (i >= 2 ? i - 2 : 0) * rowSize,
+                    rows.data() + (i - 1) * rowSize, rows.data() + i * rowSize, static_cast<int>(i), path[i], path[i - 1]);
+                cells += query.size();
+                if (rowMinimum > cutoff) {
+                    pruned = true;
+                    break;
+                }
+            }
+            if (pruned)
+                continue;
+
+            if (node.nameId != PREFIX_TRIE_NO_NAME && node.nameId < candidates.size() && accept(node.nameId)) {
+                ++names;
+                const int distance = rows[depth * rowSize + query.size()];
+                if (distance <= cutoff) {
+                    collected.push_back({node.nameId, distance});
+                    walkSelector.add({node.nameId, distance});
+                }
+            }
+
+            if (std::size_t{node.firstChild} + node.childCount > nodes.size())
+                continue;
+
+            // The child continuing the query is pushed last, to be walked first
+            std::uint32_t continuingChild = PREFIX_TRIE_NO_NAME;
+            for (std::uint32_t child = node.firstChild + node.childCount; child-- > node.firstChild;) {
+                if (depth < query.size() && nodes[child].labelOffset < labelPool.size() && labelPool[nodes[child].labelOffset] == query[depth])
+                    continuingChild = child;
+                else
+                    stack.emplace_back(child, depth);
+            }
+            if (continuingChild != PREFIX_TRIE_NO_NAME)
+                stack.emplace_back(continuingChild, depth);
+        }
+
+        WordDistanceHandler::DistanceCounters& counters = WordDistanceHandler::getDistanceCounters();
+        counters.distanceComputations.fetch_add(names, std::memory_order_relaxed);
+        counters.cellsComputed.fetch_add(cells, std::memory_order_relaxed);
+
+        // Every binary of the final selection was within the cutoff when it was walked, selecting the collected ones by
+        // increasing position gives the selection of the linear scan
+        std::sort(collected.begin(), collected.end(), [](const Match& first, const Match& second) { return first.nameId < second.nameId; });
+        SuggestionSelector selector(maxDistance, maxResults, margin, exactMatchRuledOut, resource);
+        for (const Match& match : collected)
+            selector.add(match);
+        result.matches = selector.takeMatches();
+        return result;
+    }
+
+    std::size_t size() const { return nodes.size(); }
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include "Log.hpp"
+#include "CandidateStore.hpp"
+
+#define Q_GRAM_INDEX_MAGIC "SMILEQGR"
+#define Q_GRAM_INDEX_VERSION 1
+
+/**
+ * @class QGramIndex
+ * @brief Inverted index from the bigrams of the binary names to the names containing them, used to find the binaries
+ * whose Jaccard similarity with the input command reaches a threshold without scanning all of them.
+ *
+ * Names are padded with a boundary marker on both sides before being split in bigrams, so that the first and last
+ * characters count as much as the inner ones and one character names still have bigrams. File names cannot contain the
+ * NUL character, which is therefore used as the marker. The Jaccard similarity is computed on the sets of distinct
+ * bigrams of the two words.
+ *
+ * Every bigram has a posting list holding, sorted, the positions in the CandidateStore of the names containing it. Since
+ * the store is sorted by length, the names within the length condition form a contiguous range of positions, which is
+ * cut out of every posting list with two binary searches. A query only merges the posting lists of its own bigrams.
+ *
+ * The index is persisted next to the BinaryIndex, tagged with its fingerprint, like the BK-tree.
+ */
+class QGramIndex {
+
+public:
+
+    struct Gram {
+        std::uint32_t code;
+        std::uint32_t postingCount;
+        std::uint64_t firstPosting;
+    };
+
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t gramCount;
+        std::uint32_t nameCount;
+        std::uint32_t reserved;
+        std::uint64_t postingCount;
+        std::uint64_t indexFingerprint;
+    };
+
+private:
+
+    // Sorted by code
+    std::vector<Gram> grams;
+    std::vector<std::uint32_t> postings;
+    // Number of distinct bigrams of each name, needed for the size of the union
+    std::vector<std::uint32_t> gramCounts;
+    std::uint64_t indexFingerprint = 0;
+
+    /**
+     * @return the distinct bigram codes of the padded word, sorted.
+     */
+    static std::pmr::vector<std::uint32_t> computeGrams(std::string_view word, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) {
+        std::pmr::vector<std::uint32_t> codes(resource);
+        codes.reserve(word.size() + 1);
+
+        unsigned char previous = 0;
+        for (char character : word) {
+            const unsigned char current = static_cast<unsigned char>(character);
+            codes.push_back((std::uint32_t{previous} << 8) | current);
+            previous = current;
+        }
+        codes.push_back(std::uint32_t{previous} << 8);
+
+        std::sort(codes.begin(), codes.end());
+        codes.erase(std::unique(codes.begin(), codes.end()), codes.end());
+        return codes;
+    }
+
+    const Gram * findGram(std::uint32_t code) const {
+        auto gram = std::lower_bound(grams.begin(), grams.end(), code, [](const Gram& current, std::uint32_t value) { return current.code < value; });
+        return gram != grams.end() && gram->code == code ? &*gram : nullptr;
+    }
+
+public:
+
+    QGramIndex() { }
+
+    /**
+     * Builds the posting lists of every name of the store.
+     *
+     * @param candidates the names to index, the positions stored in the posting lists are their positions in the store
+     * @param fingerprint the fingerprint of the BinaryIndex the names come from, 0 for a store built in memory
+     */
+    void build(const CandidateStore& candidates, std::uint64_t fingerprint) {
+        // (code, position) pairs, sorted so that each posting list is contiguous and sorted by position
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> occurrences;
+        gramCounts.assign(candidates.size(), 0);
+
+        for (std::uint32_t position = 0; position < candidates.size(); ++position) {
+            const std::pmr::vector<std::uint32_t> codes = computeGrams(candidates.getName(position));
+            gramCounts[position] = static_cast<std::uint32_t>(codes.size());
+            for (std::uint32_t code : codes)
+                occurrences.emplace_back(code, position);
+        }
+        std::sort(occurrences.begin(), occurrences.end());
+
+        grams.clear();
+        postings.clear();
+        postings.reserve(occurrences.size());
+        for (const auto& [code, position] : occurrences) {
+            if (grams.empty() || grams.back().code != code)
+                grams.push_back({code, 0, postings.size()});
+            ++grams.back().postingCount;
+            postings.push_back(position);
+        }
+
+        indexFingerprint = fingerprint;
+        Log::info("Built q-gram index of {} bigrams and {} postings", grams.size(), postings.size());
+    }
+
+    /**
+     * Loads an index previously saved with save, only if it was built from a BinaryIndex with the given fingerprint.
+     *
+     * @return true if the index was loaded, false if the file is missing, invalid or belongs to another index.
+     */
+    bool load(const std::filesystem::path& indexFilePath, std::uint64_t expectedIndexFingerprint) {
+        std::ifstream file(indexFilePath, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        FileHeader header{};
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+            || std::memcmp(header.magic, Q_GRAM_INDEX_MAGIC, sizeof(header.magic)) != 0
+            || header.version != Q_GRAM_INDEX_VERSION
+            || header.indexFingerprint != expectedIndexFingerprint)
+            return false;
+
+        std::vector<Gram> loadedGrams(header.gramCount);
+        std::vector<std::uint32_t> loadedPostings(header.postingCount);
+        std::vector<std::uint32_t> loadedGramCounts(header.nameCount);
+        if (!file.read(reinterpret_cast<char *>(loadedGrams.data()), static_cast<std::streamsize>(loadedGrams.size() * sizeof(Gram)))
+            || !file.read(reinterpret_cast<char *>(loadedPostings.data()), static_cast<std::streamsize>(loadedPostings.size() * sizeof(std::uint32_t)))
+            || !file.read(reinterpret_cast<char *>(loadedGramCounts.data()), static_cast<std::streamsize>(loadedGramCounts.size() * sizeof(std::uint32_t))))
+            return false;
+
+        grams = std::move(loadedGrams);
+        postings = std::move(loadedPostings);
+        gramCounts = std::move(loadedGramCounts);
+        indexFingerprint = header.indexFingerprint;
+        return true;
+    }
+
+    /**
+     * Saves the index, tagged with the fingerprint of the BinaryIndex it was built from. The file is written next to its
+     * final location and renamed, so that concurrent shells never load a partial index.
+     */
+    bool save(const std::filesystem::path& indexFilePath) const {
+        FileHeader header{};
+        std::memcpy(header.magic, Q_GRAM_INDEX_MAGIC, sizeof(header.magic));
+        header.version = Q_GRAM_INDEX_VERSION;
+        header.gramCount = static_cast<std::uint32_t>(grams.size());
+        header.nameCount = static_cast<std::uint32_t>(gramCounts.size());
+        header.postingCount = postings.size();
+        header.indexFingerprint = indexFingerprint;
+
+        std::filesystem::path temporaryPath = indexFilePath.string() + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char *>(grams.data()), static_cast<std::streamsize>(grams.size() * sizeof(Gram)));
+            file.write(reinterpret_cast<const char *>(postings.data()), static_cast<std::streamsize>(postings.size() * sizeof(std::uint32_t)));
+            file.write(reinterpret_cast<const char *>(gramCounts.data()), static_cast<std::streamsize>(gramCounts.size() * sizeof(std::uint32_t)));
+            if (!file.good())
+                return false;
+        }
+
+        std::error_code errorCode;
+        std::filesystem::rename(temporaryPath, indexFilePath, errorCode);
+        if (errorCode) {
+            std::filesystem::remove(temporaryPath, errorCode);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Loads the index saved for the given state of the BinaryIndex, or builds and saves it if there is none.
+     */
+    void loadOrBuild(const CandidateStore& candidates, std::uint64_t fingerprint, const std::filesystem::path& indexFilePath) {
+        if (load(indexFilePath, fingerprint) && gramCounts.size() == candidates.size()) {
+            Log::info("Loaded q-gram index of {} bigrams from {}", grams.size(), indexFilePath.string());
+            return;
+        }
+
+        build(candidates, fingerprint);
+        if (!save(indexFilePath))
+            Log::warn("Could not save the q-gram index in {}", indexFilePath.string());
+    }
+
+    /**
+     * Finds the names of a slice of the store whose bigram Jaccard similarity with the query reaches the threshold, merging
+     * the posting lists of the bigrams of the query.
+     *
+     * @param query the input command
+     * @param slice the positions to consider, usually the ones within the length condition
+     * @param threshold the minimum Jaccard similarity, in [0, 1]
+     * @param passes output array of one flag for each position of the slice, set to 1 for the names reaching the threshold
+     * and left untouched for the others
+     * @param resource where the bigrams of the query and the merge cursors are allocated
+     * @return the number of names reaching the threshold.
+     */
+    std::size_t filterJaccard(std::string_view query, CandidateStore::Slice slice, double threshold, std::uint8_t * passes, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) const {
+        const std::pmr::vector<std::uint32_t> queryCodes = computeGrams(query, resource);
+
+        // Cursors over the part of each posting list within the slice
+        std::pmr::vector<std::pair<const std::uint32_t *, const std::uint32_t *>> lists(resource);
+        lists.reserve(queryCodes.size());
+        for (std::uint32_t code : queryCodes) {
+            const Gram * gram = findGram(code);
+            if (gram == nullptr)
+                continue;
+
+            const std::uint32_t * first = postings.data() + gram->firstPosting;
+            const std::uint32_t * last = first + gram->postingCount;
+            first = std::lower_bound(first, last, slice.first);
+            last = std::lower_bound(first, last, slice.last);
+            if (first != last)
+                lists.emplace_back(first, last);
+        }
+
+        // The merge repeatedly takes the smallest position at the head of the lists, the number of lists holding it being
+        // the number of bigrams shared with the query
+        std::size_t matches = 0;
+        while (!lists.empty()) {
+            std::uint32_t position = *lists.front().first;
+            for (const auto& list : lists)
+                position = std::min(position, *list.first);
+
+            std::uint32_t sharedGrams = 0;
+            for (auto& list : lists) {
+                if (*list.first == position) {
+                    ++sharedGrams;
+                    ++list.first;
+                }
+            }
+            std::erase_if(lists, [](const auto& list) { return list.first == list.second; });
+
+            const double unionSize = static_cast<double>(queryCodes.size() + gramCounts[position] - sharedGrams);
+            if (sharedGrams >= threshold * unionSize) {
+                passes[position - slice.first] = 1;
+                ++matches;
+            }
+        }
+        return matches;
+    }
+
+    std::size_t size() const { return grams.size(); }
+};
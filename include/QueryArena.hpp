@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <thread>
+#include <cstddef>
+
+// Room left in the arena, besides the flags of the candidate filter, for the grams, search stack and suggestions of a query
+#define QUERY_ARENA_BASE_SIZE (256 * 1024)
+// Room left in the arena for the selection of each thread, when the scoring is spread over the cores
+#define QUERY_ARENA_THREAD_SIZE (4 * 1024)
+
+/**
+ * @class QueryArena
+ * @brief Monotonic memory resource the temporary arrays of a query are allocated from, so that the lookup itself does not
+ * allocate once the index is loaded.
+ *
+ * Its buffer is allocated once, sized after the number of candidates and of cores: the candidate filter needs one flag
+ * for each candidate in the worst case, each thread of a parallel scoring a buffer for its selection, and the other
+ * arrays of a query are small. Should a query need more, the arena falls back
+ * to the heap instead of failing. Releasing the arena makes its whole buffer available again for the next query.
+ */
+class QueryArena {
+
+private:
+
+    std::size_t capacity;
+    std::unique_ptr<std::byte[]> buffer;
+    std::pmr::monotonic_buffer_resource resource;
+
+public:
+
+    /**
+     * @param candidateCount the number of names queries are matched against
+     */
+    explicit QueryArena(std::size_t candidateCount)
+        : capacity(candidateCount + QUERY_ARENA_BASE_SIZE + std::thread::hardware_concurrency() * QUERY_ARENA_THREAD_SIZE), buffer(std::make_unique_for_overwrite<std::byte[]>(capacity)),
+        resource(buffer.get(), capacity) { }
+
+    QueryArena(const QueryArena&) = delete;
+    QueryArena& operator=(const QueryArena&) = delete;
+
+    std::pmr::memory_resource * get() { return &resource; }
+
+    /**
+     * Frees everything allocated by the previous query at once.
+     */
+    void release() { resource.release(); }
+};
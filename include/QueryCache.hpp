@@ -0,0 +1,313 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <algorithm>
+#include <bit>
+#include <filesystem>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "Settings.hpp"
+#include "CommandSuggester.hpp"
+
+#define QUERY_CACHE_MAGIC "SMILEQRC"
+#define QUERY_CACHE_VERSION 1
+// Number of entries of a set, among which the entry to evict is chosen
+#define QUERY_CACHE_WAYS 8
+#define QUERY_CACHE_ENTRY_SIZE 512
+// Longer input commands are not cached
+#define QUERY_CACHE_MAX_INPUT_LENGTH 64
+
+/**
+ * @class QueryCache
+ * @brief Persistent cache of the suggestions found for the input commands, so that a typo made again is answered without
+ * loading the lookup structures nor computing a single distance.
+ *
+ * The cache is a fixed-size file in the settings directory, memory mapped and shared by all the shells. It is set
+ * associative: the hash of the input command selects a set of QUERY_CACHE_WAYS entries, and when the set is full the entry
+ * to replace is chosen with the CLOCK algorithm, i.e. the hand of the set skips, clearing their bit, the entries read since
+ * it last passed. Each entry holds the suggestions before their ranking by the history, which changes with every command
+ * run, tagged with the fingerprint of the BinaryIndex and with a hash of the settings they depend on: an entry found for
+ * other binaries or other settings is a miss, and is the first to be replaced.
+ *
+ * The file is locked while an entry is read or written. Any error, or a file written by another version, disables the
+ * cache for the current run instead of failing the lookup.
+ */
+class QueryCache {
+
+public:
+
+    using Suggestion = CommandSuggester::Suggestion;
+
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t setCount;
+    };
+
+    struct Entry {
+        std::uint64_t inputHash;
+        std::uint64_t indexFingerprint;
+        std::uint64_t parametersHash;
+        std::uint8_t valid;
+        // Set when the entry is read, cleared when the hand of its set passes over it
+        std::uint8_t referenced;
+        std::uint8_t inputLength;
+        std::uint8_t suggestionCount;
+        std::uint16_t payloadSize;
+        std::uint16_t reserved;
+        char input[QUERY_CACHE_MAX_INPUT_LENGTH];
+        // For each suggestion, its distance, the length of its name and the name
+        std::uint8_t payload[QUERY_CACHE_ENTRY_SIZE - 96];
+    };
+
+    struct Set {
+        std::uint64_t hand;
+        Entry entries[QUERY_CACHE_WAYS];
+    };
+
+private:
+
+    int fd = -1;
+    std::byte * mapping = nullptr;
+    Set * sets = nullptr;
+    std::size_t setCount = 0;
+    std::size_t mappingSize = 0;
+    // Copy of the last entry found, the names of the suggestions returned by find point into it
+    Entry foundEntry{};
+
+    static std::uint64_t hashInput(std::string_view input) {
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (char character : input) {
+            hash ^= static_cast<unsigned char>(character);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static std::uint64_t mixHash(std::uint64_t hash, std::uint64_t value) {
+        return (hash ^ value) * 1099511628211ULL;
+    }
+
+    bool matches(const Entry& entry, std::string_view input, std::uint64_t inputHash) const {
+        return entry.valid != 0 && entry.inputHash == inputHash && entry.inputLength == input.size()
+            && std::memcmp(entry.input, input.data(), input.size()) == 0;
+    }
+
+    bool isCurrent(const Entry& entry, std::uint64_t fingerprint, std::uint64_t parametersHash) const {
+        return entry.valid != 0 && entry.indexFingerprint == fingerprint && entry.parametersHash == parametersHash;
+    }
+
+    Set& getSet(std::uint64_t inputHash) const {
+        return sets[(inputHash ^ (inputHash >> 32)) & (setCount - 1)];
+    }
+
+    /**
+     * Locks the file, unless another run resized it since it was mapped.
+     */
+    bool lock() const {
+        if (sets == nullptr || flock(fd, LOCK_EX) != 0)
+            return false;
+
+        struct stat status;
+        if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) != mappingSize) {
+            flock(fd, LOCK_UN);
+            return false;
+        }
+        return true;
+    }
+
+    void unlock() const {
+        flock(fd, LOCK_UN);
+    }
+
+    void close() {
+        if (mapping != nullptr)
+            munmap(mapping, mappingSize);
+        if (fd >= 0)
+            ::close(fd);
+        mapping = nullptr;
+        sets = nullptr;
+        fd = -1;
+    }
+
+public:
+
+    QueryCache() = default;
+    QueryCache(const QueryCache&) = delete;
+    QueryCache& operator=(const QueryCache&) = delete;
+
+    ~QueryCache() {
+        close();
+    }
+
+    /**
+     * Maps the cache file, creating it, or emptying it when it was written by another version or for another size.
+     *
+     * @param cacheFilePath the cache file
+     * @param entryCount the number of entries of the cache, rounded to a power of two number of sets
+     * @return true if the cache can be used.
+     */
+    bool open(const std::filesystem::path& cacheFilePath, std::size_t entryCount) {
+        close();
+        const std::size_t wantedSetCount = std::bit_ceil(std::max<std::size_t>(entryCount / QUERY_CACHE_WAYS, 1));
+        const std::size_t wantedSize = sizeof(FileHeader) + wantedSetCount * sizeof(Set);
+
+        fd = ::open(cacheFilePath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+            close();
+            return false;
+        }
+
+        struct stat status;
+        FileHeader header{};
+        bool valid = fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) == wantedSize
+            && pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header))
+            && std::memcmp(header.magic, QUERY_CACHE_MAGIC, sizeof(header.magic)) == 0
+            && header.version == QUERY_CACHE_VERSION && header.setCount == wantedSetCount;
+
+        if (!valid) {
+            Log::info("Creating query cache of {} entries in {}", wantedSetCount * QUERY_CACHE_WAYS, cacheFilePath.string());
+            std::memcpy(header.magic, QUERY_CACHE_MAGIC, sizeof(header.magic));
+            header.version = QUERY_CACHE_VERSION;
+            header.setCount = static_cast<std::uint32_t>(wantedSetCount);
+            valid = ftruncate(fd, 0) == 0 && ftruncate(fd, static_cast<off_t>(wantedSize)) == 0
+                && pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+        }
+
+        // The sets start right after the header, which is smaller than a page: the whole file is mapped
+        void * fileMapping = valid ? mmap(nullptr, wantedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        flock(fd, LOCK_UN);
+        if (fileMapping == MAP_FAILED) {
+            Log::warn("Could not open the query cache {}", cacheFilePath.string());
+            close();
+            return false;
+        }
+
+        mapping = static_cast<std::byte *>(fileMapping);
+        mappingSize = wantedSize;
+        setCount = wantedSetCount;
+        sets = reinterpret_cast<Set *>(mapping + sizeof(FileHeader));
+        return true;
+    }
+
+    /**
+     * Hash of the settings the suggestions of a command depend on, besides the binaries. The suggestions are cached
+     * before their ranking, which alone bounds their number, so the maximum number of suggestions is not part of it.
+     *
+     * @param margin the history ranking margin of the lookup
+     */
+    static std::uint64_t hashParameters(const Settings& settings, int margin) {
+        std::uint64_t hash = 14695981039346656037ULL;
+        hash = mixHash(hash, settings.getLengthConditionHeuristicEnabled() ? 1 : 0);
+        hash = mixHash(hash, static_cast<std::uint64_t>(settings.getLengthConditionHeuristic()));
+        hash = mixHash(hash, std::bit_cast<std::uint64_t>(settings.getQGramJaccardThreshold()));
+        hash = mixHash(hash, static_cast<std::uint64_t>(settings.getMaxEditDistance()));
+        // Every engine breaks ties by position like the linear scan, but the engine is still part of the key, so that a
+        // change of engine never serves the suggestions another one found
+        hash = mixHash(hash, settings.getSymSpellEngineEnabled() ? static_cast<std::uint64_t>(settings.getSymSpellMaxDistance()) + 1 : 0);
+        hash = mixHash(hash, settings.getPrefixTrieEngineEnabled() ? 1 : 0);
+        hash = mixHash(hash, settings.getBkTreeEngineEnabled() ? 1 : 0);
+        hash = mixHash(hash, static_cast<std::uint64_t>(margin));
+        return hash;
+    }
+
+    /**
+     * Looks up the suggestions cached for an input command, found for the same binaries and settings.
+     *
+     * @param suggestions filled with the cached suggestions, whose names are valid until the next call
+     * @return true on a hit.
+     */
+    bool find(std::string_view input, std::uint64_t fingerprint, std::uint64_t parametersHash, std::pmr::vector<Suggestion>& suggestions) {
+        if (input.size() > QUERY_CACHE_MAX_INPUT_LENGTH || !lock())
+            return false;
+
+        const std::uint64_t inputHash = hashInput(input);
+        bool found = false;
+        for (Entry& entry : getSet(inputHash).entries) {
+            if (matches(entry, input, inputHash) && isCurrent(entry, fingerprint, parametersHash)) {
+                entry.referenced = 1;
+                foundEntry = entry;
+                found = true;
+                break;
+            }
+        }
+        unlock();
+        if (!found)
+            return false;
+
+        suggestions.clear();
+        suggestions.reserve(foundEntry.suggestionCount);
+        std::size_t position = 0;
+        for (std::uint8_t i = 0; i < foundEntry.suggestionCount; ++i) {
+            const int distance = foundEntry.payload[position];
+            const std::size_t length = foundEntry.payload[position + 1];
+            suggestions.push_back({std::string_view(reinterpret_cast<const char *>(foundEntry.payload) + position + 2, length), distance});
+            position += 2 + length;
+        }
+        return true;
+    }
+
+    /**
+     * Caches the suggestions of an input command, unless they do not fit in an entry. The entry of the same command, else
+     * an outdated or empty one, else the one chosen by the hand of the set, is replaced.
+     */
+    void store(std::string_view input, std::uint64_t fingerprint, std::uint64_t parametersHash, const std::pmr::vector<Suggestion>& suggestions) {
+        if (input.size() > QUERY_CACHE_MAX_INPUT_LENGTH || suggestions.size() > UINT8_MAX)
+            return;
+
+        Entry newEntry{};
+        std::size_t payloadSize = 0;
+        for (const Suggestion& suggestion : suggestions) {
+            if (suggestion.distance < 0 || suggestion.distance > UINT8_MAX || suggestion.name.size() > UINT8_MAX
+                || payloadSize + 2 + suggestion.name.size() > sizeof(newEntry.payload))
+                return;
+            newEntry.payload[payloadSize] = static_cast<std::uint8_t>(suggestion.distance);
+            newEntry.payload[payloadSize + 1] = static_cast<std::uint8_t>(suggestion.name.size());
+            std::memcpy(newEntry.payload + payloadSize + 2, suggestion.name.data(), suggestion.name.size());
+            payloadSize += 2 + suggestion.name.size();
+        }
+        const std::uint64_t inputHash = hashInput(input);
+        newEntry.inputHash = inputHash;
+        newEntry.indexFingerprint = fingerprint;
+        newEntry.parametersHash = parametersHash;
+        newEntry.valid = 1;
+        newEntry.inputLength = static_cast<std::uint8_t>(input.size());
+        newEntry.suggestionCount = static_cast<std::uint8_t>(suggestions.size());
+        newEntry.payloadSize = static_cast<std::uint16_t>(payloadSize);
+        std::memcpy(newEntry.input, input.data(), input.size());
+
+        if (!lock())
+            return;
+
+        Set& set = getSet(inputHash);
+        Entry * replaced = nullptr;
+        for (Entry& entry : set.entries) {
+            if (matches(entry, input, inputHash)) {
+                replaced = &entry;
+                break;
+            }
+            if (replaced == nullptr && !isCurrent(entry, fingerprint, parametersHash))
+                replaced = &entry;
+        }
+        while (replaced == nullptr) {
+            Entry& entry = set.entries[set.hand % QUERY_CACHE_WAYS];
+            set.hand = (set.hand + 1) % QUERY_CACHE_WAYS;
+            if (entry.referenced != 0)
+                entry.referenced = 0;
+            else
+                replaced = &entry;
+        }
+        *replaced = newEntry;
+        unlock();
+    }
+};
+
+static_assert(sizeof(QueryCache::Entry) == QUERY_CACHE_ENTRY_SIZE);
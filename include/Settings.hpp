@@ -1,13 +1,24 @@
+#pragma once
+
 #include <iostream>
 #include <string>
 #include <fstream>
 #include <filesystem>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 #include <nlohmann/json.hpp>
-#include <spdlog/spdlog.h>
 #include <stdlib.h>
 #include <SQLiteCpp/SQLiteCpp.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include "Log.hpp"
 #include "CommonUtils.hpp"
+#include "Stats.hpp"
 #include "DatabaseStatements.hpp"
 
 using json = nlohmann::json;
@@ -16,16 +27,54 @@ using json = nlohmann::json;
 #define SETTINGS_FILE_NAME "settings.json"
 #define CONFIG_INDENTATION_SIZE 4
 #define DATABASE_FILENAME "historyStorage.db"
+#define SETTINGS_SNAPSHOT_FILENAME "settings.snapshot"
+#define SETTINGS_SNAPSHOT_MAGIC "SMILESET"
+#define SETTINGS_SNAPSHOT_VERSION 9
+#define HISTORY_SNAPSHOT_FILENAME "history.snapshot"
+#define HISTORY_JOURNAL_FILENAME "history.journal"
+#define BINARY_INDEX_FILENAME "binaryIndex.idx"
+#define BK_TREE_FILENAME "bkTree.idx"
+#define Q_GRAM_INDEX_FILENAME "qGramIndex.idx"
+#define SYM_SPELL_INDEX_FILENAME "symSpellIndex.idx"
+#define PREFIX_TRIE_FILENAME "prefixTrie.idx"
+#define QUERY_CACHE_FILENAME "queryCache.idx"
+#define SLOW_DIRECTORIES_FILENAME "slowDirectories.dat"
 #define DEFAULT_DATABASE_HISTORY_STORAGE true
 #define DEFAULT_IGNORE_MNT_FROM_SYSTEM_PATH_VARIABLES true
 #define DEFAULT_LENGTH_CONDITION_ENABLED true
 #define DEFAULT_LENGTH_CONDITION_HEURISTIC 2
+// A threshold of 0 disables the q-gram prefilter
+#define DEFAULT_Q_GRAM_JACCARD_THRESHOLD 0.0
+// Binaries farther than the closest ones by at most this margin are suggested too, if they are in the history
+#define DEFAULT_HISTORY_RANKING_MARGIN 0
+// Binaries farther than this edit distance are never suggested, a negative value suggests the closest ones whatever their distance
+#define DEFAULT_MAX_EDIT_DISTANCE -1
+// A maximum of 0 suggests every binary tied at the minimum distance
+#define DEFAULT_MAX_SUGGESTIONS 0
+// Lookups scoring at least this many binaries split them over all the cores, a threshold of 0 always scores on one thread
+#define DEFAULT_PARALLEL_SCORING_THRESHOLD 20000
+#define LOOKUP_ENGINE_LINEAR "linear"
+#define LOOKUP_ENGINE_BK_TREE "bkTree"
+#define LOOKUP_ENGINE_SYM_SPELL "symSpell"
+#define LOOKUP_ENGINE_PREFIX_TRIE "prefixTrie"
+// The linear scan needs no structure besides the index and has the lowest tail latency, the other engines are opt-in
+#define DEFAULT_LOOKUP_ENGINE LOOKUP_ENGINE_LINEAR
+// Number of characters deleted from the names in the SymSpell index, the binaries farther than that are scanned linearly
+#define DEFAULT_SYM_SPELL_MAX_DISTANCE 2
+// Number of input commands whose suggestions are cached, 0 disables the cache
+#define DEFAULT_QUERY_CACHE_SIZE 512
+// Time the binaries directories have to answer in before the suggestions are made without them, 0 waits for them forever
+#define DEFAULT_MAX_LATENCY_MS 1000
 
 #define DEBUG false
 
 /**
  * @class Settings
  * @brief Manages the loading and retrieval of application settings from a JSON configuration file.
+ *
+ * Parsing the JSON file is avoided on startup: the values read from it are saved in a compact binary snapshot next to it,
+ * tagged with the mtime, size and inode the file had, and loaded instead as long as the file is left untouched. The
+ * history database is only opened, and its table created, the first time it is requested with getDatabase.
  */
 class Settings {
 
@@ -37,40 +86,97 @@ private:
     const std::filesystem::path settingsDirectoryPath = userHomePath.string() + "/." + projectName;
     const std::filesystem::path settingsFilePath = settingsDirectoryPath.string() + "/" + settingsFileName;
     const std::filesystem::path databaseFilePath = settingsDirectoryPath.string() + "/" + DATABASE_FILENAME;
+    const std::filesystem::path settingsSnapshotFilePath = settingsDirectoryPath.string() + "/" + SETTINGS_SNAPSHOT_FILENAME;
+    const std::filesystem::path historySnapshotFilePath = settingsDirectoryPath.string() + "/" + HISTORY_SNAPSHOT_FILENAME;
+    const std::filesystem::path historyJournalFilePath = settingsDirectoryPath.string() + "/" + HISTORY_JOURNAL_FILENAME;
+    const std::filesystem::path binaryIndexFilePath = settingsDirectoryPath.string() + "/" + BINARY_INDEX_FILENAME;
+    const std::filesystem::path bkTreeFilePath = settingsDirectoryPath.string() + "/" + BK_TREE_FILENAME;
+    const std::filesystem::path qGramIndexFilePath = settingsDirectoryPath.string() + "/" + Q_GRAM_INDEX_FILENAME;
+    const std::filesystem::path symSpellIndexFilePath = settingsDirectoryPath.string() + "/" + SYM_SPELL_INDEX_FILENAME;
+    const std::filesystem::path prefixTrieFilePath = settingsDirectoryPath.string() + "/" + PREFIX_TRIE_FILENAME;
+    const std::filesystem::path queryCacheFilePath = settingsDirectoryPath.string() + "/" + QUERY_CACHE_FILENAME;
+    const std::filesystem::path slowDirectoriesFilePath = settingsDirectoryPath.string() + "/" + SLOW_DIRECTORIES_FILENAME;
 
     json settingsFile;
 
-    bool databaseHistoryStorageEnabled;
-    bool ignoreMntFromSystemPathVariables;
-    bool lengthConditionHeuristicEnabled;
-    int lengthConditionHeuristic;
+    // Every value has its default, kept when the settings file cannot be parsed
+    bool databaseHistoryStorageEnabled = DEFAULT_DATABASE_HISTORY_STORAGE;
+    bool ignoreMntFromSystemPathVariables = DEFAULT_IGNORE_MNT_FROM_SYSTEM_PATH_VARIABLES;
+    bool lengthConditionHeuristicEnabled = DEFAULT_LENGTH_CONDITION_ENABLED;
+    int lengthConditionHeuristic = DEFAULT_LENGTH_CONDITION_HEURISTIC;
+    double qGramJaccardThreshold = DEFAULT_Q_GRAM_JACCARD_THRESHOLD;
+    int historyRankingMargin = DEFAULT_HISTORY_RANKING_MARGIN;
+    int maxEditDistance = DEFAULT_MAX_EDIT_DISTANCE;
+    int maxSuggestions = DEFAULT_MAX_SUGGESTIONS;
+    int parallelScoringThreshold = DEFAULT_PARALLEL_SCORING_THRESHOLD;
+    bool bkTreeEngineEnabled = false;
+    bool symSpellEngineEnabled = false;
+    bool prefixTrieEngineEnabled = false;
+    int symSpellMaxDistance = DEFAULT_SYM_SPELL_MAX_DISTANCE;
+    int queryCacheSize = DEFAULT_QUERY_CACHE_SIZE;
+    int maxLatencyMs = DEFAULT_MAX_LATENCY_MS;
     std::vector<std::string> systemPathVariableList;
-    SQLite::Database * db;
+    // systemPathVariableList without the ignored directories, filtered on first use
+    std::vector<std::string> systemPathVariablePaths;
+    bool systemPathVariablePathsFiltered = false;
+    // Opened on first use, shared by the copies of the settings
+    std::shared_ptr<SQLite::Database> db;
+    // Statements compiled on the connection, released before it
+    std::shared_ptr<DatabaseStatements> databaseStatements;
+    bool databaseOpenFailed = false;
+
+    /**
+     * Fixed-size part of the snapshot, followed by the length-prefixed paths of systemBinariesPath.
+     */
+    struct SnapshotHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t pathCount;
+        std::int64_t settingsMtimeSeconds;
+        std::int64_t settingsMtimeNanoseconds;
+        std::uint64_t settingsSize;
+        std::uint64_t settingsInode;
+        double qGramJaccardThreshold;
+        std::int32_t lengthConditionHeuristic;
+        std::int32_t historyRankingMargin;
+        std::int32_t maxEditDistance;
+        std::int32_t maxSuggestions;
+        std::int32_t parallelScoringThreshold;
+        std::int32_t symSpellMaxDistance;
+        std::int32_t queryCacheSize;
+        std::int32_t maxLatencyMs;
+        std::uint8_t databaseHistoryStorageEnabled;
+        std::uint8_t ignoreMntFromSystemPathVariables;
+        std::uint8_t lengthConditionHeuristicEnabled;
+        std::uint8_t bkTreeEngineEnabled;
+        std::uint8_t symSpellEngineEnabled;
+        std::uint8_t prefixTrieEngineEnabled;
+    };
 
     void generateSettingsDirectory() {
-        spdlog::info("Generating new settings directory...");
+        Log::info("Generating new settings directory...");
         std::filesystem::create_directory(settingsDirectoryPath);
-        spdlog::info("Directory " + settingsDirectoryPath.string() + " successfully generated");
+        Log::info("Directory " + settingsDirectoryPath.string() + " successfully generated");
     }
 
     void generateSettingsDirectoryIfNotExists() {
         bool directoryExists = std::filesystem::is_directory(settingsDirectoryPath);
         if (!directoryExists) {
-            spdlog::warn("Configuration directory does not exist in path: " + settingsDirectoryPath.string());
+            Log::warn("Configuration directory does not exist in path: " + settingsDirectoryPath.string());
             generateSettingsDirectory();
         }
     }
 
     void generateSettingsFile() {
-        spdlog::info("Generating settings.json file...");
+        Log::info("Generating settings.json file...");
 
         std::string enabledDatabaseMessage;
         enabledDatabaseMessage = DEFAULT_DATABASE_HISTORY_STORAGE ? "Enabling" : "Disabling";     
-        spdlog::info(enabledDatabaseMessage.append(" database by default in the settings file..."));
+        Log::info(enabledDatabaseMessage.append(" database by default in the settings file..."));
         settingsFile["databaseHistoryStorageEnabled"] = DEFAULT_DATABASE_HISTORY_STORAGE;
 
         // Storing each path in the system $PATH variable in the systemPathVariableListed vector
-        spdlog::info("Loading by default all path contained in the system Path variable as a lookup reference in the settings file...");
+        Log::info("Loading by default all path contained in the system Path variable as a lookup reference in the settings file...");
         std::string systemPathVariable = getenv("PATH");
         std::stringstream ss(systemPathVariable);
         std::vector<std::string> systemPathVariableListed;
@@ -85,6 +191,15 @@ private:
 
         settingsFile["lengthConditionHeuristicEnabled"] = DEFAULT_LENGTH_CONDITION_ENABLED;
         settingsFile["lengthConditionHeuristic"] = DEFAULT_LENGTH_CONDITION_HEURISTIC;
+        settingsFile["qGramJaccardThreshold"] = DEFAULT_Q_GRAM_JACCARD_THRESHOLD;
+        settingsFile["historyRankingMargin"] = DEFAULT_HISTORY_RANKING_MARGIN;
+        settingsFile["maxEditDistance"] = DEFAULT_MAX_EDIT_DISTANCE;
+        settingsFile["maxSuggestions"] = DEFAULT_MAX_SUGGESTIONS;
+        settingsFile["parallelScoringThreshold"] = DEFAULT_PARALLEL_SCORING_THRESHOLD;
+        settingsFile["lookupEngine"] = DEFAULT_LOOKUP_ENGINE;
+        settingsFile["symSpellMaxDistance"] = DEFAULT_SYM_SPELL_MAX_DISTANCE;
+        settingsFile["queryCacheSize"] = DEFAULT_QUERY_CACHE_SIZE;
+        settingsFile["maxLatencyMs"] = DEFAULT_MAX_LATENCY_MS;
 
         std::ofstream file(settingsFilePath);
         file<<settingsFile;
@@ -97,16 +212,19 @@ private:
             generateSettingsFile();
     }
 
-    void loadSettingsFile() {
-        try {
-            spdlog::info("Loding settings file configuration...");
+    /**
+     * @return false if the settings file could not be parsed, the settings keeping their defaults.
+     * @throws ```std::runtime_error``` if the settings file can neither be read nor generated, which only the smile binary
+     * exits on: the engine also runs inside the shell, through the builtin
+     */
+    bool loadSettingsFile() {
+        Log::info("Loding settings file configuration...");
 
-            std::ifstream file(settingsFilePath);
-            if (!file.is_open()) {
-                spdlog::error("Error while opening settings file: " +  settingsDirectoryPath.string() + "/" + settingsFileName);
-                exit(1);
-            }
+        std::ifstream file(settingsFilePath);
+        if (!file.is_open())
+            throw std::runtime_error("could not open the settings file " + settingsFilePath.string());
 
+        try {
             file>>settingsFile;
             file.close();
 
@@ -114,56 +232,220 @@ private:
             systemPathVariableList = settingsFile["systemBinariesPath"].get<std::vector<std::string>>();
             lengthConditionHeuristicEnabled = settingsFile["lengthConditionHeuristicEnabled"].get<bool>();
             lengthConditionHeuristic = settingsFile["lengthConditionHeuristic"].get<int>();
+            // Settings files written by older versions do not have these keys
+            qGramJaccardThreshold = settingsFile.value("qGramJaccardThreshold", DEFAULT_Q_GRAM_JACCARD_THRESHOLD);
+            historyRankingMargin = settingsFile.value("historyRankingMargin", DEFAULT_HISTORY_RANKING_MARGIN);
+            maxEditDistance = settingsFile.value("maxEditDistance", DEFAULT_MAX_EDIT_DISTANCE);
+            maxSuggestions = std::max(settingsFile.value("maxSuggestions", DEFAULT_MAX_SUGGESTIONS), 0);
+            parallelScoringThreshold = std::max(settingsFile.value("parallelScoringThreshold", DEFAULT_PARALLEL_SCORING_THRESHOLD), 0);
+            symSpellMaxDistance = std::max(settingsFile.value("symSpellMaxDistance", DEFAULT_SYM_SPELL_MAX_DISTANCE), 0);
+            queryCacheSize = std::max(settingsFile.value("queryCacheSize", DEFAULT_QUERY_CACHE_SIZE), 0);
+            maxLatencyMs = std::max(settingsFile.value("maxLatencyMs", DEFAULT_MAX_LATENCY_MS), 0);
+
+            const std::string lookupEngine = settingsFile.value("lookupEngine", std::string(DEFAULT_LOOKUP_ENGINE));
+            bkTreeEngineEnabled = lookupEngine == LOOKUP_ENGINE_BK_TREE;
+            symSpellEngineEnabled = lookupEngine == LOOKUP_ENGINE_SYM_SPELL;
+            prefixTrieEngineEnabled = lookupEngine == LOOKUP_ENGINE_PREFIX_TRIE;
+            if (!bkTreeEngineEnabled && !symSpellEngineEnabled && !prefixTrieEngineEnabled && lookupEngine != LOOKUP_ENGINE_LINEAR)
+                Log::warn("Unknown lookup engine {}, using " LOOKUP_ENGINE_LINEAR, lookupEngine);
 
             databaseHistoryStorageEnabled = settingsFile["databaseHistoryStorageEnabled"].get<bool>();
-            generateDatabaseIfNotExists(databaseHistoryStorageEnabled);
             
-            spdlog::info("Settings file successfully loaded");
+            Log::info("Settings file successfully loaded");
+            return true;
         } catch (const std::exception &e) {
-            spdlog::error("Error while loading the settings file: {}", e.what());
+            Log::error("Error while loading the settings file: {}", e.what());
+            return false;
         }
     }
 
-    void generateDatabaseIfNotExists(bool databaseHistoryStorageEnabled) {
+    static bool isSnapshotOf(const SnapshotHeader& header, const struct stat& settingsFileStatus) {
+        return std::memcmp(header.magic, SETTINGS_SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+            && header.version == SETTINGS_SNAPSHOT_VERSION
+            && header.settingsMtimeSeconds == settingsFileStatus.st_mtim.tv_sec
+            && header.settingsMtimeNanoseconds == settingsFileStatus.st_mtim.tv_nsec
+            && header.settingsSize == static_cast<std::uint64_t>(settingsFileStatus.st_size)
+            && header.settingsInode == settingsFileStatus.st_ino;
+    }
+
+    /**
+     * Loads the values saved in the snapshot, if it was taken from the current version of the settings file.
+     *
+     * @return true if the snapshot was loaded, false if it is missing, invalid or outdated.
+     */
+    bool loadSnapshot(const struct stat& settingsFileStatus) {
+        int fd = open(settingsSnapshotFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        std::string buffer;
+        char chunk[4096];
+        ssize_t bytesRead;
+        while ((bytesRead = read(fd, chunk, sizeof(chunk))) > 0)
+            buffer.append(chunk, static_cast<std::size_t>(bytesRead));
+        close(fd);
+
+        SnapshotHeader header;
+        if (bytesRead < 0 || buffer.size() < sizeof(header))
+            return false;
+        std::memcpy(&header, buffer.data(), sizeof(header));
+        if (!isSnapshotOf(header, settingsFileStatus))
+            return false;
+
+        std::vector<std::string> paths;
+        paths.reserve(header.pathCount);
+        std::size_t position = sizeof(header);
+        for (std::uint32_t i = 0; i < header.pathCount; ++i) {
+            std::uint32_t length;
+            if (position + sizeof(length) > buffer.size())
+                return false;
+            std::memcpy(&length, buffer.data() + position, sizeof(length));
+            position += sizeof(length);
+            if (position + length > buffer.size())
+                return false;
+            paths.emplace_back(buffer.data() + position, length);
+            position += length;
+        }
+
+        databaseHistoryStorageEnabled = header.databaseHistoryStorageEnabled != 0;
+        ignoreMntFromSystemPathVariables = header.ignoreMntFromSystemPathVariables != 0;
+        lengthConditionHeuristicEnabled = header.lengthConditionHeuristicEnabled != 0;
+        lengthConditionHeuristic = header.lengthConditionHeuristic;
+        qGramJaccardThreshold = header.qGramJaccardThreshold;
+        historyRankingMargin = header.historyRankingMargin;
+        maxEditDistance = header.maxEditDistance;
+        maxSuggestions = header.maxSuggestions;
+        parallelScoringThreshold = header.parallelScoringThreshold;
+        symSpellMaxDistance = header.symSpellMaxDistance;
+        queryCacheSize = header.queryCacheSize;
+        maxLatencyMs = header.maxLatencyMs;
+        bkTreeEngineEnabled = header.bkTreeEngineEnabled != 0;
+        symSpellEngineEnabled = header.symSpellEngineEnabled != 0;
+        prefixTrieEngineEnabled = header.prefixTrieEngineEnabled != 0;
+        systemPathVariableList = std::move(paths);
+        return true;
+    }
+
+    /**
+     * Saves the values loaded from the settings file in the snapshot. The snapshot is written next to its final location
+     * and renamed, so that concurrent shells never load a partial one.
+     */
+    void writeSnapshot(const struct stat& settingsFileStatus) const {
+        SnapshotHeader header{};
+        std::memcpy(header.magic, SETTINGS_SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SETTINGS_SNAPSHOT_VERSION;
+        header.pathCount = static_cast<std::uint32_t>(systemPathVariableList.size());
+        header.settingsMtimeSeconds = settingsFileStatus.st_mtim.tv_sec;
+        header.settingsMtimeNanoseconds = settingsFileStatus.st_mtim.tv_nsec;
+        header.settingsSize = static_cast<std::uint64_t>(settingsFileStatus.st_size);
+        header.settingsInode = settingsFileStatus.st_ino;
+        header.qGramJaccardThreshold = qGramJaccardThreshold;
+        header.lengthConditionHeuristic = lengthConditionHeuristic;
+        header.historyRankingMargin = historyRankingMargin;
+        header.maxEditDistance = maxEditDistance;
+        header.maxSuggestions = maxSuggestions;
+        header.parallelScoringThreshold = parallelScoringThreshold;
+        header.symSpellMaxDistance = symSpellMaxDistance;
+        header.queryCacheSize = queryCacheSize;
+        header.maxLatencyMs = maxLatencyMs;
+        header.bkTreeEngineEnabled = bkTreeEngineEnabled;
+        header.symSpellEngineEnabled = symSpellEngineEnabled;
+        header.prefixTrieEngineEnabled = prefixTrieEngineEnabled;
+        header.databaseHistoryStorageEnabled = databaseHistoryStorageEnabled;
+        header.ignoreMntFromSystemPathVariables = ignoreMntFromSystemPathVariables;
+        header.lengthConditionHeuristicEnabled = lengthConditionHeuristicEnabled;
+
+        std::string buffer(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (const std::string& path : systemPathVariableList) {
+            const std::uint32_t length = static_cast<std::uint32_t>(path.size());
+            buffer.append(reinterpret_cast<const char *>(&length), sizeof(length));
+            buffer.append(path);
+        }
+
+        std::filesystem::path temporaryPath = settingsSnapshotFilePath.string() + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return;
+            file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            if (!file.good())
+                return;
+        }
+
+        std::error_code errorCode;
+        std::filesystem::rename(temporaryPath, settingsSnapshotFilePath, errorCode);
+        if (errorCode)
+            std::filesystem::remove(temporaryPath, errorCode);
+    }
+
+    void openDatabase() {
         if (databaseHistoryStorageEnabled) {
-            spdlog::info("Database history storage enabled");
+            Stats::Span span("sqlite");
+            Log::info("Database history storage enabled");
             try {
                 // If there is no sqlite database file in the settings directory, generates it.
                 // Either way, establishes a connection
-                db = new SQLite::Database(databaseFilePath, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+                db = std::make_shared<SQLite::Database>(databaseFilePath, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
 
-                spdlog::info("Established connection to history database file in: {}", databaseFilePath.string());
+                Log::info("Established connection to history database file in: {}", databaseFilePath.string());
+
+                // The readers of the history never wait for the flush of the journal, nor the other way around. The
+                // mode is persistent, setting it again is a no-op
+                db->exec("PRAGMA journal_mode = WAL");
+                db->exec("PRAGMA synchronous = NORMAL");
 
                 // Connects the Database Statement module to the connected database
-                DatabaseStatements databaseStatements(*db);
+                databaseStatements = std::make_shared<DatabaseStatements>(*db);
 
-                spdlog::info("Instantiated database statements module");
+                Log::info("Instantiated database statements module");
 
                 // Instantiates history table if not exists
-                SQLite::Statement query = databaseStatements.getCreateHistoryTableIfNotExistsPreparedQuery();
-                query.exec();
+                databaseStatements->getCreateHistoryTableIfNotExistsPreparedQuery().exec();
 
-                spdlog::info("Database history table existance established");
+                Log::info("Database history table existance established");
             }
             catch (const SQLite::Exception& e) {
-                spdlog::error("Error during query execution {}", e.what());
+                Log::error("Error during query execution {}", e.what());
+                databaseStatements.reset();
+                db.reset();
+                databaseOpenFailed = true;
             }
             catch (const std::exception& e) {
-                spdlog::error("Error handling database: {}", e.what());
+                Log::error("Error handling database: {}", e.what());
+                databaseStatements.reset();
+                db.reset();
+                databaseOpenFailed = true;
             }
         } else 
-            spdlog::info("Database history storage disabled");
+            Log::info("Database history storage disabled");
     }
 
 public:
 
     Settings() {     
 
-        generateSettingsDirectoryIfNotExists();
+        Stats::Span span("settingsLoad");
+
+        // A single stat tells whether anything has to be generated, and whether the snapshot is still valid
+        struct stat settingsFileStatus;
+        if (stat(settingsFilePath.c_str(), &settingsFileStatus) != 0) {
+            generateSettingsDirectoryIfNotExists();
+
+            generateSettingsFileIfNotExists();
+
+            if (stat(settingsFilePath.c_str(), &settingsFileStatus) != 0) {
+                loadSettingsFile();
+                return;
+            }
+        }
 
-        generateSettingsFileIfNotExists();
+        if (loadSnapshot(settingsFileStatus)) {
+            Log::info("Settings loaded from the snapshot {}", settingsSnapshotFilePath.string());
+            return;
+        }
 
-        loadSettingsFile();
+        if (loadSettingsFile())
+            writeSnapshot(settingsFileStatus);
     }
 
     // Getter methods
@@ -174,27 +456,88 @@ public:
     std::string getSettingsDirectoryPathString() { return settingsDirectoryPath.string(); }
     std::string getSettingsFilePathString() { return settingsFilePath.string(); }
     std::string getDatabaseFilePathString() { return databaseFilePath.string(); }
+    std::string getBinaryIndexFilePathString() { return binaryIndexFilePath.string(); }
+    std::string getBkTreeFilePathString() { return bkTreeFilePath.string(); }
+    std::string getQGramIndexFilePathString() { return qGramIndexFilePath.string(); }
+    std::string getSymSpellIndexFilePathString() { return symSpellIndexFilePath.string(); }
+    std::string getPrefixTrieFilePathString() { return prefixTrieFilePath.string(); }
+    std::string getQueryCacheFilePathString() { return queryCacheFilePath.string(); }
+    std::string getSlowDirectoriesFilePathString() { return slowDirectoriesFilePath.string(); }
 
     std::filesystem::path getUserHomePath() { return userHomePath; }
     std::filesystem::path getSettingsDirectoryPath() { return settingsDirectoryPath; }
     std::filesystem::path getSettingsFilePath() { return settingsFilePath; }
     std::filesystem::path getDatabaseFilePath() { return databaseFilePath; }
+    std::filesystem::path getHistorySnapshotFilePath() { return historySnapshotFilePath; }
+    std::filesystem::path getHistoryJournalFilePath() { return historyJournalFilePath; }
+    std::filesystem::path getBinaryIndexFilePath() { return binaryIndexFilePath; }
+    std::filesystem::path getBkTreeFilePath() { return bkTreeFilePath; }
+    std::filesystem::path getQGramIndexFilePath() { return qGramIndexFilePath; }
+    std::filesystem::path getSymSpellIndexFilePath() { return symSpellIndexFilePath; }
+    std::filesystem::path getPrefixTrieFilePath() { return prefixTrieFilePath; }
+    std::filesystem::path getQueryCacheFilePath() { return queryCacheFilePath; }
+    std::filesystem::path getSlowDirectoriesFilePath() { return slowDirectoriesFilePath; }
     
-    json getSettingsFile() { return settingsFile; }
+    /**
+     * @return the parsed settings file, which is only read on this first call when the settings came from the snapshot.
+     */
+    json getSettingsFile() {
+        if (settingsFile.is_null()) {
+            std::ifstream file(settingsFilePath);
+            if (file.is_open())
+                settingsFile = json::parse(file, nullptr, false);
+        }
+        return settingsFile;
+    }
+
+    /**
+     * Opens the history database on first use, creating its table if needed.
+     *
+     * @return the history database, or nullptr if history storage is disabled or the database could not be opened.
+     */
+    SQLite::Database * getDatabase() {
+        if (db == nullptr && !databaseOpenFailed)
+            openDatabase();
+        return db.get();
+    }
 
-    std::vector<std::string> getSystemPathVariablePaths() { 
-        if (ignoreMntFromSystemPathVariables) {
-            std::vector<std::string> filteredSystemPathVariableList;
+    /**
+     * @return the statements of the history database, compiled once per connection, or nullptr if the database is not
+     * available.
+     */
+    DatabaseStatements * getDatabaseStatements() {
+        return getDatabase() != nullptr ? databaseStatements.get() : nullptr;
+    }
+
+    bool getDatabaseHistoryStorageEnabled() const { return databaseHistoryStorageEnabled; }
+
+    /**
+     * @return the configured binaries directories, without the ones in /mnt if ignoreMntFromSystemPathVariables is set.
+     * The list is filtered on the first call only.
+     */
+    const std::vector<std::string>& getSystemPathVariablePaths() {
+        if (!systemPathVariablePathsFiltered) {
             for (const auto& entry : systemPathVariableList) {
-                if (entry.find("/mnt") != 0)
-                    filteredSystemPathVariableList.push_back(entry);
+                if (!ignoreMntFromSystemPathVariables || entry.find("/mnt") != 0)
+                    systemPathVariablePaths.push_back(entry);
             }
-            return filteredSystemPathVariableList;
-        } else
-            return systemPathVariableList; 
+            systemPathVariablePathsFiltered = true;
+        }
+        return systemPathVariablePaths;
     }
 
     // By adding const to these member functions, it promises that calling them will not change the state of the Settings object
     bool getLengthConditionHeuristicEnabled() const { return lengthConditionHeuristicEnabled; }
     int getLengthConditionHeuristic() const { return lengthConditionHeuristic; }
+    double getQGramJaccardThreshold() const { return qGramJaccardThreshold; }
+    int getHistoryRankingMargin() const { return historyRankingMargin; }
+    int getMaxEditDistance() const { return maxEditDistance; }
+    int getMaxSuggestions() const { return maxSuggestions; }
+    int getParallelScoringThreshold() const { return parallelScoringThreshold; }
+    bool getBkTreeEngineEnabled() const { return bkTreeEngineEnabled; }
+    bool getSymSpellEngineEnabled() const { return symSpellEngineEnabled; }
+    bool getPrefixTrieEngineEnabled() const { return prefixTrieEngineEnabled; }
+    int getSymSpellMaxDistance() const { return symSpellMaxDistance; }
+    int getQueryCacheSize() const { return queryCacheSize; }
+    int getMaxLatencyMs() const { return maxLatencyMs; }
 };
\ No newline at end of file
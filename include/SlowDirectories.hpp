@@ -0,0 +1,189 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Log.hpp"
+
+#define SLOW_DIRECTORIES_MAGIC "SMILESLW"
+#define SLOW_DIRECTORIES_VERSION 1
+// Number of consecutive runs a directory has to miss the deadline in before it is no longer refreshed
+#define SLOW_DIRECTORY_SKIP_THRESHOLD 2
+// A skipped directory is probed again after this delay, doubled at each new timeout up to the maximum
+#define SLOW_DIRECTORY_BASE_BACKOFF_SECONDS 60
+#define SLOW_DIRECTORY_MAX_BACKOFF_SECONDS 86400
+
+/**
+ * @class SlowDirectories
+ * @brief Record of the binaries directories which did not answer within the latency budget, e.g. on a hung network mount,
+ * so that the directories which keep timing out are not even stat'ed on the next runs.
+ *
+ * A directory is skipped once it timed out in SLOW_DIRECTORY_SKIP_THRESHOLD consecutive runs, its binaries being taken
+ * from the index as they were last scanned. It is probed again after a backoff delay which doubles with every timeout,
+ * and forgotten as soon as it answers in time. The record is a small binary file in the settings directory, only written
+ * when it changes.
+ */
+class SlowDirectories {
+
+private:
+
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t directoryCount;
+    };
+
+    struct Record {
+        std::uint32_t timeouts = 0;
+        // Unix time of the last timeout
+        std::int64_t lastTimeout = 0;
+    };
+
+    std::filesystem::path filePath;
+    std::unordered_map<std::string, Record> records;
+    bool changed = false;
+
+    static std::int64_t getBackoffSeconds(std::uint32_t timeouts) {
+        const std::uint32_t doublings = std::min<std::uint32_t>(timeouts - SLOW_DIRECTORY_SKIP_THRESHOLD, 20);
+        return std::min<std::int64_t>(std::int64_t{SLOW_DIRECTORY_BASE_BACKOFF_SECONDS} << doublings, SLOW_DIRECTORY_MAX_BACKOFF_SECONDS);
+    }
+
+    template <typename T>
+    static bool readValue(const std::string& buffer, std::size_t& position, T& value) {
+        if (position + sizeof(T) > buffer.size())
+            return false;
+        std::memcpy(&value, buffer.data() + position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+
+public:
+
+    explicit SlowDirectories(const std::filesystem::path& filePath) : filePath(filePath) { }
+
+    /**
+     * Loads the record, left empty if the file is missing or invalid. The file is usually missing, which is checked with
+     * a single system call.
+     */
+    void load() {
+        int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        std::string buffer;
+        char chunk[4096];
+        ssize_t bytesRead;
+        while ((bytesRead = read(fd, chunk, sizeof(chunk))) > 0)
+            buffer.append(chunk, static_cast<std::size_t>(bytesRead));
+        close(fd);
+
+        std::size_t position = 0;
+        FileHeader header{};
+        if (bytesRead < 0 || !readValue(buffer, position, header)
+            || std::memcmp(header.magic, SLOW_DIRECTORIES_MAGIC, sizeof(header.magic)) != 0
+            || header.version != SLOW_DIRECTORIES_VERSION)
+            return;
+
+        std::unordered_map<std::string, Record> loadedRecords;
+        for (std::uint32_t i = 0; i < header.directoryCount; ++i) {
+            Record record;
+            std::uint32_t length = 0;
+            if (!readValue(buffer, position, record.timeouts) || !readValue(buffer, position, record.lastTimeout)
+                || !readValue(buffer, position, length) || position + length > buffer.size())
+                return;
+            loadedRecords.emplace(buffer.substr(position, length), record);
+            position += length;
+        }
+        records = std::move(loadedRecords);
+    }
+
+    /**
+     * @param now the current Unix time
+     * @return the directories not to refresh in this run.
+     */
+    std::unordered_set<std::string> getSkippedDirectories(std::int64_t now) const {
+        std::unordered_set<std::string> skippedDirectories;
+        for (const auto& [path, record] : records)
+            if (record.timeouts >= SLOW_DIRECTORY_SKIP_THRESHOLD && now < record.lastTimeout + getBackoffSeconds(record.timeouts))
+                skippedDirectories.insert(path);
+        return skippedDirectories;
+    }
+
+    /**
+     * Records the outcome of a refresh: the late directories timed out once more, and the other directories which were
+     * refreshed answered in time.
+     *
+     * @param directories the configured directories
+     * @param skippedDirectories the directories which were not refreshed
+     * @param lateDirectories the directories which did not answer before the deadline
+     * @param now the current Unix time
+     */
+    void update(const std::vector<std::string>& directories, const std::unordered_set<std::string>& skippedDirectories,
+                const std::vector<std::string>& lateDirectories, std::int64_t now) {
+        for (const std::string& directory : lateDirectories) {
+            Record& record = records[directory];
+            ++record.timeouts;
+            record.lastTimeout = now;
+            changed = true;
+            if (record.timeouts >= SLOW_DIRECTORY_SKIP_THRESHOLD)
+                Log::warn("Binaries directory {} timed out {} times in a row, skipping it for {} s", directory, record.timeouts, getBackoffSeconds(record.timeouts));
+        }
+
+        for (const std::string& directory : directories) {
+            if (skippedDirectories.contains(directory) || std::ranges::find(lateDirectories, directory) != lateDirectories.end())
+                continue;
+            if (records.erase(directory) > 0)
+                changed = true;
+        }
+    }
+
+    /**
+     * Saves the record if it changed. The file is written next to its final location and renamed, so that concurrent
+     * shells never load a partial one.
+     */
+    void save() {
+        if (!changed)
+            return;
+        changed = false;
+
+        std::error_code errorCode;
+        if (records.empty()) {
+            std::filesystem::remove(filePath, errorCode);
+            return;
+        }
+
+        FileHeader header{};
+        std::memcpy(header.magic, SLOW_DIRECTORIES_MAGIC, sizeof(header.magic));
+        header.version = SLOW_DIRECTORIES_VERSION;
+        header.directoryCount = static_cast<std::uint32_t>(records.size());
+
+        std::filesystem::path temporaryPath = filePath.string() + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            for (const auto& [path, record] : records) {
+                const std::uint32_t length = static_cast<std::uint32_t>(path.size());
+                file.write(reinterpret_cast<const char *>(&record.timeouts), sizeof(record.timeouts));
+                file.write(reinterpret_cast<const char *>(&record.lastTimeout), sizeof(record.lastTimeout));
+                file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+                file.write(path.data(), static_cast<std::streamsize>(path.size()));
+            }
+            if (!file.good())
+                return;
+        }
+
+        std::filesystem::rename(temporaryPath, filePath, errorCode);
+        if (errorCode)
+            std::filesystem::remove(temporaryPath, errorCode);
+    }
+};
@@ -0,0 +1,512 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <memory>
+#include <algorithm>
+#include <optional>
+#include <chrono>
+#include <ranges>
+#include <unordered_map>
+#include <filesystem>
+#include <csignal>
+#include <cstring>
+#include <cstdlib>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "Settings.hpp"
+#include "CommonUtils.hpp"
+#include "CandidateStore.hpp"
+#include "QGramIndex.hpp"
+#include "CommandHistory.hpp"
+#include "HistoryJournal.hpp"
+#include "CommandSuggester.hpp"
+
+#define DAEMON_SOCKET_FILENAME "smile.sock"
+#define DAEMON_REPLY_OK "OK"
+#define DAEMON_CLIENT_TIMEOUT_MS 1000
+#define DAEMON_MAX_REQUEST_SIZE 4096
+// Interval at which the binaries directories which are missing, or could not be watched, are watched again
+#define DAEMON_DIRECTORY_RETRY_MS 5000
+
+/**
+ * @class SmileDaemon
+ * @brief Resident process keeping the binaries of the system path in memory and answering queries over a Unix socket.
+ *
+ * Every configured binaries directory is watched with inotify, so that binaries being added, removed or having their
+ * permissions changed are applied to the in-memory set one by one instead of rescanning the directories. A directory
+ * which is missing, or removed later on, is watched again every DAEMON_DIRECTORY_RETRY_MS once it exists, and scanned
+ * then. The settings file is watched as well, and reloaded whenever it is written, and so is the history journal, flushed
+ * into the database once it grew large enough.
+ *
+ * The binaries being kept up to date in memory, the daemon neither refreshes the index nor caches the queries: the
+ * lookupEngine, queryCacheSize and maxLatencyMs settings only apply to the in-process lookups. Its queries are always
+ * answered by the linear scan, which every engine gives the same suggestions as, and the directories are scanned without
+ * a deadline, when the daemon starts or reloads the settings and never during a query.
+ *
+ * The protocol is one query per connection: the client sends the input command followed by a newline, the daemon replies
+ * with an "OK" line followed by one line for each suggestion, then closes the connection. An empty line is a ping,
+ * answered with the "OK" line alone without any lookup.
+ */
+class SmileDaemon {
+
+private:
+
+    struct WatchedDirectory {
+        std::string path;
+        int watchDescriptor = -1;
+        std::set<std::string> binaries;
+    };
+
+    inline static volatile std::sig_atomic_t stopRequested = 0;
+
+    std::unique_ptr<Settings> settings;
+    std::vector<WatchedDirectory> directories;
+    std::unordered_map<int, std::size_t> directoryByWatchDescriptor;
+    // Number of directories containing each binary
+    std::unordered_map<std::string, int> binaryReferences;
+    // Compact copy of the binaries the queries are matched against, rebuilt on the first query after a change
+    CandidateStore::Storage candidateStorage;
+    CandidateStore candidates;
+    QGramIndex qGramIndex;
+    bool candidatesOutdated = true;
+    // Started on the first query over enough binaries to be scored in parallel, then kept for the following ones
+    std::unique_ptr<ThreadPool> scoringThreadPool;
+
+    int inotifyFd = -1;
+    int settingsWatchDescriptor = -1;
+    int listenFd = -1;
+    std::filesystem::path socketPath;
+    std::chrono::steady_clock::time_point nextDirectoryRetry;
+
+    static void requestStop(int signal [[maybe_unused]]) { stopRequested = 1; }
+
+    void addBinary(WatchedDirectory& directory, const std::string& name) {
+        if (directory.binaries.insert(name).second && ++binaryReferences[name] == 1)
+            candidatesOutdated = true;
+    }
+
+    void removeBinary(WatchedDirectory& directory, const std::string& name) {
+        if (directory.binaries.erase(name) == 0)
+            return;
+
+        auto reference = binaryReferences.find(name);
+        if (reference != binaryReferences.end() && --reference->second == 0) {
+            binaryReferences.erase(reference);
+            candidatesOutdated = true;
+        }
+    }
+
+    static bool isExecutableBinary(const std::filesystem::path& filePath) {
+        try {
+            return CommonUtils::doesCurrentUserHaveExecutablePermissionForFile(filePath);
+        } catch (const std::filesystem::filesystem_error &e) {
+            return false;
+        }
+    }
+
+    static int watchDirectory(int inotifyFd, const std::string& path) {
+        return inotify_add_watch(inotifyFd, path.c_str(),
+            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    }
+
+    bool hasUnwatchedDirectories() const {
+        return std::ranges::any_of(directories, [](const WatchedDirectory& directory) { return directory.watchDescriptor < 0; });
+    }
+
+    /**
+     * Watches again the directories which were missing or removed, and scans those which exist now.
+     */
+    void retryUnwatchedDirectories() {
+        for (std::size_t i = 0; i < directories.size(); ++i) {
+            WatchedDirectory& directory = directories[i];
+            if (directory.watchDescriptor >= 0)
+                continue;
+
+            directory.watchDescriptor = watchDirectory(inotifyFd, directory.path);
+            if (directory.watchDescriptor < 0)
+                continue;
+
+            directoryByWatchDescriptor[directory.watchDescriptor] = i;
+            Log::info("Binaries directory {} is watched again", directory.path);
+            try {
+                for (const std::string& name : CommonUtils::getListOfFilesInPath(directory.path, false, true))
+                    addBinary(directory, name);
+            } catch (const std::filesystem::filesystem_error &e) {
+                Log::warn("Error while opening {}: {}. Ignoring...", directory.path, e.what());
+            }
+        }
+    }
+
+    /**
+     * Drops the current watches and binaries, then scans every configured directory and watches it for changes.
+     */
+    void loadDirectories() {
+        for (const WatchedDirectory& directory : directories) {
+            if (directory.watchDescriptor >= 0)
+                inotify_rm_watch(inotifyFd, directory.watchDescriptor);
+        }
+        directories.clear();
+        directoryByWatchDescriptor.clear();
+        binaryReferences.clear();
+        candidatesOutdated = true;
+
+        std::vector<std::string> paths = settings->getSystemPathVariablePaths();
+        directories.resize(paths.size());
+
+        // Watching before scanning, so that no binary added in between is missed
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            directories[i].path = paths[i];
+            directories[i].watchDescriptor = watchDirectory(inotifyFd, paths[i]);
+            if (directories[i].watchDescriptor >= 0)
+                directoryByWatchDescriptor[directories[i].watchDescriptor] = i;
+            else
+                Log::warn("Could not watch {}: {}", paths[i], std::strerror(errno));
+        }
+
+        std::vector<std::vector<std::string>> fileLists = CommonUtils::getListsOfFilesInPaths(paths, false, true);
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            for (const std::string& name : fileLists[i])
+                addBinary(directories[i], name);
+        }
+
+        nextDirectoryRetry = std::chrono::steady_clock::now() + std::chrono::milliseconds(DAEMON_DIRECTORY_RETRY_MS);
+        Log::info("Loaded {} binaries from {} directories", binaryReferences.size(), directories.size());
+    }
+
+    void reloadSettings() {
+        Log::info("Reloading settings");
+        try {
+            settings = std::make_unique<Settings>();
+            loadDirectories();
+        } catch (const std::exception &e) {
+            Log::error("Error while reloading the settings: {}", e.what());
+        }
+    }
+
+    void handleDirectoryEvent(const struct inotify_event * event) {
+        auto watched = directoryByWatchDescriptor.find(event->wd);
+        if (watched == directoryByWatchDescriptor.end())
+            return;
+
+        WatchedDirectory& directory = directories[watched->second];
+
+        if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+            Log::warn("Binaries directory {} was removed", directory.path);
+            for (const std::string& name : std::set<std::string>(directory.binaries))
+                removeBinary(directory, name);
+            // A moved directory would still be watched at its new path. The path is watched again once it exists
+            if (event->mask & IN_MOVE_SELF)
+                inotify_rm_watch(inotifyFd, event->wd);
+            directoryByWatchDescriptor.erase(watched);
+            directory.watchDescriptor = -1;
+            return;
+        }
+
+        if (event->len == 0)
+            return;
+
+        const std::string name(event->name);
+        if (isExecutableBinary(std::filesystem::path(directory.path) / name))
+            addBinary(directory, name);
+        else
+            removeBinary(directory, name);
+    }
+
+    void handleInotifyEvents() {
+        alignas(struct inotify_event) char buffer[16 * 1024];
+
+        while (true) {
+            ssize_t bytesRead = read(inotifyFd, buffer, sizeof(buffer));
+            if (bytesRead <= 0)
+                return;
+
+            for (ssize_t offset = 0; offset < bytesRead;) {
+                const struct inotify_event * event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+                offset += static_cast<ssize_t>(sizeof(struct inotify_event) + event->len);
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    Log::warn("Too many file system events, rescanning all directories");
+                    loadDirectories();
+                    return;
+                }
+
+                if (event->wd == settingsWatchDescriptor) {
+                    if (event->len > 0 && settings->getSettingsFileName() == event->name)
+                        reloadSettings();
+                    // The recorded commands are flushed by the daemon, between two queries
+                    else if (event->len > 0 && settings->getHistoryJournalFilePath().filename() == event->name && HistoryJournal::needsFlush(*settings))
+                        HistoryJournal::flush(*settings);
+                } else
+                    handleDirectoryEvent(event);
+            }
+        }
+    }
+
+    static void setTimeouts(int fd) {
+        struct timeval timeout{};
+        timeout.tv_sec = DAEMON_CLIENT_TIMEOUT_MS / 1000;
+        timeout.tv_usec = (DAEMON_CLIENT_TIMEOUT_MS % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    static bool writeAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            ssize_t written = write(fd, data.data(), data.size());
+            if (written <= 0)
+                return false;
+            data.remove_prefix(static_cast<std::size_t>(written));
+        }
+        return true;
+    }
+
+    void handleClient(int clientFd) {
+        setTimeouts(clientFd);
+
+        std::string request;
+        char buffer[512];
+        while (request.find('\n') == std::string::npos && request.size() < DAEMON_MAX_REQUEST_SIZE) {
+            ssize_t bytesRead = read(clientFd, buffer, sizeof(buffer));
+            if (bytesRead <= 0)
+                break;
+            request.append(buffer, static_cast<std::size_t>(bytesRead));
+        }
+
+        std::size_t end = request.find('\n');
+        if (end == std::string::npos)
+            return;
+
+        const std::string inputCommand = request.substr(0, end);
+        if (inputCommand.empty()) {
+            writeAll(clientFd, DAEMON_REPLY_OK "\n");
+            return;
+        }
+        Log::info("Query for {}", inputCommand);
+
+        if (candidatesOutdated) {
+            candidateStorage = CandidateStore::build(binaryReferences | std::views::keys);
+            candidates = CandidateStore(candidateStorage);
+            if (settings->getQGramJaccardThreshold() > 0)
+                qGramIndex.build(candidates, 0);
+            candidatesOutdated = false;
+        }
+
+        // The history snapshot is checked on every query, and only reloaded when the database changed
+        CommandHistory history;
+        history.load(*settings);
+
+        const int threshold = settings->getParallelScoringThreshold();
+        if (!scoringThreadPool && threshold > 0 && candidates.size() >= static_cast<std::size_t>(threshold) && ThreadPool::getThreadCount(SIZE_MAX) > 1)
+            scoringThreadPool = std::make_unique<ThreadPool>(ThreadPool::getThreadCount(SIZE_MAX));
+
+        const int margin = history.empty() ? 0 : settings->getHistoryRankingMargin();
+        const std::size_t maxSuggestions = static_cast<std::size_t>(settings->getMaxSuggestions());
+        // Every tie is found, the ranking orders them by common prefix before bounding their number
+        const std::pmr::vector<CommandSuggester::Suggestion> suggestions = CommandSuggester::findClosestCommands(inputCommand, candidates, *settings, &qGramIndex,
+            margin, 0, std::pmr::get_default_resource(), scoringThreadPool.get());
+        const std::pmr::vector<std::string_view> similarCommands = CommandSuggester::rankSuggestions(inputCommand, suggestions, &history, margin, maxSuggestions);
+
+        std::string reply = DAEMON_REPLY_OK "\n";
+        for (std::string_view command : similarCommands)
+            reply.append(command).append("\n");
+        writeAll(clientFd, reply);
+    }
+
+    static struct sockaddr_un getSocketAddress(const std::filesystem::path& path) {
+        struct sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        return address;
+    }
+
+    bool openSocket() {
+        socketPath = getSocketPath();
+        if (socketPath.string().size() >= sizeof(sockaddr_un::sun_path)) {
+            std::cerr<<"error: socket path "<<socketPath.string()<<" is too long\n";
+            return false;
+        }
+
+        if (ping()) {
+            std::cerr<<"error: another daemon is already listening on "<<socketPath.string()<<"\n";
+            return false;
+        }
+        unlink(socketPath.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un address = getSocketAddress(socketPath);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+            std::cerr<<"error: could not listen on "<<socketPath.string()<<": "<<std::strerror(errno)<<"\n";
+            return false;
+        }
+        chmod(socketPath.c_str(), S_IRUSR | S_IWUSR);
+        return true;
+    }
+
+public:
+
+    SmileDaemon() { }
+
+    ~SmileDaemon() {
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(socketPath.c_str());
+        }
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+    }
+
+    SmileDaemon(const SmileDaemon&) = delete;
+    SmileDaemon& operator=(const SmileDaemon&) = delete;
+
+    /**
+     * @return the socket the daemon listens on: smile.sock in $XDG_RUNTIME_DIR, or in the settings directory when it is not set.
+     */
+    static std::filesystem::path getSocketPath() {
+        const char * runtimeDirectory = getenv("XDG_RUNTIME_DIR");
+        if (runtimeDirectory != nullptr && runtimeDirectory[0] != '\0')
+            return std::filesystem::path(runtimeDirectory) / DAEMON_SOCKET_FILENAME;
+        return std::filesystem::path(getenv("HOME")) / ("." PROJECT_NAME) / DAEMON_SOCKET_FILENAME;
+    }
+
+    /**
+     * Sends a request line to a running daemon.
+     *
+     * @return the lines following the "OK" line of the reply, or nothing if no daemon is running or it did not answer in time.
+     */
+    static std::optional<std::string> request(const std::string& line) {
+        const std::filesystem::path path = getSocketPath();
+        if (path.string().size() >= sizeof(sockaddr_un::sun_path))
+            return std::nullopt;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return std::nullopt;
+
+        struct sockaddr_un address = getSocketAddress(path);
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0) {
+            close(fd);
+            return std::nullopt;
+        }
+        setTimeouts(fd);
+
+        std::string reply;
+        if (writeAll(fd, line + "\n")) {
+            shutdown(fd, SHUT_WR);
+            char buffer[4096];
+            ssize_t bytesRead;
+            while ((bytesRead = read(fd, buffer, sizeof(buffer))) > 0)
+                reply.append(buffer, static_cast<std::size_t>(bytesRead));
+        }
+        close(fd);
+
+        const std::string okLine = DAEMON_REPLY_OK "\n";
+        if (reply.compare(0, okLine.size(), okLine) != 0)
+            return std::nullopt;
+        return reply.substr(okLine.size());
+    }
+
+    /**
+     * @return true if a daemon is listening and answering on the socket.
+     */
+    static bool ping() {
+        return request("").has_value();
+    }
+
+    /**
+     * Asks a running daemon for the suggestions of an input command.
+     *
+     * @param inputCommand the command typed by the user
+     * @param similarCommands where the suggestions are stored
+     * @return true if a daemon answered, false if none is running or it did not answer in time.
+     */
+    static bool query(const std::string& inputCommand, std::vector<std::string>& similarCommands) {
+        if (inputCommand.empty() || inputCommand.find('\n') != std::string::npos)
+            return false;
+
+        const std::optional<std::string> reply = request(inputCommand);
+        if (!reply)
+            return false;
+
+        similarCommands.clear();
+        for (std::size_t start = 0; start < reply->size();) {
+            std::size_t end = reply->find('\n', start);
+            if (end == std::string::npos)
+                break;
+            similarCommands.push_back(reply->substr(start, end - start));
+            start = end + 1;
+        }
+        return true;
+    }
+
+    /**
+     * Loads the settings and the binaries, then serves queries until SIGINT or SIGTERM is received.
+     *
+     * @return the process exit code.
+     */
+    int run() {
+        try {
+            settings = std::make_unique<Settings>();
+        } catch (const std::exception &e) {
+            std::cerr<<"error: "<<e.what()<<"\n";
+            return 1;
+        }
+
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0) {
+            std::cerr<<"error: could not initialize inotify: "<<std::strerror(errno)<<"\n";
+            return 1;
+        }
+
+        settingsWatchDescriptor = inotify_add_watch(inotifyFd, settings->getSettingsDirectoryPathString().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        loadDirectories();
+
+        if (!openSocket())
+            return 1;
+
+        std::signal(SIGINT, requestStop);
+        std::signal(SIGTERM, requestStop);
+        std::signal(SIGPIPE, SIG_IGN);
+
+        Log::info("Listening on {}", socketPath.string());
+
+        while (!stopRequested) {
+            // The missing directories are retried on a timer, the daemon otherwise only waking up for an event
+            int timeout = -1;
+            if (hasUnwatchedDirectories()) {
+                const auto now = std::chrono::steady_clock::now();
+                if (now >= nextDirectoryRetry) {
+                    retryUnwatchedDirectories();
+                    nextDirectoryRetry = now + std::chrono::milliseconds(DAEMON_DIRECTORY_RETRY_MS);
+                }
+                timeout = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(nextDirectoryRetry - now).count());
+            }
+
+            struct pollfd descriptors[2] = {{inotifyFd, POLLIN, 0}, {listenFd, POLLIN, 0}};
+            if (poll(descriptors, 2, timeout) <= 0)
+                continue;
+
+            if (descriptors[0].revents & POLLIN)
+                handleInotifyEvents();
+
+            if (descriptors[1].revents & POLLIN) {
+                int clientFd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (clientFd >= 0) {
+                    handleClient(clientFd);
+                    close(clientFd);
+                }
+            }
+        }
+
+        Log::info("Daemon stopped");
+        return 0;
+    }
+};
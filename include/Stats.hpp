@@ -0,0 +1,147 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <mutex>
+#include <chrono>
+#include <filesystem>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+
+#define STATS_LOG_FILENAME "stats.log"
+
+/**
+ * @class Stats
+ * @brief Stage timings and counters of a single lookup, emitted as one JSON line when --stats is given.
+ *
+ * Recording is disabled by default, in which case spans do not even read the clock. Span and counter names are string
+ * literals, kept in the order they are first recorded; recording a span with an existing name adds to its duration.
+ */
+class Stats {
+
+private:
+
+    bool enabled = false;
+    std::mutex mutex;
+    std::vector<std::pair<std::string_view, double>> spans;
+    std::vector<std::pair<std::string_view, std::uint64_t>> counters;
+
+    template <typename Value>
+    static void addTo(std::vector<std::pair<std::string_view, Value>>& entries, std::string_view name, Value value, bool accumulate) {
+        for (auto& entry : entries) {
+            if (entry.first == name) {
+                entry.second = accumulate ? entry.second + value : value;
+                return;
+            }
+        }
+        entries.emplace_back(name, value);
+    }
+
+public:
+
+    /**
+     * Measures the time between its construction and its destruction, and records it as a span when stats are enabled.
+     */
+    class Span {
+
+    private:
+
+        std::string_view name;
+        bool recording;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+
+        explicit Span(std::string_view name) : name(name), recording(Stats::get().isEnabled()) {
+            if (recording)
+                start = std::chrono::steady_clock::now();
+        }
+
+        ~Span() {
+            if (recording)
+                Stats::get().addSpan(name, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+    };
+
+    static Stats& get() {
+        static Stats stats;
+        return stats;
+    }
+
+    void enable() { enabled = true; }
+
+    bool isEnabled() const { return enabled; }
+
+    /**
+     * @param name the name of the stage, a string literal
+     * @param microseconds the time spent in the stage, added to the previous spans of the same stage
+     */
+    void addSpan(std::string_view name, double microseconds) {
+        if (!enabled)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        addTo(spans, name, microseconds, true);
+    }
+
+    /**
+     * @param name the name of the counter, a string literal
+     * @param value the value of the counter, replacing the previous one
+     */
+    void setCounter(std::string_view name, std::uint64_t value) {
+        if (!enabled)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        addTo(counters, name, value, false);
+    }
+
+    /**
+     * @param inputCommand the command the lookup was for
+     * @return the record of the lookup: time, input command, spans in microseconds and counters.
+     */
+    nlohmann::json toJson(std::string_view inputCommand) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        nlohmann::json record;
+        record["timestamp"] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        record["input"] = inputCommand;
+        record["spans"] = nlohmann::json::object();
+        for (const auto& [name, microseconds] : spans)
+            record["spans"][std::string(name)] = microseconds;
+        record["counters"] = nlohmann::json::object();
+        for (const auto& [name, value] : counters)
+            record["counters"][std::string(name)] = value;
+        return record;
+    }
+
+    /**
+     * Writes the record of the lookup as a single line, to stderr or appended to a log file. The line is written with a
+     * single write on a descriptor opened in append mode, so that records of concurrent shells are never interleaved.
+     *
+     * @param inputCommand the command the lookup was for
+     * @param logFilePath the log to append the record to, or an empty path for stderr
+     * @return true if the record was written.
+     */
+    bool emit(std::string_view inputCommand, const std::filesystem::path& logFilePath) {
+        const std::string line = toJson(inputCommand).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "\n";
+
+        if (logFilePath.empty()) {
+            std::cerr<<line;
+            return true;
+        }
+
+        int fd = open(logFilePath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        const bool written = write(fd, line.data(), line.size()) == static_cast<ssize_t>(line.size());
+        close(fd);
+        return written;
+    }
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <memory_resource>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+
+/**
+ * @class SuggestionSelector
+ * @brief Bounded selection of the closest binaries seen during a scan, exposing the distance cutoff the rest of the scan
+ * can use to abandon the binaries that cannot be selected anymore.
+ *
+ * A binary is selected when it is at the minimum distance found so far, or farther by at most the margin, and within the
+ * maximum edit distance. When a maximum number of results is set the selected binaries are kept in a max-heap on their
+ * distance then identifier, so that a closer binary replaces the farthest one and, once the heap is full, only binaries
+ * strictly closer than the farthest one can still be selected. When the binaries are offered by increasing identifier, as
+ * in a linear scan, the binaries tied at the largest distance that are kept are therefore always the ones with the lowest
+ * identifiers; in any other order, as in a BK-tree walk, which of them are kept depends on the order, so such walks keep
+ * the ties with getSharedCutoff and select the binaries again by increasing identifier.
+ *
+ * The cutoff only ever decreases. The scan is complete as soon as the cutoff drops below the lowest distance a binary not
+ * yet seen can have: names are unique, so once the exact match is found, or known to be missing, that distance is 1.
+ */
+class SuggestionSelector {
+
+public:
+
+    struct Match {
+        std::uint32_t nameId;
+        int distance;
+    };
+
+private:
+
+    std::pmr::vector<Match> matches;
+    int maxDistance;
+    std::size_t maxResults;
+    int margin;
+    int lowestRemainingDistance;
+    int minimumDistance = INT_MAX;
+
+    static bool isCloser(const Match& first, const Match& second) {
+        return first.distance != second.distance ? first.distance < second.distance : first.nameId < second.nameId;
+    }
+
+public:
+
+    /**
+     * @param maxDistance the highest distance a selected binary can have, a negative value for no maximum
+     * @param maxResults the maximum number of selected binaries, 0 for no maximum
+     * @param margin how much farther than the closest binaries the selected ones can be
+     * @param exactMatchRuledOut true when the caller already knows that no binary is at distance 0
+     * @param resource where the selected binaries are allocated
+     */
+    SuggestionSelector(int maxDistance, std::size_t maxResults, int margin, bool exactMatchRuledOut, std::pmr::memory_resource * resource = std::pmr::get_default_resource())
+        : matches(resource), maxDistance(maxDistance < 0 ? INT_MAX / 2 : maxDistance), maxResults(maxResults), margin(std::max(margin, 0)),
+        lowestRemainingDistance(exactMatchRuledOut ? 1 : 0) { }
+
+    /**
+     * @return the highest distance a binary can have to be selected, or -1 when no binary left to scan can be selected.
+     */
+    int getCutoff() const {
+        int cutoff = maxDistance;
+        if (minimumDistance != INT_MAX)
+            cutoff = std::min(cutoff, minimumDistance + margin);
+        if (maxResults > 0 && matches.size() == maxResults)
+            cutoff = std::min(cutoff, matches.front().distance - 1);
+        return cutoff < lowestRemainingDistance ? -1 : cutoff;
+    }
+
+    /**
+     * Bound another selector, scanning other binaries in parallel, can use: unlike the cutoff it keeps the binaries tied
+     * with the farthest selected one, which the other selector may have to keep if their identifiers are lower.
+     *
+     * @return the highest distance a binary not offered to this selector can have to be in the final selection.
+     */
+    int getSharedCutoff() const {
+        int cutoff = maxDistance;
+        if (minimumDistance != INT_MAX)
+            cutoff = std::min(cutoff, minimumDistance + margin);
+        if (maxResults > 0 && matches.size() == maxResults)
+            cutoff = std::min(cutoff, matches.front().distance);
+        return cutoff;
+    }
+
+    bool isComplete() const { return getCutoff() < 0; }
+
+    /**
+     * Offers a binary to the selection, ignored if it is farther than the cutoff.
+     */
+    void add(const Match& match) {
+        if (match.distance > getCutoff())
+            return;
+
+        if (match.distance == 0)
+            lowestRemainingDistance = 1;
+
+        if (match.distance < minimumDistance) {
+            minimumDistance = match.distance;
+            const int farthestDistance = minimumDistance + margin;
+            if (std::erase_if(matches, [farthestDistance](const Match& selected) { return selected.distance > farthestDistance; }) > 0)
+                std::make_heap(matches.begin(), matches.end(), isCloser);
+        }
+
+        if (maxResults > 0 && matches.size() == maxResults) {
+            std::pop_heap(matches.begin(), matches.end(), isCloser);
+            matches.pop_back();
+        }
+        matches.push_back(match);
+        std::push_heap(matches.begin(), matches.end(), isCloser);
+    }
+
+    /**
+     * @return the selected binaries, closest first.
+     */
+    std::pmr::vector<Match> takeMatches() {
+        std::sort_heap(matches.begin(), matches.end(), isCloser);
+        return std::move(matches);
+    }
+};
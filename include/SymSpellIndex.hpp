@@ -0,0 +1,453 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <memory_resource>
+#include <algorithm>
+#include <bit>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Log.hpp"
+#include "CandidateStore.hpp"
+#include "WordDistanceHandler.hpp"
+#include "SuggestionSelector.hpp"
+
+#define SYM_SPELL_INDEX_MAGIC "SMILESYM"
+#define SYM_SPELL_INDEX_VERSION 1
+// Only the deletes of the first characters of the names are indexed, which bounds the number of deletes of long names
+#define SYM_SPELL_PREFIX_LENGTH 7
+// Highest number of deleted characters the index can be built for
+#define SYM_SPELL_MAX_DISTANCE_LIMIT 3
+
+/**
+ * @class SymSpellIndex
+ * @brief Symmetric delete dictionary (SymSpell) mapping the strings obtained by deleting characters from the binary names
+ * to the names they come from, used to find the binaries within a small distance of the input command by probing a few
+ * hash table slots instead of walking all of them.
+ *
+ * Two words are within distance d of each other only if deleting at most d characters from each of them gives the same
+ * string (a substitution or a transposition deletes from both, an insertion from one), and this still holds for their
+ * prefixes of SYM_SPELL_PREFIX_LENGTH characters. Every string obtained by deleting up to maxDistance characters from the
+ * prefix of every name is hashed into an open addressing table whose slots point to the sorted positions, in the
+ * CandidateStore, of the names it was obtained from. A query probes the table with the hashes of its own deletes, and the
+ * distance is only computed for the names found. Neither the strings nor the hashes are compared: a collision only adds
+ * names to verify.
+ *
+ * The index is persisted next to the BinaryIndex, tagged with its fingerprint, together with the names it was built from.
+ * The file is memory mapped and used in place, so that a lookup only reads the slots and postings it probes however large
+ * the table is. When the binaries change, the postings of the names still present are remapped to their new positions and only the
+ * deletes of the new names are computed.
+ */
+class SymSpellIndex {
+
+public:
+
+    struct Slot {
+        std::uint64_t hash;
+        std::uint32_t firstPosting;
+        // 0 for an empty slot
+        std::uint32_t postingCount;
+    };
+
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t maxDistance;
+        std::uint32_t prefixLength;
+        std::uint32_t nameCount;
+        std::uint64_t slotCount;
+        std::uint64_t postingCount;
+        std::uint64_t namePoolSize;
+        std::uint64_t indexFingerprint;
+    };
+
+    using Match = SuggestionSelector::Match;
+
+    struct SearchResult {
+        std::pmr::vector<Match> matches;
+        std::size_t verifiedNames = 0;
+        // False when binaries farther than the indexed distance could still be selected, the lookup must then be done
+        // with another engine
+        bool complete = false;
+    };
+
+private:
+
+    // Power of two number of slots, at most two thirds of them used
+    std::span<const Slot> slots;
+    std::span<const std::uint32_t> postings;
+    // The names the index was built from, in store order, to remap the postings when the binaries change
+    std::span<const std::uint32_t> nameLengths;
+    std::string_view namePool;
+    int maxDistance = 0;
+    std::uint64_t indexFingerprint = 0;
+
+    // The tables point either into the mapping of the index file, or into these arrays for an index built in memory
+    const std::byte * mapping = nullptr;
+    std::size_t mappingSize = 0;
+    std::vector<Slot> builtSlots;
+    std::vector<std::uint32_t> builtPostings;
+    std::vector<std::uint32_t> builtNameLengths;
+    std::string builtNamePool;
+
+    void unmap() {
+        if (mapping != nullptr)
+            munmap(const_cast<std::byte *>(mapping), mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+
+    /**
+     * FNV-1a hash of the characters of the prefix whose bit is not set in the deletion mask.
+     */
+    static std::uint64_t hashDelete(std::string_view prefix, unsigned deletionMask) {
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < prefix.size(); ++i) {
+            if (deletionMask & (1U << i))
+                continue;
+            hash ^= static_cast<unsigned char>(prefix[i]);
+            hash *= 1099511628211ULL;
+        }
+        // The length is mixed in, so that the deletes of different lengths spread over the table
+        return hash ^ (prefix.size() - static_cast<std::size_t>(std::popcount(deletionMask)));
+    }
+
+    /**
+     * Appends the hashes of the prefix of the word and of every string obtained by deleting up to maxDeletes of its
+     * characters, the prefix being short enough for the deleted characters to be enumerated as bit masks.
+     */
+    template <typename HashVector>
+    static void computeDeletes(std::string_view word, int maxDeletes, HashVector& hashes) {
+        const std::string_view prefix = word.substr(0, std::min<std::size_t>(word.size(), SYM_SPELL_PREFIX_LENGTH));
+        const std::size_t firstHash = hashes.size();
+        for (unsigned deletionMask = 0; deletionMask < (1U << prefix.size()); ++deletionMask)
+            if (std::popcount(deletionMask) <= maxDeletes)
+                hashes.push_back(hashDelete(prefix, deletionMask));
+
+        // Deleting either of two equal characters gives the same string
+        std::sort(hashes.begin() + static_cast<std::ptrdiff_t>(firstHash), hashes.end());
+        hashes.erase(std::unique(hashes.begin() + static_cast<std::ptrdiff_t>(firstHash), hashes.end()), hashes.end());
+    }
+
+    std::size_t getHomeSlot(std::uint64_t hash) const {
+        return static_cast<std::size_t>((hash ^ (hash >> 29)) & (slots.size() - 1));
+    }
+
+    const Slot * findSlot(std::uint64_t hash) const {
+        if (slots.empty())
+            return nullptr;
+
+        for (std::size_t i = getHomeSlot(hash); slots[i].postingCount != 0; i = (i + 1) & (slots.size() - 1))
+            if (slots[i].hash == hash)
+                return &slots[i];
+        return nullptr;
+    }
+
+    /**
+     * Builds the table from (hash, position) pairs, which are sorted in place.
+     */
+    void buildTable(std::vector<std::pair<std::uint64_t, std::uint32_t>>& deletes) {
+        std::sort(deletes.begin(), deletes.end());
+        deletes.erase(std::unique(deletes.begin(), deletes.end()), deletes.end());
+
+        std::size_t hashCount = 0;
+        for (std::size_t i = 0; i < deletes.size(); ++i)
+            if (i == 0 || deletes[i].first != deletes[i - 1].first)
+                ++hashCount;
+
+        builtSlots.assign(std::bit_ceil(std::max<std::size_t>(hashCount + hashCount / 2, 2)), Slot{});
+        builtPostings.clear();
+        builtPostings.reserve(deletes.size());
+        slots = builtSlots;
+
+        for (std::size_t first = 0; first < deletes.size();) {
+            std::size_t last = first;
+            while (last < deletes.size() && deletes[last].first == deletes[first].first)
+                builtPostings.push_back(deletes[last++].second);
+
+            std::size_t i = getHomeSlot(deletes[first].first);
+            while (builtSlots[i].postingCount != 0)
+                i = (i + 1) & (builtSlots.size() - 1);
+            builtSlots[i] = Slot{deletes[first].first, static_cast<std::uint32_t>(builtPostings.size() - (last - first)), static_cast<std::uint32_t>(last - first)};
+            first = last;
+        }
+        postings = builtPostings;
+    }
+
+    void storeNames(const CandidateStore& candidates) {
+        builtNameLengths.clear();
+        builtNamePool.clear();
+        builtNameLengths.reserve(candidates.size());
+        for (std::string_view name : candidates.getNames()) {
+            builtNameLengths.push_back(static_cast<std::uint32_t>(name.size()));
+            builtNamePool.append(name);
+        }
+        nameLengths = builtNameLengths;
+        namePool = builtNamePool;
+    }
+
+    /**
+     * Rebuilds the table of the previously loaded index for the names of the store: the postings of the names still
+     * present are moved to their new positions, those of the removed names are dropped, and only the deletes of the new
+     * names are computed.
+     */
+    void update(const CandidateStore& candidates, std::uint64_t fingerprint) {
+        std::vector<std::uint32_t> newPositions(nameLengths.size());
+        std::vector<bool> indexed(candidates.size(), false);
+        std::size_t nameOffset = 0;
+        for (std::size_t i = 0; i < nameLengths.size(); ++i) {
+            newPositions[i] = candidates.find(namePool.substr(std::min(nameOffset, namePool.size()), nameLengths[i]));
+            if (newPositions[i] < candidates.size())
+                indexed[newPositions[i]] = true;
+            nameOffset += nameLengths[i];
+        }
+
+        std::vector<std::pair<std::uint64_t, std::uint32_t>> deletes;
+        deletes.reserve(postings.size());
+        for (const Slot& slot : slots) {
+            for (std::uint64_t i = slot.firstPosting; i < std::min<std::uint64_t>(slot.firstPosting + slot.postingCount, postings.size()); ++i) {
+                const std::uint32_t position = postings[i] < newPositions.size() ? newPositions[postings[i]] : static_cast<std::uint32_t>(candidates.size());
+                if (position < candidates.size())
+                    deletes.emplace_back(slot.hash, position);
+            }
+        }
+
+        std::size_t addedNames = 0;
+        std::vector<std::uint64_t> hashes;
+        for (std::uint32_t position = 0; position < candidates.size(); ++position) {
+            if (indexed[position])
+                continue;
+            hashes.clear();
+            computeDeletes(candidates.getName(position), maxDistance, hashes);
+            for (std::uint64_t hash : hashes)
+                deletes.emplace_back(hash, position);
+            ++addedNames;
+        }
+
+        buildTable(deletes);
+        storeNames(candidates);
+        unmap();
+        indexFingerprint = fingerprint;
+        Log::info("Updated SymSpell index, {} of {} names added", addedNames, candidates.size());
+    }
+
+public:
+
+    SymSpellIndex() { }
+
+    ~SymSpellIndex() { unmap(); }
+
+    SymSpellIndex(const SymSpellIndex&) = delete;
+    SymSpellIndex& operator=(const SymSpellIndex&) = delete;
+
+    /**
+     * Builds the table of the deletes of every name of the store.
+     *
+     * @param candidates the names to index, the positions stored in the table are their positions in the store
+     * @param fingerprint the fingerprint of the BinaryIndex the names come from
+     * @param maxDeletes the highest number of characters deleted from the names, capped at SYM_SPELL_MAX_DISTANCE_LIMIT
+     */
+    void build(const CandidateStore& candidates, std::uint64_t fingerprint, int maxDeletes) {
+        maxDistance = std::clamp(maxDeletes, 0, SYM_SPELL_MAX_DISTANCE_LIMIT);
+
+        std::vector<std::pair<std::uint64_t, std::uint32_t>> deletes;
+        std::vector<std::uint64_t> hashes;
+        for (std::uint32_t position = 0; position < candidates.size(); ++position) {
+            hashes.clear();
+            computeDeletes(candidates.getName(position), maxDistance, hashes);
+            for (std::uint64_t hash : hashes)
+                deletes.emplace_back(hash, position);
+        }
+
+        buildTable(deletes);
+        storeNames(candidates);
+        unmap();
+        indexFingerprint = fingerprint;
+        Log::info("Built SymSpell index of {} postings over {} slots", postings.size(), slots.size());
+    }
+
+    /**
+     * Maps an index previously saved with save, whatever the BinaryIndex it was built from.
+     *
+     * @return true if the index was mapped, false if the file is missing or invalid.
+     */
+    bool load(const std::filesystem::path& indexFilePath) {
+        int fd = open(indexFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct stat status;
+        if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(FileHeader)) {
+            close(fd);
+            return false;
+        }
+
+        void * fileMapping = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (fileMapping == MAP_FAILED)
+            return false;
+
+        const std::byte * data = static_cast<const std::byte *>(fileMapping);
+        const std::size_t dataSize = static_cast<std::size_t>(status.st_size);
+        const FileHeader * header = reinterpret_cast<const FileHeader *>(data);
+        const std::uint64_t postingsOffset = sizeof(FileHeader) + header->slotCount * sizeof(Slot);
+        const std::uint64_t nameLengthsOffset = postingsOffset + header->postingCount * sizeof(std::uint32_t);
+        const std::uint64_t namePoolOffset = nameLengthsOffset + std::uint64_t{header->nameCount} * sizeof(std::uint32_t);
+
+        if (std::memcmp(header->magic, SYM_SPELL_INDEX_MAGIC, sizeof(header->magic)) != 0
+            || header->version != SYM_SPELL_INDEX_VERSION
+            || header->prefixLength != SYM_SPELL_PREFIX_LENGTH
+            || header->maxDistance > SYM_SPELL_MAX_DISTANCE_LIMIT
+            || !std::has_single_bit(header->slotCount)
+            || header->slotCount > dataSize || header->postingCount > dataSize || header->nameCount > dataSize
+            || namePoolOffset + header->namePoolSize != dataSize) {
+            munmap(fileMapping, dataSize);
+            return false;
+        }
+
+        unmap();
+        mapping = data;
+        mappingSize = dataSize;
+        slots = std::span<const Slot>(reinterpret_cast<const Slot *>(data + sizeof(FileHeader)), header->slotCount);
+        postings = std::span<const std::uint32_t>(reinterpret_cast<const std::uint32_t *>(data + postingsOffset), header->postingCount);
+        nameLengths = std::span<const std::uint32_t>(reinterpret_cast<const std::uint32_t *>(data + nameLengthsOffset), header->nameCount);
+        namePool = std::string_view(reinterpret_cast<const char *>(data + namePoolOffset), header->namePoolSize);
+        maxDistance = static_cast<int>(header->maxDistance);
+        indexFingerprint = header->indexFingerprint;
+        return true;
+    }
+
+    /**
+     * Saves the index, tagged with the fingerprint of the BinaryIndex it was built from. The file is written next to its
+     * final location and renamed, so that concurrent shells never load a partial index.
+     */
+    bool save(const std::filesystem::path& indexFilePath) const {
+        FileHeader header{};
+        std::memcpy(header.magic, SYM_SPELL_INDEX_MAGIC, sizeof(header.magic));
+        header.version = SYM_SPELL_INDEX_VERSION;
+        header.maxDistance = static_cast<std::uint32_t>(maxDistance);
+        header.prefixLength = SYM_SPELL_PREFIX_LENGTH;
+        header.nameCount = static_cast<std::uint32_t>(nameLengths.size());
+        header.slotCount = slots.size();
+        header.postingCount = postings.size();
+        header.namePoolSize = namePool.size();
+        header.indexFingerprint = indexFingerprint;
+
+        std::filesystem::path temporaryPath = indexFilePath.string() + ".tmp." + std::to_string(getpid());
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return false;
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char *>(slots.data()), static_cast<std::streamsize>(slots.size() * sizeof(Slot)));
+            file.write(reinterpret_cast<const char *>(postings.data()), static_cast<std::streamsize>(postings.size() * sizeof(std::uint32_t)));
+            file.write(reinterpret_cast<const char *>(nameLengths.data()), static_cast<std::streamsize>(nameLengths.size() * sizeof(std::uint32_t)));
+            file.write(namePool.data(), static_cast<std::streamsize>(namePool.size()));
+            if (!file.good())
+                return false;
+        }
+
+        std::error_code errorCode;
+        std::filesystem::rename(temporaryPath, indexFilePath, errorCode);
+        if (errorCode) {
+            std::filesystem::remove(temporaryPath, errorCode);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Loads the index saved for the given state of the BinaryIndex. An index saved for another state with the same
+     * distance is updated for the current binaries, and an index is built from scratch otherwise. The index is saved
+     * whenever it changed.
+     */
+    void loadOrBuild(const CandidateStore& candidates, std::uint64_t fingerprint, int maxDeletes, const std::filesystem::path& indexFilePath) {
+        maxDeletes = std::clamp(maxDeletes, 0, SYM_SPELL_MAX_DISTANCE_LIMIT);
+        const bool loaded = load(indexFilePath) && maxDistance == maxDeletes;
+        if (loaded && indexFingerprint == fingerprint && nameLengths.size() == candidates.size()) {
+            Log::info("Loaded SymSpell index of {} postings from {}", postings.size(), indexFilePath.string());
+            return;
+        }
+
+        if (loaded)
+            update(candidates, fingerprint);
+        else
+            build(candidates, fingerprint, maxDeletes);
+        if (!save(indexFilePath))
+            Log::warn("Could not save the SymSpell index in {}", indexFilePath.string());
+    }
+
+    /**
+     * Finds the binaries accepted by the predicate closest to the query among the names sharing a delete with it, which
+     * are all the names within the indexed distance. The distance is computed for those names only, by increasing position,
+     * with the cutoff of a SuggestionSelector.
+     *
+     * @param candidates the store the index was built from
+     * @param query the input command
+     * @param maxDistance the highest distance of the binaries to find, a negative value for no maximum
+     * @param maxResults the maximum number of binaries to find, 0 for no maximum
+     * @param margin how much farther than the closest binaries the returned ones can be
+     * @param accept predicate on the position of the binary in the store, false to leave it out of the results
+     * @param resource where the matches and the temporary arrays of the lookup are allocated
+     * @return the matches, closest first, the number of names whose distance was computed, and whether the matches are
+     * the ones a scan of every binary would have selected.
+     */
+    template <typename AcceptPredicate>
+    SearchResult findBest(const CandidateStore& candidates, std::string_view query, int maxDistance, std::size_t maxResults, int margin, AcceptPredicate accept, std::pmr::memory_resource * resource = std::pmr::get_default_resource()) const {
+        std::pmr::vector<std::uint64_t> hashes(resource);
+        computeDeletes(query, this->maxDistance, hashes);
+
+        std::pmr::vector<std::uint32_t> positions(resource);
+        for (std::uint64_t hash : hashes) {
+            if (const Slot * slot = findSlot(hash)) {
+                const std::span<const std::uint32_t> slotPostings = postings.subspan(std::min<std::size_t>(slot->firstPosting, postings.size()));
+                positions.insert(positions.end(), slotPostings.begin(), slotPostings.begin() + std::min<std::ptrdiff_t>(slot->postingCount, std::ssize(slotPostings)));
+            }
+        }
+        std::sort(positions.begin(), positions.end());
+        positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+        const std::uint32_t exactMatch = candidates.find(query);
+        const bool exactMatchRuledOut = exactMatch == candidates.size() || !accept(exactMatch);
+        SuggestionSelector selector(maxDistance, maxResults, margin, exactMatchRuledOut, resource);
+
+        const bool bitParallel = WordDistanceHandler::isBitParallelEligible(query);
+        const WordDistanceHandler::QueryPattern pattern = bitParallel ? WordDistanceHandler::buildQueryPattern(query) : WordDistanceHandler::QueryPattern{};
+
+        SearchResult result{std::pmr::vector<Match>(resource)};
+        for (std::uint32_t position : positions) {
+            if (!accept(position))
+                continue;
+
+            // Names farther than the indexed distance may have been found through a collision, and are left out so that
+            // the names not found cannot be missed
+            const int cutoff = std::min(selector.getCutoff(), this->maxDistance);
+            if (cutoff < 0)
+                break;
+
+            ++result.verifiedNames;
+            const std::string_view name = candidates.getName(position);
+            const int distance = bitParallel
+                ? WordDistanceHandler::calculateWordDistance(pattern, name, cutoff)
+                : WordDistanceHandler::calculateWordDistance(query, name, cutoff);
+            if (distance <= cutoff)
+                selector.add({position, distance});
+        }
+
+        result.complete = selector.getSharedCutoff() <= this->maxDistance;
+        result.matches = selector.takeMatches();
+        return result;
+    }
+
+    int getMaxDistance() const { return maxDistance; }
+
+    std::size_t size() const { return postings.size(); }
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <exception>
+#include "Log.hpp"
+
+/**
+ * @class ThreadPool
+ * @brief Small fixed-size pool of worker threads executing tasks from a shared queue.
+ *
+ * Tasks may submit further tasks (e.g. a directory scan submitting its subdirectories), and wait returns only when the
+ * queue is empty and no task is running anymore. The queue keeps its storage once drained, so that a pool reused from
+ * one batch of tasks to the next no longer allocates for them.
+ */
+class ThreadPool {
+
+private:
+
+    std::vector<std::thread> workers;
+    std::vector<std::function<void()>> tasks;
+    // Index of the next task to run in tasks
+    std::size_t nextTask = 0;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable allTasksDone;
+    std::size_t unfinishedTasks = 0;
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                taskAvailable.wait(lock, [this]() { return stopping || nextTask < tasks.size(); });
+                if (nextTask == tasks.size())
+                    return;
+                task = std::move(tasks[nextTask++]);
+                if (nextTask == tasks.size()) {
+                    tasks.clear();
+                    nextTask = 0;
+                }
+            }
+
+            try {
+                task();
+            } catch (const std::exception &e) {
+                Log::error("Error in worker thread: {}", e.what());
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--unfinishedTasks == 0)
+                allTasksDone.notify_all();
+        }
+    }
+
+public:
+
+    /**
+     * @param threadCount the number of worker threads, at least one is always started.
+     */
+    explicit ThreadPool(std::size_t threadCount) {
+        threadCount = std::max<std::size_t>(threadCount, 1);
+        workers.reserve(threadCount);
+        // Room for a task per worker, whatever the order in which the first ones were run
+        tasks.reserve(threadCount);
+        for (std::size_t i = 0; i < threadCount; ++i)
+            workers.emplace_back([this]() { workerLoop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t size() const { return workers.size(); }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+            ++unfinishedTasks;
+        }
+        taskAvailable.notify_one();
+    }
+
+    /**
+     * Blocks until every submitted task, including the ones submitted by other tasks, has completed.
+     */
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        allTasksDone.wait(lock, [this]() { return unfinishedTasks == 0; });
+    }
+
+    /**
+     * @param maxThreads upper bound, usually the amount of independent work available.
+     * @return the number of threads to use: the number of cores, capped at maxThreads.
+     */
+    static std::size_t getThreadCount(std::size_t maxThreads) {
+        std::size_t cores = std::thread::hardware_concurrency();
+        return std::clamp<std::size_t>(cores == 0 ? 1 : cores, 1, std::max<std::size_t>(maxThreads, 1));
+    }
+};
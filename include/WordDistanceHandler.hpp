@@ -1,15 +1,165 @@
+#pragma once
+
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
-#include <map>
+#include <cstdlib>
+#include <cstdint>
+#include <array>
+#include <atomic>
+
 
+#define BIT_PARALLEL_MAX_LENGTH 64
+// Distance tables of up to this many cells are kept on the stack of the kernel
+#define WORD_DISTANCE_STACK_CELLS 8192
+// Longest words handled by the length-specialized unrestricted distance kernels, which only the BK-tree engine runs
+#define UNRESTRICTED_KERNEL_MAX_LENGTH 64
 
 class WordDistanceHandler {
 
+public:
+
+    /**
+     * Match masks of a query, computed once and reused against every candidate: bit i of matchMasks[c] is set when the
+     * i-th character of the query is c.
+     */
+    struct QueryPattern {
+        std::array<std::uint64_t, 256> matchMasks{};
+        int length = 0;
+    };
+
+    /**
+     * Counters of the distances computed since the start of the process. A cell is one entry of the distance table, the
+     * bit-parallel kernel counting the whole column it advances for each character of the candidate.
+     */
+    struct DistanceCounters {
+        std::atomic<std::uint64_t> distanceComputations{0};
+        std::atomic<std::uint64_t> cellsComputed{0};
+    };
+
+    static DistanceCounters& getDistanceCounters() {
+        static DistanceCounters distanceCounters;
+        return distanceCounters;
+    }
+
 private:
 
     /**
-     * This Damerau-Leveshtein word distance implementation follows the pseudocode found in this website https://hyperskill.org/learn/step/18819
+     * Adds the cells computed by a kernel to the counters when the kernel returns, whatever the return point.
+     */
+    struct CellCount {
+        std::uint64_t cells = 0;
+
+        ~CellCount() {
+            DistanceCounters& counters = getDistanceCounters();
+            counters.distanceComputations.fetch_add(1, std::memory_order_relaxed);
+            counters.cellsComputed.fetch_add(cells, std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * Returns where a kernel can lay out a table of the given number of cells: the stack array of the kernel when it is large
+     * enough, so that scoring does not allocate, otherwise a buffer reused by the thread for the longer words.
+     */
+    static int * getTable(std::array<int, WORD_DISTANCE_STACK_CELLS>& stackTable, std::size_t tableSize) {
+        if (tableSize <= stackTable.size())
+            return stackTable.data();
+
+        thread_local std::vector<int> heapTable;
+        if (heapTable.size() < tableSize)
+            heapTable.resize(tableSize);
+        return heapTable.data();
+    }
+
+    /**
+     * Kernel of calculateUnrestrictedWordDistance specialized for words of at most MaxLength characters.
+     *
+     * Every size is known at compile time: the table is a stack array of 16 bits cells (distances cannot exceed twice the
+     * length class), the second word is copied in a padded array, and each row is computed in two passes. The first one
+     * takes the substitution and deletion costs from the previous row over the whole length class, without any dependency
+     * between the cells, so that it is unrolled and vectorized. The second one walks the row once to add the insertion cost,
+     * the only one depending on the cell on the left, and the transpositions, only looked up once the current character of
+     * the first word was found earlier in the second one. The cells past the end of the second word are kept initialized, so
+     * that the first pass never reads an undefined cell.
+     */
+    template <int MaxLength>
+    static int calculateUnrestrictedDistance(std::string_view word1, std::string_view word2) {
+        static_assert(MaxLength > 0 && MaxLength <= 127, "the cells and the rows of the characters are stored in 16 and 8 bits");
+        using Cell = std::int16_t;
+        constexpr std::size_t rowSize = MaxLength + 2;
+        static constexpr std::array<Cell, rowSize> emptyWordDistances = []() {
+            std::array<Cell, rowSize> distances{};
+            for (std::size_t i = 0; i < rowSize; ++i)
+                distances[i] = static_cast<Cell>(i);
+            return distances;
+        }();
+
+        const int word1Length = static_cast<int>(word1.size());
+        const int word2Length = static_cast<int>(word2.size());
+
+        CellCount cellCount;
+
+        if (word1Length == 0) return word2Length;
+        if (word2Length == 0) return word1Length;
+
+        cellCount.cells = static_cast<std::uint64_t>(word1Length) * static_cast<std::uint64_t>(word2Length);
+        const Cell infinity = static_cast<Cell>(word1Length + word2Length);
+
+        std::array<char, MaxLength> paddedWord2{};
+        std::copy_n(word2.begin(), word2Length, paddedWord2.begin());
+
+        // table[(i + 1) * rowSize + (j + 1)] holds the distance between the first i characters of word1 and the first j of word2
+        std::array<Cell, rowSize * rowSize> table;
+        std::array<std::uint8_t, 256> lastRowOfCharacter{};
+        std::array<Cell, MaxLength> substitutionsAndDeletions;
+
+        std::fill_n(table.begin(), rowSize, infinity);
+        table[rowSize] = infinity;
+        std::copy_n(emptyWordDistances.begin(), rowSize - 1, table.begin() + rowSize + 1);
+
+        for (int i = 1; i <= word1Length; ++i) {
+            Cell * row = table.data() + static_cast<std::size_t>(i + 1) * rowSize;
+            const Cell * previousRow = row - rowSize;
+            const char word1Character = word1[static_cast<std::size_t>(i) - 1];
+
+            for (std::size_t j = 0; j < MaxLength; ++j) {
+                const Cell substitution = static_cast<Cell>(previousRow[j + 1] + (paddedWord2[j] != word1Character));
+                const Cell deletion = static_cast<Cell>(previousRow[j + 2] + 1);
+                substitutionsAndDeletions[j] = std::min(substitution, deletion);
+            }
+
+            row[0] = infinity;
+            row[1] = emptyWordDistances[static_cast<std::size_t>(i)];
+            int left = i;
+            int lastMatchingColumn = 0;
+            for (int j = 1; j <= word2Length; ++j) {
+                const char word2Character = paddedWord2[static_cast<std::size_t>(j) - 1];
+                int distance = std::min<int>(substitutionsAndDeletions[static_cast<std::size_t>(j) - 1], left + 1);
+
+                if (lastMatchingColumn > 0) {
+                    const int transpositionRow = lastRowOfCharacter[static_cast<unsigned char>(word2Character)];
+                    if (transpositionRow > 0) {
+                        distance = std::min(distance, table[static_cast<std::size_t>(transpositionRow) * rowSize + static_cast<std::size_t>(lastMatchingColumn)]
+                            + (i - transpositionRow - 1) + 1 + (j - lastMatchingColumn - 1));
+                    }
+                }
+                if (word2Character == word1Character)
+                    lastMatchingColumn = j;
+
+                row[j + 1] = static_cast<Cell>(distance);
+                left = distance;
+            }
+            std::fill(row + word2Length + 2, row + rowSize, infinity);
+            lastRowOfCharacter[static_cast<unsigned char>(word1Character)] = static_cast<std::uint8_t>(i);
+        }
+
+        return table[static_cast<std::size_t>(word1Length + 1) * rowSize + static_cast<std::size_t>(word2Length) + 1];
+    }
+
+    /**
+     * This Damerau-Leveshtein word distance implementation computes the optimal string alignment (OSA) variant, following
+     * the recurrence found in this website https://hyperskill.org/learn/step/18819
      * The distance of two strings a and b, is defined using indices i and j to traverse them, and is calculated with the function d(i,j)
      * which is the minimum of the following values:
      * - 0                      if i == 0 and j == 0
@@ -18,42 +168,132 @@ private:
      * - d(i-1, j-1)            if i,j > 0 and a[i] == b[j]
      * - d(i-1, j-1) + 1        if i,j > 0 and a[i] != b[j]
      * - d(i-2, j-2) + 1        if i,j > 0 and a[i] == b[j-1] and a[i-1] == b[j]
-     * 
+     *
+     * Instead of recursing, the table is filled row by row keeping only the last three rows (the transposition looks two rows back).
+     * Since a cell can never be smaller than the difference of its indices, only the cells in the diagonal band |i - j| <= maxDistance
+     * are computed (Ukkonen's cutoff), and as soon as a whole row exceeds maxDistance the computation stops: no later row can go back
+     * under the cutoff.
+     *
      * @param word1 The first string.
      * @param word2 The second string.
-     * @param word1Index The current index in word1.
-     * @param word2Index The current index in word2.
+     * @param maxDistance The highest distance the caller is interested in, a negative value disables the cutoff.
      *
-     * @returns The distance (integer) between the two words: 0 if they are identical, and greater than 0 if they differ.
+     * @returns The distance (integer) between the two words if it is lower or equal to maxDistance, maxDistance + 1 otherwise.
      */
-    static int calculateDistance(std::string word1, std::string word2, int word1Index, int word2Index) {
-        std::vector<int> results;
+    static int calculateDistance(std::string_view word1, std::string_view word2, int maxDistance) {
+        const int word1Length = static_cast<int>(word1.size());
+        const int word2Length = static_cast<int>(word2.size());
 
-        if (word1Index == 0) return word2Index;
-        if (word2Index == 0) return word1Index;
+        if (maxDistance < 0 || maxDistance > std::max(word1Length, word2Length))
+            maxDistance = std::max(word1Length, word2Length);
 
-        if (word1Index > 0) {
-            results.push_back(calculateDistance(word1, word2, word1Index-1 , word2Index) + 1);
-        }
+        const int outOfBand = maxDistance + 1;
+        CellCount cellCount;
 
-        if (word2Index > 0) {
-            results.push_back(calculateDistance(word1, word2, word1Index , word2Index-1) + 1);
-        }
+        if (std::abs(word1Length - word2Length) > maxDistance) return outOfBand;
+        if (word1Length == 0) return word2Length;
+        if (word2Length == 0) return word1Length;
 
-        if (word1Index > 0 && word2Index > 0 && word1[word1Index-1] == word2[word2Index-1]) {
-            results.push_back(calculateDistance(word1, word2, word1Index-1 , word2Index-1));
-        }
+        const std::size_t rowSize = static_cast<std::size_t>(word2Length) + 2;
+        std::array<int, WORD_DISTANCE_STACK_CELLS> stackTable;
+        int * twoRowsBefore = getTable(stackTable, rowSize * 3);
+        int * previousRow = twoRowsBefore + rowSize;
+        int * currentRow = previousRow + rowSize;
 
-        if (word1Index > 0 && word2Index > 0 && word1[word1Index-1] != word2[word2Index-1]) {
-            results.push_back(calculateDistance(word1, word2, word1Index-1 , word2Index-1) + 1);
+        for (int j = 0; j <= word2Length + 1; ++j)
+            previousRow[j] = j <= maxDistance ? j : outOfBand;
+
+        for (int i = 1; i <= word1Length; ++i) {
+            const int bandStart = std::max(1, i - maxDistance);
+            const int bandEnd = std::min(word2Length, i + maxDistance);
+
+            currentRow[bandStart - 1] = bandStart == 1 && i <= maxDistance ? i : outOfBand;
+            int rowMinimum = currentRow[bandStart - 1];
+            cellCount.cells += static_cast<std::uint64_t>(std::max(0, bandEnd - bandStart + 1));
+
+            for (int j = bandStart; j <= bandEnd; ++j) {
+                const int substitutionCost = word1[i - 1] == word2[j - 1] ? 0 : 1;
+
+                int distance = std::min({previousRow[j] + 1, currentRow[j - 1] + 1, previousRow[j - 1] + substitutionCost});
+
+                if (i > 1 && j > 1 && word1[i - 1] == word2[j - 2] && word1[i - 2] == word2[j - 1])
+                    distance = std::min(distance, twoRowsBefore[j - 2] + 1);
+
+                currentRow[j] = std::min(distance, outOfBand);
+                rowMinimum = std::min(rowMinimum, currentRow[j]);
+            }
+
+            // The next row reads one cell past the band, which must not contain a value left by an older row
+            currentRow[bandEnd + 1] = outOfBand;
+
+            if (rowMinimum > maxDistance)
+                return outOfBand;
+
+            std::swap(twoRowsBefore, previousRow);
+            std::swap(previousRow, currentRow);
         }
 
-        if (word1Index > 1 && word2Index > 1 && word1[word1Index-1] == word2[word2Index-2] && word1[word1Index-2] == word2[word2Index-1]) {
-            results.push_back(calculateDistance(word1, word2, word1Index-2 , word2Index-2) + 1);
+        return previousRow[word2Length];
+    }
+
+    /**
+     * Bit-parallel version of the optimal string alignment distance (Hyyro, 2003), an extension of Myers' algorithm with transpositions.
+     * Each bit of the vertical delta vectors VP/VN represents one character of the pattern, so that a whole column of the distance
+     * table is advanced with a handful of word operations for each character of the candidate.
+     *
+     * @param pattern The precomputed match masks of the query, whose length must not exceed BIT_PARALLEL_MAX_LENGTH.
+     * @param word The candidate string, of any length.
+     * @param maxDistance The highest distance the caller is interested in, a negative value disables the cutoff.
+     *
+     * @returns The distance between the query and the candidate if it is lower or equal to maxDistance, maxDistance + 1 otherwise.
+     */
+    static int calculateBitParallelDistance(const QueryPattern& pattern, std::string_view word, int maxDistance) {
+        const int patternLength = pattern.length;
+        const int wordLength = static_cast<int>(word.size());
+
+        if (maxDistance < 0 || maxDistance > std::max(patternLength, wordLength))
+            maxDistance = std::max(patternLength, wordLength);
+
+        CellCount cellCount;
+
+        if (std::abs(patternLength - wordLength) > maxDistance) return maxDistance + 1;
+        if (patternLength == 0) return wordLength;
+        if (wordLength == 0) return patternLength;
+
+        const std::uint64_t lastBit = std::uint64_t{1} << (patternLength - 1);
+
+        std::uint64_t verticalPositive = ~std::uint64_t{0};
+        std::uint64_t verticalNegative = 0;
+        std::uint64_t diagonalZero = 0;
+        std::uint64_t previousMatchMask = 0;
+        int distance = patternLength;
+
+        for (int j = 0; j < wordLength; ++j) {
+            const std::uint64_t matchMask = pattern.matchMasks[static_cast<unsigned char>(word[j])];
+            cellCount.cells += static_cast<std::uint64_t>(patternLength);
+            const std::uint64_t transposition = (((~diagonalZero) & matchMask) << 1) & previousMatchMask;
+
+            diagonalZero = (((matchMask & verticalPositive) + verticalPositive) ^ verticalPositive) | matchMask | verticalNegative | transposition;
+
+            std::uint64_t horizontalPositive = verticalNegative | ~(diagonalZero | verticalPositive);
+            std::uint64_t horizontalNegative = diagonalZero & verticalPositive;
+
+            distance += (horizontalPositive & lastBit) != 0;
+            distance -= (horizontalNegative & lastBit) != 0;
+
+            // The last cell can decrease by at most one for each remaining character of the candidate
+            if (distance - (wordLength - j - 1) > maxDistance)
+                return maxDistance + 1;
+
+            horizontalPositive = (horizontalPositive << 1) | 1;
+            horizontalNegative = horizontalNegative << 1;
+
+            verticalPositive = horizontalNegative | ~(diagonalZero | horizontalPositive);
+            verticalNegative = horizontalPositive & diagonalZero;
+            previousMatchMask = matchMask;
         }
 
-        std::vector<int>::iterator result = std::min_element(results.begin(), results.end());
-        return  *result;
+        return std::min(distance, maxDistance + 1);
     }
 
 
@@ -68,36 +308,184 @@ public:
      * 
      * @returns The distance (integer) between the two words: 0 if they are identical, and greater than 0 if they differ.
      */
-    static int calculateWordDistance(std::string word1, std::string word2) {
-        int wordDistance = calculateDistance(word1, word2, word1.size(), word2.size());
+    static int calculateWordDistance(std::string_view word1, std::string_view word2) {
+        int wordDistance = calculateDistance(word1, word2, -1);
         return wordDistance;
     }
 
-    static std::map<std::string, int> calculateWordDistance(std::string word1, std::vector<std::string> wordList) {
-        std::map<std::string, int> distanceMap;
-        for(std::string entry : wordList)
-            distanceMap.insert(std::make_pair(entry, calculateWordDistance(word1, entry)));
+    /**
+     * Calculates the word distance between two strings using the Damerau-Leveshtein algorithm, giving up as soon as it
+     * is known to be greater than maxDistance.
+     * @param word1 the first string
+     * @param word2 the second string
+     * @param maxDistance the highest distance of interest, a negative value disables the cutoff
+     *
+     * @returns The distance between the two words if it is lower or equal to maxDistance, maxDistance + 1 otherwise.
+     */
+    static int calculateWordDistance(std::string_view word1, std::string_view word2, int maxDistance) {
+        return calculateDistance(word1, word2, maxDistance);
+    }
+
+    /**
+     * Calculates the unrestricted Damerau-Levenshtein distance (Lowrance-Wagner), in which a transposed pair can be further edited.
+     * Unlike the optimal string alignment distance returned by calculateWordDistance it satisfies the triangle inequality, so it
+     * is the one metric trees are built on. It is never greater than the optimal string alignment distance of the same words.
+     *
+     * The kernel is picked by the length of the longer word: words up to UNRESTRICTED_KERNEL_MAX_LENGTH characters, which
+     * are almost all binary names, use the kernel specialized for the smallest length class holding them, longer ones the
+     * generic kernel. Only the BK-tree computes this distance, so these kernels only speed up lookups with lookupEngine set
+     * to bkTree: the other engines score with the bit-parallel kernel, and with calculateDistance for the queries longer
+     * than BIT_PARALLEL_MAX_LENGTH, which no length class could hold either.
+     * @param word1 the first string
+     * @param word2 the second string
+     *
+     * @returns The unrestricted distance between the two words.
+     */
+    static int calculateUnrestrictedWordDistance(std::string_view word1, std::string_view word2) {
+        const std::size_t longestLength = std::max(word1.size(), word2.size());
+        if (longestLength <= 8)
+            return calculateUnrestrictedDistance<8>(word1, word2);
+        if (longestLength <= 16)
+            return calculateUnrestrictedDistance<16>(word1, word2);
+        if (longestLength <= 32)
+            return calculateUnrestrictedDistance<32>(word1, word2);
+        if (longestLength <= UNRESTRICTED_KERNEL_MAX_LENGTH)
+            return calculateUnrestrictedDistance<UNRESTRICTED_KERNEL_MAX_LENGTH>(word1, word2);
+        return calculateGenericUnrestrictedWordDistance(word1, word2);
+    }
+
+    /**
+     * Generic kernel of calculateUnrestrictedWordDistance, for words of any length.
+     * @param word1 the first string
+     * @param word2 the second string
+     *
+     * @returns The unrestricted distance between the two words.
+     */
+    static int calculateGenericUnrestrictedWordDistance(std::string_view word1, std::string_view word2) {
+        const int word1Length = static_cast<int>(word1.size());
+        const int word2Length = static_cast<int>(word2.size());
+
+        CellCount cellCount;
+
+        if (word1Length == 0) return word2Length;
+        if (word2Length == 0) return word1Length;
+
+        cellCount.cells = static_cast<std::uint64_t>(word1Length) * static_cast<std::uint64_t>(word2Length);
+        const int infinity = word1Length + word2Length;
+        const std::size_t rowSize = static_cast<std::size_t>(word2Length) + 2;
+
+        // table[(i + 1) * rowSize + (j + 1)] holds the distance between the first i characters of word1 and the first j of word2
+        const std::size_t tableSize = rowSize * (static_cast<std::size_t>(word1Length) + 2);
+        std::array<int, WORD_DISTANCE_STACK_CELLS> stackTable;
+        int * table = getTable(stackTable, tableSize);
+        std::fill(table, table + tableSize, 0);
+        auto cell = [&](int i, int j) -> int& { return table[static_cast<std::size_t>(i) * rowSize + static_cast<std::size_t>(j)]; };
+
+        // Last row of word1 in which each character was seen
+        std::array<int, 256> lastRowOfCharacter{};
+
+        cell(0, 0) = infinity;
+        for (int i = 0; i <= word1Length; ++i) {
+            cell(i + 1, 0) = infinity;
+            cell(i + 1, 1) = i;
+        }
+        for (int j = 0; j <= word2Length; ++j) {
+            cell(0, j + 1) = infinity;
+            cell(1, j + 1) = j;
+        }
+
+        for (int i = 1; i <= word1Length; ++i) {
+            int lastMatchingColumn = 0;
+            for (int j = 1; j <= word2Length; ++j) {
+                const int transpositionRow = lastRowOfCharacter[static_cast<unsigned char>(word2[j - 1])];
+                const int transpositionColumn = lastMatchingColumn;
+                int substitutionCost = 1;
+                if (word1[i - 1] == word2[j - 1]) {
+                    substitutionCost = 0;
+                    lastMatchingColumn = j;
+                }
+
+                cell(i + 1, j + 1) = std::min({
+                    cell(i, j) + substitutionCost,
+                    cell(i + 1, j) + 1,
+                    cell(i, j + 1) + 1,
+                    cell(transpositionRow, transpositionColumn) + (i - transpositionRow - 1) + 1 + (j - transpositionColumn - 1)
+                });
+            }
+            lastRowOfCharacter[static_cast<unsigned char>(word1[i - 1])] = i;
+        }
 
-        return distanceMap;
+        return cell(word1Length + 1, word2Length + 1);
     }
 
-    static std::map<std::string, int> calculateWordDistance(std::string word1, std::set<std::string> wordSet) {
-        std::map<std::string, int> distanceMap;
-        for(std::string entry : wordSet)
-            distanceMap.insert(std::make_pair(entry, calculateWordDistance(word1, entry)));
+    /**
+     * Checks whether a query is short enough to be scored with the bit-parallel kernel.
+     * @param query the string typed by the user
+     *
+     * @returns true if every character of the query fits in one bit of a machine word.
+     */
+    static bool isBitParallelEligible(std::string_view query) {
+        return query.size() <= BIT_PARALLEL_MAX_LENGTH;
+    }
 
-        return distanceMap;
-    }    
+    /**
+     * Precomputes the per-character match masks of a query for the bit-parallel kernel.
+     * @param query the string typed by the user, at most BIT_PARALLEL_MAX_LENGTH characters long
+     *
+     * @returns the match masks of the query.
+     */
+    static QueryPattern buildQueryPattern(std::string_view query) {
+        QueryPattern pattern;
+        pattern.length = static_cast<int>(query.size());
+        for (std::size_t i = 0; i < query.size(); ++i)
+            pattern.matchMasks[static_cast<unsigned char>(query[i])] |= std::uint64_t{1} << i;
+        return pattern;
+    }
 
     /**
-     * Prints a map of words and their distances.
-     * 
-     * @param distanceMap A map where the key is a word (string)
-     *        and the value is the word's distance (int).
+     * Calculates the word distance between a precomputed query and a candidate with the bit-parallel kernel.
+     * @param pattern the match masks returned by buildQueryPattern
+     * @param word the candidate string
+     * @param maxDistance the highest distance of interest, a negative value disables the cutoff
+     *
+     * @returns The distance between the two words if it is lower or equal to maxDistance, maxDistance + 1 otherwise.
      */
-    static void printDistanceMap(const std::map<std::string, int>& distanceMap) {
-        for (const auto& pair : distanceMap) {
-            std::cout << "Word: " << pair.first << ", Distance: " << pair.second << std::endl;
+    static int calculateWordDistance(const QueryPattern& pattern, std::string_view word, int maxDistance = -1) {
+        return calculateBitParallelDistance(pattern, word, maxDistance);
+    }
+
+    /**
+     * Computes one row of the optimal string alignment table of a query against a word built one character at a time, as
+     * in a walk down a trie, where the rows of the shared prefixes are computed once for all the words starting with them.
+     * Row i holds the distances between the first i characters of the word and every prefix of the query, row 0 being
+     * 0, 1, ..., query.size(). Rows never decrease in minimum, so a walk can give up on a prefix, and on every word
+     * starting with it, as soon as the minimum of its row exceeds the distance it is interested in.
+     * @param query the string typed by the user
+     * @param twoRowsBefore row i - 2, read only when i > 1, for the transpositions
+     * @param previousRow row i - 1
+     * @param currentRow where row i is written, query.size() + 1 cells
+     * @param i the number of characters of the word so far, at least 1
+     * @param character the i-th character of the word
+     * @param previousCharacter the (i - 1)-th character of the word, ignored when i == 1
+     *
+     * @returns The minimum of row i.
+     */
+    static int calculateNextRow(std::string_view query, const int * twoRowsBefore, const int * previousRow, int * currentRow, int i, char character, char previousCharacter) {
+        const int queryLength = static_cast<int>(query.size());
+
+        currentRow[0] = i;
+        int rowMinimum = i;
+        for (int j = 1; j <= queryLength; ++j) {
+            const int substitutionCost = character == query[j - 1] ? 0 : 1;
+
+            int distance = std::min({previousRow[j] + 1, currentRow[j - 1] + 1, previousRow[j - 1] + substitutionCost});
+
+            if (i > 1 && j > 1 && character == query[j - 2] && previousCharacter == query[j - 1])
+                distance = std::min(distance, twoRowsBefore[j - 2] + 1);
+
+            currentRow[j] = distance;
+            rowMinimum = std::min(rowMinimum, distance);
         }
+        return rowMinimum;
     }
 };
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef SMILE_H
+#define SMILE_H
+
+#include <stddef.h>
+
+/*
+ * C interface of libsmile, the lookup engine behind smile --i, for the programs which embed it instead of running the
+ * smile binary: shells, editors and language bindings. The engine reads the settings of ~/.smile like the binary, and
+ * keeps the index and the lookup structures resident from one query to the next.
+ *
+ * An engine is meant to be used from a single thread. Every function returns a negative value on error.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct smile_engine smile_engine;
+
+/**
+ * @return a new engine, loaded from the settings of the user, or NULL on error. The index is only loaded by the first
+ * refresh.
+ */
+smile_engine * smile_engine_create(void);
+
+/**
+ * Releases an engine, NULL is ignored.
+ */
+void smile_engine_destroy(smile_engine * engine);
+
+/**
+ * Brings the index up to date with the binaries directories and reloads the history.
+ *
+ * @return the number of directories which did not answer within the latency budget, or -1 on error.
+ */
+int smile_engine_refresh(smile_engine * engine);
+
+/**
+ * Looks up the binaries closest to an input command, ranked by the history.
+ *
+ * @param input the command to correct, NUL-terminated
+ * @param max_results the maximum number of suggestions, 0 for the maxSuggestions of the settings
+ * @param results filled with at most capacity suggestions, most relevant first, valid until the next call on the engine
+ * @param capacity the number of entries of results
+ * @return the number of suggestions, which can exceed capacity like with snprintf, or -1 on error.
+ */
+int smile_engine_query(smile_engine * engine, const char * input, size_t max_results, const char ** results, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
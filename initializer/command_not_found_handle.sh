@@ -1,6 +1,8 @@
 command_not_found_handle() {
 
     declare attempted_command="$1"
+    # The smile builtin, when enabled, answers from the index kept in the shell without running the smile binary
+    builtin smile "$attempted_command" 2>/dev/null && return 0
     /usr/bin/smile --i $attempted_command
     return 0
 }
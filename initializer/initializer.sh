@@ -6,4 +6,27 @@ if ! grep -q 'command_not_found_handle' ~/.bashrc; then
 	cat ./initializer/command_not_found_handle.sh >> ~/.bashrc
 else
 	echo "Initializer: the command_not_found_handle is already in the .bashrc file"
-fi
\ No newline at end of file
+fi
+
+# The executions are recorded from PROMPT_COMMAND, for the suggestions to be ranked by the history
+echo "Checking if the smile history hook is in the .bashrc file..."
+if ! grep -q '__smile_record_last_command' ~/.bashrc; then
+	echo "Initializer: the smile history hook is not in the .bashrc file. Appending it..."
+	cat ./initializer/record_prompt_command.sh >> ~/.bashrc
+else
+	echo "Initializer: the smile history hook is already in the .bashrc file"
+fi
+
+# The smile builtin answers the lookups from within the shell, the command_not_found_handle falls back to the smile
+# binary when it is not installed or cannot be enabled
+SMILE_BUILTIN=/usr/lib/bash/libsmile_builtin.so
+
+echo "Checking if the smile builtin is enabled in the .bashrc file..."
+if [ ! -f "$SMILE_BUILTIN" ]; then
+	echo "Initializer: the smile builtin is not installed, the smile binary will be used"
+elif ! grep -q 'libsmile_builtin.so' ~/.bashrc; then
+	echo "Initializer: the smile builtin is not enabled in the .bashrc file. Appending it..."
+	echo "[ -f $SMILE_BUILTIN ] && enable -f $SMILE_BUILTIN smile 2>/dev/null" >> ~/.bashrc
+else
+	echo "Initializer: the smile builtin is already enabled in the .bashrc file"
+fi
@@ -0,0 +1,15 @@
+
+# Records the binary run by the last command line in the smile history, once per history entry and off the prompt
+__smile_record_last_command() {
+    declare last_status=$?
+    declare history_number command_name
+    read -r history_number command_name _ <<< "$(HISTTIMEFORMAT= builtin history 1)"
+    # The first prompt only notes the last entry of the history file, which was recorded by the previous shell
+    if [ -n "${__smile_last_recorded_entry+x}" ] && [ "$history_number" != "$__smile_last_recorded_entry" ] \
+        && [ -n "$command_name" ] && type -P "$command_name" >/dev/null; then
+        ( /usr/bin/smile --record "${command_name##*/}" >/dev/null 2>&1 & )
+    fi
+    __smile_last_recorded_entry=$history_number
+    return $last_status
+}
+PROMPT_COMMAND="__smile_record_last_command${PROMPT_COMMAND:+;$PROMPT_COMMAND}"
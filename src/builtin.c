@@ -0,0 +1,164 @@
+/*
+ * Bash loadable builtin answering the lookups of command_not_found_handle from within the shell, without running the
+ * smile binary: enable -f libsmile_builtin.so smile
+ *
+ * The engine is loaded when the builtin is enabled, so that the index, the lookup structures and the query cache stay
+ * mapped in the shell. Bash runs command_not_found_handle in a forked child, which inherits them: a lookup costs the
+ * stat of the binaries directories, and a rescan only when their mtime changed. The engine is created again when the
+ * settings file changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "loadables.h"
+
+#include "../include/smile.h"
+
+/* Number of suggestions the results array holds before a lookup has to be repeated with a larger one */
+#define SMILE_BUILTIN_RESULTS_CAPACITY 64
+
+static smile_engine * engine = NULL;
+static struct timespec settingsModificationTime;
+
+static int getSettingsModificationTime(struct timespec * modificationTime) {
+    const char * home = getenv("HOME");
+    char settingsFilePath[4096];
+    struct stat status;
+
+    if (home == NULL || snprintf(settingsFilePath, sizeof(settingsFilePath), "%s/.smile/settings.json", home) >= (int) sizeof(settingsFilePath))
+        return 0;
+    if (stat(settingsFilePath, &status) != 0)
+        memset(&status, 0, sizeof(status));
+    *modificationTime = status.st_mtim;
+    return 1;
+}
+
+/*
+ * Creates the engine, again if the settings changed since it was created, and refreshes its index.
+ */
+static int loadEngine(void) {
+    struct timespec modificationTime;
+
+    /* The settings are read from $HOME, like the smile binary does */
+    if (!getSettingsModificationTime(&modificationTime))
+        return 0;
+
+    if (engine != NULL && (modificationTime.tv_sec != settingsModificationTime.tv_sec || modificationTime.tv_nsec != settingsModificationTime.tv_nsec)) {
+        smile_engine_destroy(engine);
+        engine = NULL;
+    }
+
+    if (engine == NULL) {
+        engine = smile_engine_create();
+        if (engine == NULL)
+            return 0;
+        /* Creating the engine may have generated the settings file */
+        getSettingsModificationTime(&settingsModificationTime);
+    }
+
+    return smile_engine_refresh(engine) >= 0;
+}
+
+/*
+ * Prints the suggestions the same way as the smile binary does.
+ */
+static void printSuggestions(const char * inputCommand, const char ** results, int count) {
+    int i;
+
+    if (count == 0)
+        printf("Could not find any similar commands to \"%s\"\n", inputCommand);
+    else if (count == 1)
+        printf("Could not find command %s. Were you looking for \"%s\"?\n", inputCommand, results[0]);
+    else {
+        printf("Could not find command %s. Were you looking for these?\n", inputCommand);
+        for (i = 0; i < count; ++i)
+            printf("- %s\n", results[i]);
+    }
+    fflush(stdout);
+}
+
+int smile_builtin(WORD_LIST * list) {
+    const char * inputCommand;
+    const char * fixedResults[SMILE_BUILTIN_RESULTS_CAPACITY];
+    const char ** results = fixedResults;
+    int count;
+
+    if (no_options(list))
+        return EX_USAGE;
+    list = loptend;
+    if (list == NULL || list->next != NULL) {
+        builtin_usage();
+        return EX_USAGE;
+    }
+    inputCommand = list->word->word;
+
+    if (!loadEngine()) {
+        builtin_error("could not load the binary index");
+        return EXECUTION_FAILURE;
+    }
+
+    count = smile_engine_query(engine, inputCommand, 0, results, SMILE_BUILTIN_RESULTS_CAPACITY);
+    if (count > SMILE_BUILTIN_RESULTS_CAPACITY) {
+        results = malloc(sizeof(*results) * (size_t) count);
+        if (results == NULL) {
+            builtin_error("out of memory");
+            return EXECUTION_FAILURE;
+        }
+        count = smile_engine_query(engine, inputCommand, 0, results, (size_t) count);
+    }
+
+    if (count < 0) {
+        builtin_error("could not look up %s", inputCommand);
+        if (results != fixedResults)
+            free(results);
+        return EXECUTION_FAILURE;
+    }
+
+    printSuggestions(inputCommand, results, count);
+    if (results != fixedResults)
+        free(results);
+    return EXECUTION_SUCCESS;
+}
+
+/*
+ * Called by enable -f: the engine is loaded in the shell itself, so that the children running command_not_found_handle
+ * inherit it. The builtin is enabled even if it fails, the engine being created again on the first lookup.
+ */
+int smile_builtin_load(char * name) {
+    (void) name;
+    loadEngine();
+    return 1;
+}
+
+/*
+ * Called by enable -d.
+ */
+void smile_builtin_unload(char * name) {
+    (void) name;
+    smile_engine_destroy(engine);
+    engine = NULL;
+}
+
+char * smile_doc[] = {
+    "Suggest the binaries closest to a mistyped command.",
+    "",
+    "Looks up COMMAND in the index of the binaries directories kept by the",
+    "shell, and prints the closest binaries ranked by the history, like",
+    "smile --i COMMAND does without running the smile binary.",
+    "",
+    "Exit Status:",
+    "Returns success unless the index could not be loaded.",
+    (char *) NULL
+};
+
+struct builtin smile_struct = {
+    "smile",
+    smile_builtin,
+    BUILTIN_ENABLED,
+    smile_doc,
+    "smile COMMAND",
+    0
+};
@@ -0,0 +1,63 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../include/smile.h"
+#include "../include/Settings.hpp"
+#include "../include/Engine.hpp"
+
+/**
+ * The engine behind the C interface, with the suggestions of the last query copied out of the arena of the engine so
+ * that they stay NUL-terminated.
+ */
+struct smile_engine {
+    Settings settings;
+    Engine engine{settings};
+    std::vector<std::string> results;
+};
+
+extern "C" {
+
+smile_engine * smile_engine_create(void) {
+    try {
+        return new smile_engine();
+    }
+    catch (const std::exception& e) {
+        Log::error("Could not create the engine: {}", e.what());
+        return nullptr;
+    }
+}
+
+void smile_engine_destroy(smile_engine * engine) {
+    delete engine;
+}
+
+int smile_engine_refresh(smile_engine * engine) {
+    if (engine == nullptr)
+        return -1;
+    try {
+        engine->results.clear();
+        return static_cast<int>(engine->engine.refresh().size());
+    }
+    catch (const std::exception& e) {
+        Log::error("Could not refresh the index: {}", e.what());
+        return -1;
+    }
+}
+
+int smile_engine_query(smile_engine * engine, const char * input, size_t max_results, const char ** results, size_t capacity) {
+    if (engine == nullptr || input == nullptr || (results == nullptr && capacity > 0))
+        return -1;
+    try {
+        const std::pmr::vector<std::string_view> similarCommands = engine->engine.query(input, max_results);
+        engine->results.assign(similarCommands.begin(), similarCommands.end());
+        for (std::size_t i = 0; i < std::min(engine->results.size(), capacity); ++i)
+            results[i] = engine->results[i].c_str();
+        return static_cast<int>(engine->results.size());
+    }
+    catch (const std::exception& e) {
+        Log::error("Could not look up {}: {}", input, e.what());
+        return -1;
+    }
+}
+
+}
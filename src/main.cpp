@@ -2,9 +2,16 @@
 #include <map>
 #include <set>
 #include <cmath>
+#include <chrono>
 #include <unordered_set>
 #include "../include/Settings.hpp"
 #include "../include/WordDistanceHandler.hpp"
+#include "../include/CommandSuggester.hpp"
+#include "../include/Engine.hpp"
+#include "../include/SmileDaemon.hpp"
+#include "../include/BatchSuggester.hpp"
+#include "../include/HistoryJournal.hpp"
+#include "../include/Stats.hpp"
 
 #include <boost/program_options.hpp>
 
@@ -21,108 +28,80 @@ namespace po = boost::program_options;
  * @param settings The settings object containing configuration such as system path variables and heuristics for matching.
  * @return true if similar commands are found, otherwise false if no suggestions can be made.
  */
-bool suggestCommands(const po::variables_map vm, std::string inputCommand, Settings settings) {
-    spdlog::info("Printing content of system path vector");
+bool suggestCommands(const po::variables_map& vm, const std::string& inputCommand, Settings& settings) {
+    Log::info("Printing content of system path vector");
 
     // If verbose mode enabled print the content of the system path vector
     if (vm.count("v"))
         CommonUtils::printVector(settings.getSystemPathVariablePaths());
 
-    // Moving system path to a new data structure
-    std::set<std::string> systemPathVariableSet;
-    for (const auto &entry : settings.getSystemPathVariablePaths()) {
-        std::vector<std::string> filesInPath = CommonUtils::getListOfFilesInPath(entry, false, true);
-        systemPathVariableSet.insert(filesInPath.begin(), filesInPath.end());
-    }
+    // Loading the binaries of the system path from the persistent index, only the directories modified since the last run
+    // are rescanned. A directory on a hung mount cannot hold the shell past the latency budget
+    Engine engine(settings);
+    const std::vector<std::string>& lateDirectories = engine.refresh();
 
-    spdlog::info("Printing content of system path set");
+    Log::info("Printing content of system path set");
 
     // If verbose mode enabled print the set
     if (vm.count("v"))
-        CommonUtils::printSet(systemPathVariableSet);
-
-    spdlog::info("Before filtering set size: {}", systemPathVariableSet.size());
-
-    std::set<std::string> systemPathVariableFilteredSet;
-
-    spdlog::info("Applying length distance heuristic based on a maximum difference in length of {}", settings.getLengthConditionHeuristic());
-    if (settings.getLengthConditionHeuristicEnabled()) {
-
-        std::copy_if(
-            systemPathVariableSet.begin(), 
-            systemPathVariableSet.end(), 
-            std::inserter(systemPathVariableFilteredSet, systemPathVariableFilteredSet.end()), 
-            [inputCommand, settings](const std::string& value){
-                
-                int absoluteLengthLetterDifference = std::abs(static_cast<int>(value.length()) - static_cast<int>(inputCommand.length()));    
-
-                // This heuristic is used to improve runtimes by reducing the numbers of binaries to check based on the total amount of
-                // length differencies between the two words. By default, if their length is different by two or more letters, their
-                // distance do not get calculated
-                bool lengthCondition = absoluteLengthLetterDifference <= settings.getLengthConditionHeuristic();
-
-                if (!lengthCondition)
-                    return lengthCondition;
-
-                std::unordered_set<char> inputCommandCharSet = CommonUtils::getSetOfUniqueCharFromString(inputCommand);
-                std::unordered_set<char> currentBinaryCharSet = CommonUtils::getSetOfUniqueCharFromString(value);
-                
-                std::unordered_set<char> intersectionSet;
-                for (char ch : inputCommandCharSet) {
-                    if (currentBinaryCharSet.find(ch) != currentBinaryCharSet.end())
-                        intersectionSet.insert(ch);
-                }
-                
-                bool letterCondition = intersectionSet.size() >= (inputCommandCharSet.size() / 2);
-
-                return letterCondition;
-            }
-        );
-    } else
-        systemPathVariableFilteredSet = systemPathVariableSet;
+        CommonUtils::printSet(engine.getBinaryIndex().getNames());
 
-    if (settings.getLengthConditionHeuristicEnabled()) {
-        spdlog::info("After filtering set size: {}", systemPathVariableFilteredSet.size());
+    const std::pmr::vector<std::string_view> similarCommands = engine.query(inputCommand);
 
-        spdlog::info("Printing content of system path set after filtering");
-        // If verbose mode enabled print the newly filtered set
-        if (vm.count("v"))
-            CommonUtils::printSet(systemPathVariableFilteredSet);
-    }
+    const bool found = CommandSuggester::printSuggestions(inputCommand, similarCommands);
+    for (const std::string& directory : lateDirectories)
+        std::cerr<<"note: "<<directory<<" did not answer within "<<settings.getMaxLatencyMs()<<" ms, its binaries may be missing or outdated\n";
+    return found;
+}
 
-    spdlog::info("Calculating distance Map");
-    std::map<std::string, int> distanceMap = WordDistanceHandler::calculateWordDistance(inputCommand, systemPathVariableFilteredSet);
+/**
+ * Emits the stats of the lookup, if enabled with --stats: on stderr, or appended to the stats log in the settings
+ * directory with --stats=log.
+ */
+void emitStats(const po::variables_map& vm, const std::string& inputCommand, std::chrono::steady_clock::time_point start) {
+    Stats& stats = Stats::get();
+    if (!stats.isEnabled())
+        return;
+
+    stats.addSpan("total", std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+
+    const CommonUtils::ScanCounters& scanCounters = CommonUtils::getScanCounters();
+    stats.setCounter("directoriesScanned", scanCounters.directoriesScanned);
+    stats.setCounter("directoryReadCalls", scanCounters.directoryReadCalls);
+    stats.setCounter("entriesRead", scanCounters.entriesRead);
+    stats.setCounter("filesStated", scanCounters.metadataCalls);
+
+    const WordDistanceHandler::DistanceCounters& distanceCounters = WordDistanceHandler::getDistanceCounters();
+    stats.setCounter("distanceComputations", distanceCounters.distanceComputations);
+    stats.setCounter("distanceCells", distanceCounters.cellsComputed);
+
+    std::filesystem::path logFilePath;
+    if (vm["stats"].as<std::string>() == "log") {
+        const char * home = getenv("HOME");
+        logFilePath = std::filesystem::path(home != nullptr ? home : "") / ("." PROJECT_NAME) / STATS_LOG_FILENAME;
+    }
 
-    if (distanceMap.size() == 0) {
-        std::cout<<"Could not find any similar commands to \""<<inputCommand<<"\"\n";
-        return false;
-    } 
+    if (!stats.emit(inputCommand, logFilePath))
+        std::cerr<<"error: could not write the stats in "<<logFilePath.string()<<"\n";
+}
 
-    int minValueInMap = INT_MAX;
-    for (auto const &entry : distanceMap) {
-        if (entry.second < minValueInMap)
-            minValueInMap = entry.second;
+/**
+ * Loads the settings, ending the process when the settings file can neither be read nor generated.
+ */
+Settings loadSettings() {
+    try {
+        return Settings();
     }
-
-    std::vector<std::string> similarCommands;
-    for (auto const &entry : distanceMap) {
-        if (entry.second == minValueInMap) {
-            similarCommands.push_back(entry.first);
-        }
+    catch (const std::exception& e) {
+        std::cerr<<"error: "<<e.what()<<"\n";
+        exit(1);
     }
-
-    if (similarCommands.size() > 1) {
-        std::cout<<"Could not find command " + inputCommand + ". Were you looking for these?\n";
-        for (auto const &entry : similarCommands)
-            std::cout<<"- "<<entry<<"\n";
-    } else 
-        std::cout<<"Could not find command " + inputCommand + ". Were you looking for \"" + similarCommands[0]<<"\"?\n";
-
-    return true;
 }
 
 int main(int argc, char* argv[]) {
 
+    const auto start = std::chrono::steady_clock::now();
+
     std::string inputCommand;
     
     po::variables_map vm;        
@@ -134,19 +113,26 @@ int main(int argc, char* argv[]) {
             ("i", po::value<std::string>(), "The input command")
             ("e", "Edit the configuration file")
             ("v", "Verbose mode")
+            ("batch", po::value<std::string>()->implicit_value(""), "Look up every line of stdin, or of the file given with --batch=FILE, printing the suggestions as one JSON line per input line")
+            ("record", po::value<std::string>(), "Record an execution of the given command in the history")
+            ("daemon", "Run as a resident daemon answering the queries of the other instances")
+            ("stats", po::value<std::string>()->implicit_value(""), "Print the timings and counters of the lookup as a JSON line on stderr, or append it to ~/.smile/" STATS_LOG_FILENAME " with --stats=log")
             ("help", "Produce a help message");
 
         po::store(po::parse_command_line(argc, argv, desc), vm);
         po::notify(vm);    
 
         
-        if (!vm.count("v")) {
-            spdlog::set_level(spdlog::level::off);
-        }
+        // Logging is only set up in verbose mode, other runs never initialize spdlog
+        if (vm.count("v"))
+            Log::enable();
+
+        if (vm.count("stats"))
+            Stats::get().enable();
 
         if (vm.count("i")) {
             inputCommand = vm["i"].as<std::string>();
-            spdlog::info("Specified input command: {}", inputCommand);
+            Log::info("Specified input command: {}", inputCommand);
         }
 
         if (vm.count("e")) {
@@ -169,13 +155,70 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    Settings settings;
+    if (vm.count("batch")) {
+        const std::string batchFilePath = vm["batch"].as<std::string>();
+        std::ifstream batchFile;
+        if (!batchFilePath.empty()) {
+            batchFile.open(batchFilePath);
+            if (!batchFile.is_open()) {
+                std::cerr<<"error: could not open "<<batchFilePath<<"\n";
+                return 1;
+            }
+        }
+
+        Settings settings = loadSettings();
+        BatchSuggester batchSuggester(settings);
+        std::size_t processedLines;
+        {
+            Stats::Span span("batch");
+            processedLines = batchSuggester.run(batchFilePath.empty() ? std::cin : batchFile, std::cout, ThreadPool::getThreadCount(SIZE_MAX));
+        }
+        Stats::get().setCounter("batchLines", processedLines);
+        emitStats(vm, batchFilePath, start);
+        return 0;
+    }
+
+    // Recording only appends to the journal, its flush into the history database is left to the daemon, or to a child
+    // once the journal is large enough
+    if (vm.count("record")) {
+        Settings settings = loadSettings();
+        HistoryJournal::record(settings, vm["record"].as<std::string>());
+        if (HistoryJournal::needsFlush(settings))
+            HistoryJournal::flushInBackground();
+        return 0;
+    }
 
-    //TODO: enable database insertion for history if enabled
+    // The resident daemon, when running, answers without loading the settings nor the index. Verbose mode always
+    // runs the lookup in-process so that its details are printed
+    if (vm.count("i") && !vm.count("v") && !vm.count("daemon")) {
+        std::vector<std::string> similarCommands;
+        bool answered;
+        {
+            Stats::Span span("daemonQuery");
+            answered = SmileDaemon::query(inputCommand, similarCommands);
+        }
+        if (answered) {
+            CommandSuggester::printSuggestions(inputCommand, similarCommands);
+            Stats::get().setCounter("suggestions", similarCommands.size());
+            emitStats(vm, inputCommand, start);
+            return 0;
+        }
+    }
 
-    //TODO: order results by most similar characters from the start to give more appropriate results?
+    if (vm.count("daemon")) {
+        SmileDaemon daemon;
+        return daemon.run();
+    }
+
+    Settings settings = loadSettings();
+
+    // The recorded commands are flushed off the lookup, the history is up to date from the next one
+    if (HistoryJournal::needsFlush(settings))
+        HistoryJournal::flushInBackground();
 
     suggestCommands(vm, inputCommand, settings);
 
+    emitStats(vm, inputCommand, start);
+
     return 0;
 }
\ No newline at end of file